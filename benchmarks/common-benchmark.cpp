@@ -0,0 +1,81 @@
+#include "config.h"
+#include "util.h"
+#include "common-benchmark.h"
+
+#include <iostream>
+#include <chrono>
+#include <stdexcept>
+
+using namespace std;
+
+/**
+  \return average time in milliseconds of single extraction
+  */
+double time_extraction(const function<MCMesh()>& extract, size_t& verts)
+{
+	//first run compiles kernels lazily on some platforms
+	verts = extract().verts.size();
+	auto start = chrono::steady_clock::now();
+	for(unsigned int i=0; i<REPETITIONS; i++) {
+		extract();
+	}
+	auto end = chrono::steady_clock::now();
+	return chrono::duration<double, milli>(end - start).count() / REPETITIONS;
+}
+
+/**
+  Measures op on the device with markers enqueued before and after it, so
+  only kernels enqueued by op are timed, not the host. queue must be
+  created with profiling enabled.
+  \return average time in milliseconds of single run of op
+  */
+double time_on_device(const cl::CommandQueue& queue, const function<void()>& op)
+{
+	//first run compiles kernels lazily on some platforms
+	op();
+	cl::Event start, end;
+	queue.enqueueMarker(&start);
+	for(unsigned int i=0; i<REPETITIONS; i++) {
+		op();
+	}
+	queue.enqueueMarker(&end);
+	end.wait();
+	cl_ulong t0 = start.getProfilingInfo<CL_PROFILING_COMMAND_END>();
+	cl_ulong t1 = end.getProfilingInfo<CL_PROFILING_COMMAND_END>();
+	return (t1 - t0) * 1e-6 / REPETITIONS;
+}
+
+/**
+  \return overlapping blobs filling most of the (-2.5, 2.5) cube
+  */
+vector<float4> benchmark_blobs()
+{
+	return vector<float4>{
+		{0.0f, 0.0f, 0.0f, 3.0f},
+		{1.0f, 0.5f, 0.0f, 1.5f},
+		{-1.0f, -0.5f, 0.8f, 1.2f},
+		{0.3f, -1.2f, -0.7f, 1.0f}
+	};
+}
+
+/**
+  Runs body of a benchmark and reports its errors.
+  \return exit code of the benchmark
+  */
+int run_benchmark(const function<void()>& body)
+{
+	try {
+		body();
+	} catch ( cl::Error &e ) {
+		cerr
+		  << "OpenCL runtime error at function " << endl
+		  << e.what() << endl
+		  << "Error code: "<< endl
+		  << errorString(e.err()) << endl;
+		return 1;
+	} catch (runtime_error &e) {
+		cerr << e.what() << endl;
+		return 1;
+	}
+	return 0;
+}
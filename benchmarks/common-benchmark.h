@@ -0,0 +1,33 @@
+#ifndef __MCBLOB_COMMON_BENCHMARK_H__
+#define __MCBLOB_COMMON_BENCHMARK_H__
+
+#include <cstddef>
+#include <functional>
+#include <vector>
+
+#include <CL/cl.hpp>
+
+#include "common/mathtypes.h"
+#include "marchingcubes.h"
+
+/*
+ * Helpers shared by benchmarks: timing of whole extractions on the host,
+ * timing of single kernels with profiling events, and the scene of blobs
+ * all of them evaluate.
+ */
+
+/** Number of timed runs averaged by every measurement */
+static const unsigned int REPETITIONS = 10;
+
+double time_extraction(const std::function<MCMesh()>& extract, size_t& verts);
+
+double time_on_device(
+	const cl::CommandQueue& queue,
+	const std::function<void()>& op
+);
+
+std::vector<float4> benchmark_blobs();
+
+int run_benchmark(const std::function<void()>& body);
+
+#endif //__MCBLOB_COMMON_BENCHMARK_H__
@@ -0,0 +1,64 @@
+#include "config.h"
+#include "context.h"
+#include "grid.h"
+#include "blob.h"
+#include "marchingcubes.h"
+#include "histopyramid.h"
+#include "common-benchmark.h"
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+
+using namespace std;
+
+/*
+ * Compares time of scan based Marching cubes (MarchingCubes) with histogram
+ * pyramid one (HistoPyramid) for blocks of different sizes. Both engines
+ * extract the same, already evaluated grid.
+ */
+
+static const unsigned int BLOCK_DIMS[] = {16, 32, 64, 128, 256};
+
+int main()
+{
+	return run_benchmark([]() {
+		Context ctx{false};
+		vector<float4> blobs = benchmark_blobs();
+		
+		cout << setw(8) << "block" << setw(12) << "vertices"
+		     << setw(12) << "scan [ms]" << setw(12) << "hpmc [ms]" << endl;
+		for(unsigned int dim : BLOCK_DIMS) {
+			Grid grid(
+				uint3(dim, dim, dim),
+				float3(5.0f / dim, 5.0f / dim, 5.0f / dim),
+				float3(-2.5f, -2.5f, -2.5f),
+				ctx.getClContext(),
+				ctx.getQueues()[0],
+				ctx.getMemsetKernel(),
+				Grid::Format::SCALAR
+			);
+			grid.clear();
+			ctx.getBlobProgram()->runBlob(blobs.data(), blobs.size(), grid);
+			
+			size_t scanVerts, hpVerts;
+			double scanTime = time_extraction(
+				[&]() { return ctx.getMcProgram()->compute(grid, 1.0f); },
+				scanVerts
+			);
+			double hpTime = time_extraction(
+				[&]() { return ctx.getHpProgram()->compute(grid, 1.0f); },
+				hpVerts
+			);
+			if(scanVerts != hpVerts) {
+				ostringstream msg;
+				msg << "Vertex count mismatch for block " << dim;
+				throw runtime_error(msg.str());
+			}
+			cout << setw(8) << dim << setw(12) << scanVerts
+			     << setw(12) << fixed << setprecision(2) << scanTime
+			     << setw(12) << hpTime << endl;
+		}
+	});
+}
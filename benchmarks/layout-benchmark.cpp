@@ -0,0 +1,130 @@
+#include "config.h"
+#include "context.h"
+#include "grid.h"
+#include "blob.h"
+#include "marchingcubes.h"
+#include "scan.h"
+#include "util.h"
+#include "common-benchmark.h"
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+
+using namespace std;
+
+/*
+ * Compares throughput of the kernels reading the lattice, blob evaluation,
+ * voxel classification and triangle generation, on grids stored in linear
+ * and bricked layout (see Grid::Layout) for blocks of different sizes.
+ * Every kernel is timed on its own with profiling events, its inputs are
+ * prepared by the previous stages beforehand.
+ */
+
+static const unsigned int BLOCK_DIMS[] = {32, 64, 128, 256};
+static const float ISO_VALUE = 1.0f;
+
+/** Throughput of the kernels on a single grid */
+struct LayoutThroughput {
+	double blobValue;    /**< millions of lattice points per second */
+	double classify;     /**< millions of voxels per second */
+	double generate;     /**< millions of vertices per second */
+	unsigned int verts;
+};
+
+static LayoutThroughput measure_layout(
+	Context& ctx,
+	const vector<float4>& blobs,
+	unsigned int dim,
+	Grid::Layout layout)
+{
+	cl::CommandQueue queue = ctx.getQueues()[0];
+	MarchingCubes* mc = ctx.getMcProgram();
+	Scan* scan = ctx.getScanProgram();
+	Grid grid(
+		uint3(dim, dim, dim),
+		float3(5.0f / dim, 5.0f / dim, 5.0f / dim),
+		float3(-2.5f, -2.5f, -2.5f),
+		ctx.getClContext(),
+		queue,
+		ctx.getMemsetKernel(),
+		Grid::Format::SCALAR,
+		layout
+	);
+	LayoutThroughput rates;
+	
+	//Values keep accumulating while timed, so the grid is evaluated once
+	//more afterwards
+	double points = (dim + 1.0) * (dim + 1.0) * (dim + 1.0);
+	double ms = time_on_device(queue, [&]() {
+		ctx.getBlobProgram()->runBlob(blobs.data(), blobs.size(), grid);
+	});
+	rates.blobValue = points / ms * 1e-3;
+	grid.clear();
+	ctx.getBlobProgram()->runBlob(blobs.data(), blobs.size(), grid);
+	
+	unsigned int numVoxels = grid.getVoxelCount();
+	size_t voxelBytes = sizeof(cl_uint) * numVoxels;
+	cl::Buffer voxelVerts(ctx.getClContext(), CL_MEM_READ_WRITE, voxelBytes);
+	cl::Buffer voxelOccupied(ctx.getClContext(), CL_MEM_READ_WRITE, voxelBytes);
+	ms = time_on_device(queue, [&]() {
+		mc->launchClassifyVoxel(grid, voxelVerts, voxelOccupied, ISO_VALUE);
+	});
+	rates.classify = numVoxels / ms * 1e-3;
+	
+	cl::Buffer occupiedScan(ctx.getClContext(), CL_MEM_READ_WRITE, voxelBytes);
+	scan->compute(voxelOccupied, occupiedScan, numVoxels);
+	cl_uint activeVoxels = readScanTotal(queue, voxelOccupied, occupiedScan, numVoxels);
+	cl::Buffer vertsScan(ctx.getClContext(), CL_MEM_READ_WRITE, voxelBytes);
+	scan->compute(voxelVerts, vertsScan, numVoxels);
+	rates.verts = readScanTotal(queue, voxelVerts, vertsScan, numVoxels);
+	if(activeVoxels == 0) {
+		rates.generate = 0.0;
+		return rates;
+	}
+	cl::Buffer compacted(ctx.getClContext(), CL_MEM_READ_WRITE,
+	                     sizeof(cl_uint) * activeVoxels);
+	mc->launchCompactVoxels(compacted, voxelOccupied, occupiedScan, numVoxels);
+	size_t resultBytes = sizeof(float3) * rates.verts;
+	cl::Buffer verts(ctx.getClContext(), CL_MEM_WRITE_ONLY, resultBytes);
+	cl::Buffer normals(ctx.getClContext(), CL_MEM_WRITE_ONLY, resultBytes);
+	ms = time_on_device(queue, [&]() {
+		mc->launchGenerateTriangles(verts, normals, compacted, vertsScan,
+		                            ISO_VALUE, activeVoxels, rates.verts, grid);
+	});
+	rates.generate = rates.verts / ms * 1e-3;
+	return rates;
+}
+
+int main()
+{
+	return run_benchmark([]() {
+		Context ctx{false, true};
+		vector<float4> blobs = benchmark_blobs();
+		
+		cout << "Throughput in millions of lattice points (blob), voxels "
+		     << "(classify) and vertices (generate) per second" << endl;
+		cout << setw(8) << "block" << setw(12) << "vertices"
+		     << setw(12) << "blob lin" << setw(12) << "blob brick"
+		     << setw(12) << "class lin" << setw(12) << "class brick"
+		     << setw(12) << "gen lin" << setw(12) << "gen brick" << endl;
+		for(unsigned int dim : BLOCK_DIMS) {
+			LayoutThroughput linear =
+				measure_layout(ctx, blobs, dim, Grid::Layout::LINEAR);
+			LayoutThroughput bricked =
+				measure_layout(ctx, blobs, dim, Grid::Layout::BRICKED);
+			if(linear.verts != bricked.verts) {
+				ostringstream msg;
+				msg << "Vertex count mismatch for block " << dim;
+				throw runtime_error(msg.str());
+			}
+			cout << setw(8) << dim << setw(12) << linear.verts
+			     << fixed << setprecision(1)
+			     << setw(12) << linear.blobValue << setw(12) << bricked.blobValue
+			     << setw(12) << linear.classify << setw(12) << bricked.classify
+			     << setw(12) << linear.generate << setw(12) << bricked.generate
+			     << endl;
+		}
+	});
+}
@@ -88,6 +88,7 @@
 #include<string>
 #include<tuple>
 #include<cmath>
+#include<algorithm>
 #include<boost/program_options.hpp>
 #include<glm/glm.hpp>
 
@@ -101,6 +102,13 @@ using namespace std;
 static const int BLOCK_LOG_SIZE = 5;
 static const float BLOB_SPACING_COEFF =0.75f;
 static const float FILLER_BLOB_DIAM_COEFF = 2.6f;
+/**
+ * \brief With --tight, margin (in diameters) left around each blob
+ *
+ * Density of single blob a diameter away from its center is about 5% of the
+ * iso value, so surface doesn't reach beyond it.
+ */
+static const float TIGHT_MARGIN_DIAMS = 1.0f;
 
 
 //Variables for parameters
@@ -109,6 +117,7 @@ static string inputFile = "-";
 static int randomSeed = 1;
 static unsigned int posDeviationPercent = 0;
 static unsigned int sizeDeviationPercent = 0;
+static bool tight = false;
 
 /**
  * \brief How many blocks for Marching cubes are there gonna be on X axis
@@ -145,7 +154,11 @@ void parse_options(int argc, char** argv)
 	                 "value set to 10 may end up with size between 0.9m and 1.1m. "
 	                 "Deviation has uniform distribution within its bounds.")
 	                ("seed", po::value<int>(&randomSeed)->default_value(1),
-	                 "Random seed used for deviating sizes and positions of blobs");
+	                 "Random seed used for deviating sizes and positions of blobs")
+	                ("tight", po::value(&tight)->zero_tokens(),
+	                 "Fit the domain of marching cubes tightly around generated "
+	                 "blobs instead of padding the fracture net by two fracture "
+	                 "lengths along X and Z axes.");
 	
 	po::variables_map vm;
 	po::store(po::parse_command_line(argc, argv, desc), vm);
@@ -381,11 +394,56 @@ void blobber(ostream& os)
 	float sizeRandCoeff = static_cast<float>(std::min((uint) 100, sizeDeviationPercent)) / 100.0f;
 	std::uniform_real_distribution<float> sizeDis(-sizeRandCoeff, sizeRandCoeff);
 	
+	vector<glm::vec4> blobs;
+	for(auto& elem: fractureNet.dataPoints) {
+		DataPoint& dp = elem.second;
+		glm::vec4 offset {
+			fractureNet.xLen * dp.x - fractureNet.dimensionLength(Dimension::DIM_X) / 2.0f,
+			fractureNet.dimensionLength(Dimension::DIM_Y) - fractureNet.yLen * dp.y,
+			fractureNet.zLen * dp.z - fractureNet.dimensionLength(Dimension::DIM_Z) / 2.0f,
+			0.0f
+		};
+		
+		vector<glm::vec4> dpBlobs = blobsFromDataPoint(dp, fractureNet);
+		for(auto& blob : dpBlobs) {
+			blobs.push_back(blob + offset);
+		}
+		
+	}
+	for(auto& blob : blobs) {
+		blob.x += posDis(rng) * blob.w;
+		blob.y += posDis(rng) * blob.w;
+		blob.z += posDis(rng) * blob.w;
+		blob.w += sizeDis(rng) * blob.w;
+	}
+	
 	//lengths on X and Z are enlarge so blobs on boundaries are wholly within the are
 	//where marching cubes will work
 	float xLen = fractureNet.dimensionLength(Dimension::DIM_X) + 2 * fractureNet.xLen;
 	float yLen = fractureNet.dimensionLength(Dimension::DIM_Y);
 	float zLen = fractureNet.dimensionLength(Dimension::DIM_Z) + 2 * fractureNet.zLen;
+	glm::vec3 center{0.0f, yLen / 2.0f, 0.0f};
+	if(tight && !blobs.empty()) {
+		//Bounding box of blobs with margins instead
+		float lo[3] = {blobs[0].x, blobs[0].y, blobs[0].z};
+		float hi[3] = {blobs[0].x, blobs[0].y, blobs[0].z};
+		for(auto& blob : blobs) {
+			float margin = blob.w * TIGHT_MARGIN_DIAMS;
+			float pos[3] = {blob.x, blob.y, blob.z};
+			for(int axis=0; axis<3; axis++) {
+				lo[axis] = std::min(lo[axis], pos[axis] - margin);
+				hi[axis] = std::max(hi[axis], pos[axis] + margin);
+			}
+		}
+		xLen = hi[0] - lo[0];
+		yLen = hi[1] - lo[1];
+		zLen = hi[2] - lo[2];
+		center = glm::vec3{
+			(lo[0] + hi[0]) / 2.0f,
+			(lo[1] + hi[1]) / 2.0f,
+			(lo[2] + hi[2]) / 2.0f
+		};
+	}
 	
 	//Length of a single block is derieved from length of a block on X dimension.
 	float blockLen = xLen / g_blocksOnX;
@@ -400,8 +458,11 @@ void blobber(ostream& os)
 	float yMcLen = blocksOnY * blockLen;
 	float zMcLen = blocksOnZ * blockLen;
 	
-	//print starting point. Bottom of the structure will be on y = 0.0
-	os << -xMcLen / 2.0f << " " << 0.0f << " " << -zMcLen / 2.0f << "\n";
+	//print starting point. Without --tight bottom of the structure will be
+	//on y = 0.0, otherwise the realm is centered on blobs
+	float yStart = tight ? center.y - yMcLen / 2.0f : 0.0f;
+	os << center.x - xMcLen / 2.0f << " " << yStart << " "
+	   << center.z - zMcLen / 2.0f << "\n";
 	
 	//Print number of blocks on each axis
 	os << blocksOnX << " " << blocksOnY << " " << blocksOnZ << "\n";
@@ -410,31 +471,9 @@ void blobber(ostream& os)
 	os << blockLen << " " << blockLen << " " << blockLen << "\n";
 	os << BLOCK_LOG_SIZE << "\n";
 	
-	glm::vec3 startPoint{-xLen / 2.0f, yLen, -zLen / 2.0f};
-	vector<glm::vec4> blobs;
-	
-	for(auto& elem: fractureNet.dataPoints) {
-		DataPoint& dp = elem.second;
-		glm::vec4 offset {
-			fractureNet.xLen * dp.x - fractureNet.dimensionLength(Dimension::DIM_X) / 2.0f,
-			fractureNet.dimensionLength(Dimension::DIM_Y) - fractureNet.yLen * dp.y,
-			fractureNet.zLen * dp.z - fractureNet.dimensionLength(Dimension::DIM_Z) / 2.0f,
-			0.0f
-		};
-		
-		vector<glm::vec4> dpBlobs = blobsFromDataPoint(dp, fractureNet);
-		for(auto& blob : dpBlobs) {
-			blobs.push_back(blob + offset);
-		}
-		
-	}
-	
 	os << blobs.size() << "\n";
 	for(auto& blob : blobs) {
-		os << blob.x + posDis(rng) * blob.w << " "
-		   << blob.y + posDis(rng) * blob.w << " "
-		   << blob.z + posDis(rng) * blob.w << " "
-		   << blob.w + sizeDis(rng) * blob.w << "\n";
+		os << blob.x << " " << blob.y << " " << blob.z << " " << blob.w << "\n";
 	}
 }
 
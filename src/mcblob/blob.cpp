@@ -1,28 +1,349 @@
 #include "config.h"
 #include "grid.h"
+#include "sparsegrid.h"
 #include "blob.h"
 #include "util.h"
 
 #include <stdexcept>
 #include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstring>
 
 using namespace std;
 
 static const std::string sPath = "kernels/blob.cl";
 
-static const int BLOB_THREADS_PER_WG = 0;
+/** Number of work items in a work group of blob kernels, and so the number
+    of blobs kept in local memory at once. */
+static const int BLOB_THREADS_PER_WG = 64;
 static const bool BLOB_USE_ALL_CARDS = false;
 
+/** Default shape of work groups of blobValue3D, see setWorkGroupShape() */
+static const uint3 BLOB_WORK_GROUP_SHAPE(8, 8, 4);
+
+/** Number of kernel arguments set by setBlobArgs() */
+static const cl_uint BLOB_ARGS = 4;
+
+/** Relative error allowed for density bounds computed by classifyTiles,
+    covers rounding differences between bounds and values computed for
+    the grid. */
+static const float TILE_BOUNDS_SLACK = 1e-2f;
+
 Blob::Blob(
 	const cl::Context &context,
 	const vector<cl::CommandQueue>& commandQueues)
-	: AbstractProgram(sPath, context, commandQueues)
+	: AbstractProgram(sPath, context, commandQueues),
+	  mFalloff{Falloff::GAUSSIAN},
+	  mSeparable{false},
+	  mSplatting{false},
+	  mUploadedBlobs{}
 {
 	mBlobValKernel = cl::Kernel(mProgram, "blobValue");
+	mBlobVal3DKernel = cl::Kernel(mProgram, "blobValue3D");
+	mBlobValSeparableKernel = cl::Kernel(mProgram, "blobValueSeparable");
+	mSplatBlobsKernel = cl::Kernel(mProgram, "splatBlobs");
+	mBlobValTiledKernel = cl::Kernel(mProgram, "blobValueTiled");
+	mClassifyTilesKernel = cl::Kernel(mProgram, "classifyTiles");
+	mResampleFaceKernel = cl::Kernel(mProgram, "resampleFace");
 	cl::CommandQueue q = commandQueues[0];
 	cl::Device dev;
 	q.getInfo(CL_QUEUE_DEVICE, &dev);
-	dev.getInfo(CL_DEVICE_MAX_CONSTANT_BUFFER_SIZE, &mConstantBufferSize);
+	mMaxWorkGroupSize =
+		mBlobValKernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(dev);
+	for(cl::Kernel* k : {&mBlobValTiledKernel, &mClassifyTilesKernel,
+	                     &mSplatBlobsKernel}) {
+		size_t kernelMax =
+			k->getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(dev);
+		mMaxWorkGroupSize = std::min(mMaxWorkGroupSize, kernelMax);
+	}
+	mMaxWorkGroupSize3D =
+		mBlobVal3DKernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(dev);
+	size_t separableMax =
+		mBlobValSeparableKernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(dev);
+	mMaxWorkGroupSize3D = std::min(mMaxWorkGroupSize3D, separableMax);
+	cl_ulong localMemSize = dev.getInfo<CL_DEVICE_LOCAL_MEM_SIZE>();
+	mLocalMemSize = localMemSize;
+	setWorkGroupSize(BLOB_THREADS_PER_WG);
+	setWorkGroupShape(BLOB_WORK_GROUP_SHAPE);
+}
+
+/**
+  Sets size of work groups of 1D blob kernels, which is also the number of
+  blobs kept in local memory at once. Lowered if the device can't run that
+  many work items in a group.
+  */
+void Blob::setWorkGroupSize(size_t size)
+{
+	mWorkGroupSize = std::max<size_t>(1, std::min(size, mMaxWorkGroupSize));
+}
+
+/**
+  Sets shape of work groups used to add blobs to dense grids. Lattice
+  points computed by one work group form a box of this shape, so they are
+  close to each other in the grid and all share the same tiles of blobs in
+  local memory. Shape is shrunk if the device can't run that many work
+  items in a group.
+  \param shape number of work items along x, y and z. If x is 0, grids are
+  computed with 1D kernel instead, with work groups made of consecutive
+  lattice points.
+  */
+void Blob::setWorkGroupShape(const uint3& shape)
+{
+	mWorkGroupShape = shape.x == 0 ?
+		uint3(0, 0, 0) :
+		fitWorkGroupShape(
+			uint3(shape.x, std::max(shape.y, 1u), std::max(shape.z, 1u)),
+			mMaxWorkGroupSize3D
+		);
+}
+
+/**
+  Selects field function of blobs used by following runs. With compact
+  support functions regions farther than the radius of influence from every
+  blob are certainly empty, so culling by classifyRegions() is exact.
+  */
+void Blob::setFalloff(Falloff falloff)
+{
+	if(falloff != mFalloff) {
+		mFalloff = falloff;
+		//Uploaded blobs are scaled by radius of influence
+		mUploadedBlobs.clear();
+		mBlobBuffer = cl::Buffer();
+	}
+}
+
+/**
+  Selects separable evaluation of Gaussian blobs for dense grids. Each
+  Gaussian is a product of 1D factors along the axes, so work groups of
+  blobValueSeparable compute exponentials only along edges of their box of
+  lattice points and combine them, and gradient is computed analytically
+  instead of from three more samples. Used only with Falloff::GAUSSIAN and
+  3D work groups (see setWorkGroupShape()), other runs are unaffected.
+  */
+void Blob::setSeparable(bool separable)
+{
+	mSeparable = separable;
+}
+
+/**
+  Selects splatting of blobs into dense grids. Instead of every lattice
+  point summing all blobs, every blob is added only to lattice points
+  within its radius of influence, so the cost follows the sum of blob
+  footprints. Used only with compact support falloffs (see
+  getSupportRatio()) and grids in Grid::Format::GRADIENT or
+  Grid::Format::SCALAR, which can be updated atomically, other runs are
+  unaffected.
+  */
+void Blob::setSplatting(bool splatting)
+{
+	mSplatting = splatting;
+}
+
+/**
+  Sets queues of sub-devices of the first queue's device, one for each NUMA
+  node. Evaluation of blobs with blobValue3D, blobValueSeparable and 1D blob
+  kernels is then split evenly among them, dense grids by lattice slices,
+  while everything else, including splatting, still runs on the first queue.
+  Nodes don't share the first queue, so it's finished before they start and
+  they are waited for.
+  \param queues queues of nodes, fewer than two turn the split off
+  */
+void Blob::setNodeQueues(const vector<cl::CommandQueue>& queues)
+{
+	mNodeQueues = queues;
+	if(mNodeQueues.size() < 2) {
+		mNodeQueues.clear();
+	}
+}
+
+/**
+  \return ratio of radius of influence R, beyond which blob adds nothing to
+  the density, to blob's radius (half of the diameter), or 0 if falloff
+  doesn't have compact support
+  */
+float Blob::getSupportRatio(Falloff falloff)
+{
+	switch(falloff) {
+	case Falloff::WYVILL:
+	case Falloff::MURAKAMI:
+		return 2.0f;
+	case Falloff::TRUNCATED_GAUSSIAN:
+		return 3.0f;
+	default:
+		return 0.0f;
+	}
+}
+
+/**
+  Copies blobs to the device, so following runs with the same array don't
+  transfer them again. Blobs are kept as (x, y, z, 1/R^2), with R being
+  radius of influence, i.e. half of the diameter given in w times
+  getSupportRatio() (1 for Gaussian), so kernels don't compute it for every
+  lattice point.
+  
+  runBlob(), classifyRegions() and findActiveTiles() upload blobs
+  themselves whenever they get blobs different from the uploaded ones (see
+  isUploaded()), so calling this method is needed only to upload ahead of
+  them.
+  \param blobs array of blobs, as in runBlob(const float4*, int, Grid&)
+  \param nBlobs length of blobs array
+  */
+void Blob::uploadBlobs(const float4 *const blobs, int nBlobs)
+{
+	mUploadedBlobs.assign(blobs, blobs + std::max(nBlobs, 0));
+	if(nBlobs <= 0) {
+		mBlobBuffer = cl::Buffer();
+		return;
+	}
+	float ratio = std::max(1.0f, getSupportRatio(mFalloff));
+	vector<float4> prepared(blobs, blobs + nBlobs);
+	for(float4& blob : prepared) {
+		float radius = blob.w / 2.0f * ratio;
+		blob.w = 1.0f / (radius * radius);
+	}
+	mBlobBuffer = cl::Buffer(
+		mContext,
+		CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+		nBlobs * sizeof(float4),
+		prepared.data()
+	);
+}
+
+/**
+  Checks if blobs are the ones in the device buffer. Contents are compared,
+  not addresses, as an array may be modified in place or freed and another
+  one allocated at the same address. That's linear in the number of blobs,
+  which is negligible next to evaluating them.
+  */
+bool Blob::isUploaded(const float4 *const blobs, int nBlobs) const
+{
+	return nBlobs >= 0 &&
+	       mUploadedBlobs.size() == static_cast<size_t>(nBlobs) &&
+	       (nBlobs == 0 ||
+	        memcmp(mUploadedBlobs.data(), blobs, nBlobs * sizeof(float4)) == 0);
+}
+
+/**
+  Sets blob arguments of kernel, uploading blobs if needed. Blobs buffer,
+  number of blobs, local tile for groupSize blobs and falloff are passed as
+  BLOB_ARGS arguments starting at blobsArg.
+  \return false if there are no blobs, so the kernel doesn't have to run
+  */
+bool Blob::setBlobArgs(
+	cl::Kernel& kernel,
+	cl_uint blobsArg,
+	const float4 *const blobs,
+	int nBlobs,
+	size_t groupSize)
+{
+	if(nBlobs <= 0) {
+		return false;
+	}
+	if(!isUploaded(blobs, nBlobs)) {
+		uploadBlobs(blobs, nBlobs);
+	}
+	
+	kernel.setArg(blobsArg, mBlobBuffer);
+	kernel.setArg(blobsArg + 1, (cl_int) nBlobs);
+	kernel.setArg(blobsArg + 2, cl::__local(groupSize * sizeof(float4)));
+	kernel.setArg(blobsArg + 3, static_cast<cl_uint>(mFalloff));
+	return true;
+}
+
+/**
+  Runs 1D kernel over all blobs at once. Blobs are read from global memory
+  and work items of each work group share them through local memory, a tile
+  of work group size at a time. Blob arguments are set with setBlobArgs(),
+  remaining arguments must be already set.
+  \param nItems number of work items
+  */
+void Blob::runBlobKernel(
+	cl::Kernel& kernel,
+	cl_uint blobsArg,
+	const float4 *const blobs,
+	int nBlobs,
+	int nItems)
+{
+	if(!setBlobArgs(kernel, blobsArg, blobs, nBlobs, mWorkGroupSize)) {
+		return;
+	}
+	
+	if(!mNodeQueues.empty()) {
+		mCommandQueues[0].finish();
+		run1DKernelMultipleQueues(
+			kernel,
+			mNodeQueues,
+			nItems,
+			mWorkGroupSize,
+			true
+		);
+	} else if(BLOB_USE_ALL_CARDS) {
+		run1DKernelMultipleQueues(
+			kernel,
+			mCommandQueues,
+			nItems,
+			mWorkGroupSize
+		);
+	} else {
+		run1DKernelSingleQueue(
+			kernel,
+			mCommandQueues[0],
+			nItems,
+			mWorkGroupSize
+		);
+	}
+}
+
+/**
+  Runs 3D blob kernel over lattice slices of a grid from firstSlice on, in
+  work groups of mWorkGroupShape. With node queues slices are split among
+  them in parts of whole work groups, so no lattice point is added twice.
+  \param firstSliceArg index of the firstSlice argument of the kernel,
+  remaining arguments must be already set
+  \param gridSize size of the grid in voxels
+  */
+void Blob::runSlices(
+	cl::Kernel& kernel,
+	cl_uint firstSliceArg,
+	const uint3& gridSize,
+	unsigned int firstSlice)
+{
+	unsigned int nSlices = gridSize.z + 1 - firstSlice;
+	if(mNodeQueues.empty()) {
+		kernel.setArg(firstSliceArg, (cl_uint) firstSlice);
+		run3DKernel(
+			kernel,
+			mCommandQueues[0],
+			uint3(gridSize.x + 1, gridSize.y + 1, nSlices),
+			mWorkGroupShape
+		);
+		return;
+	}
+	
+	mCommandQueues[0].finish();
+	vector<unsigned int> parts = splitWork(
+		nSlices,
+		mWorkGroupShape.z,
+		vector<double>(mNodeQueues.size(), 1.0)
+	);
+	for(size_t i=0; i < parts.size(); i++) {
+		if(parts[i] == 0) {
+			continue;
+		}
+		//Arguments are captured when the kernel is enqueued
+		kernel.setArg(firstSliceArg, (cl_uint) firstSlice);
+		run3DKernel(
+			kernel,
+			mNodeQueues[i],
+			uint3(gridSize.x + 1, gridSize.y + 1, parts[i]),
+			mWorkGroupShape
+		);
+		firstSlice += parts[i];
+	}
+	for(cl::CommandQueue& queue : mNodeQueues) {
+		queue.finish();
+	}
 }
 
 /**
@@ -32,58 +353,395 @@ Blob::Blob(
   from w component.
   \param nBlobs length of blobs array
   \param grid grid to which blob values will be added
+  \param firstSlice number of leading lattice slices along z that are
+  skipped, e.g. because they were copied from the previous block with
+  Grid::copySlices()
   */
-void Blob::runBlob(const float4 *const blobs, int nBlobs, Grid &grid)
+void Blob::runBlob(
+	const float4 *const blobs,
+	int nBlobs,
+	Grid &grid,
+	unsigned int firstSlice)
 {
-	cl_int blobsPerRun = mConstantBufferSize / sizeof(blobs[0]);
 	grid.copyToDevice();
+	
+	uint3 gridSize = grid.getGridSize();
+	if(firstSlice > gridSize.z) {
+		return;
+	}
+	
+	Grid::Format format = grid.getFormat();
+	if(mSplatting && getSupportRatio(mFalloff) > 0.0f &&
+	   (format == Grid::Format::GRADIENT || format == Grid::Format::SCALAR)) {
+		runSplat(blobs, nBlobs, grid, firstSlice);
+		return;
+	}
+	if(mSeparable && mFalloff == Falloff::GAUSSIAN && mWorkGroupShape.x > 0) {
+		runSeparable(blobs, nBlobs, grid, firstSlice);
+		return;
+	}
+	if(mWorkGroupShape.x > 0) {
+		uint arg = 0;
+		mBlobVal3DKernel.setArg(arg++, grid.getStartPos());
+		mBlobVal3DKernel.setArg(arg++, gridSize);
+		mBlobVal3DKernel.setArg(arg++, grid.getVoxelSize());
+		cl_uint blobsArg = arg;
+		arg += BLOB_ARGS;
+		mBlobVal3DKernel.setArg(arg++, grid.getValuesBuffer());
+		mBlobVal3DKernel.setArg(arg++, grid.getFormat());
+		mBlobVal3DKernel.setArg(arg++, grid.getLayout());
+		cl_uint firstSliceArg = arg++;
+		
+		size_t groupSize =
+			mWorkGroupShape.x * mWorkGroupShape.y * mWorkGroupShape.z;
+		if(setBlobArgs(mBlobVal3DKernel, blobsArg, blobs, nBlobs, groupSize)) {
+			runSlices(mBlobVal3DKernel, firstSliceArg, gridSize, firstSlice);
+		}
+		return;
+	}
+	
+	cl_uint slicePoints = (gridSize.x + 1) * (gridSize.y + 1);
+	cl_int nPoints = slicePoints * (gridSize.z + 1 - firstSlice);
+	
+	uint arg = 0;
+	mBlobValKernel.setArg(arg++, grid.getStartPos());
+	mBlobValKernel.setArg(arg++, grid.getGridSize());
+	mBlobValKernel.setArg(arg++, grid.getVoxelSize());
+	cl_uint blobsArg = arg;
+	arg += BLOB_ARGS;
+	mBlobValKernel.setArg(arg++, grid.getValuesBuffer());
+	mBlobValKernel.setArg(arg++, grid.getFormat());
+	mBlobValKernel.setArg(arg++, grid.getLayout());
+	mBlobValKernel.setArg(arg++, slicePoints * firstSlice);
+	mBlobValKernel.setArg(arg++, nPoints);
+	
+	runBlobKernel(mBlobValKernel, blobsArg, blobs, nBlobs, nPoints);
+}
+
+/**
+  Adds blobs to the grid with blobValueSeparable, see setSeparable(). Tile
+  of blobs and their factors are kept in local memory, so the tile is made
+  smaller than work group when they don't fit.
+  */
+void Blob::runSeparable(
+	const float4 *const blobs,
+	int nBlobs,
+	Grid& grid,
+	unsigned int firstSlice)
+{
+	uint3 gridSize = grid.getGridSize();
+	size_t groupSize =
+		mWorkGroupShape.x * mWorkGroupShape.y * mWorkGroupShape.z;
+	size_t axesLen = mWorkGroupShape.x + mWorkGroupShape.y + mWorkGroupShape.z;
+	size_t bytesPerBlob = sizeof(float4) + axesLen * sizeof(cl_float);
+	cl_int blobsPerTile = std::min(groupSize, mLocalMemSize / bytesPerBlob);
+	if(blobsPerTile < 1) {
+		throw runtime_error("Blob::runSeparable: work group shape too big "
+		                    "for local memory");
+	}
+	
+	uint arg = 0;
+	mBlobValSeparableKernel.setArg(arg++, grid.getStartPos());
+	mBlobValSeparableKernel.setArg(arg++, gridSize);
+	mBlobValSeparableKernel.setArg(arg++, grid.getVoxelSize());
+	cl_uint blobsArg = arg;
+	arg += BLOB_ARGS;
+	mBlobValSeparableKernel.setArg(arg++, grid.getValuesBuffer());
+	mBlobValSeparableKernel.setArg(arg++, grid.getFormat());
+	mBlobValSeparableKernel.setArg(arg++, grid.getLayout());
+	cl_uint firstSliceArg = arg++;
+	mBlobValSeparableKernel.setArg(
+		arg++, cl::__local(blobsPerTile * axesLen * sizeof(cl_float)));
+	mBlobValSeparableKernel.setArg(arg++, blobsPerTile);
+	
+	if(setBlobArgs(mBlobValSeparableKernel, blobsArg, blobs, nBlobs, blobsPerTile)) {
+		runSlices(mBlobValSeparableKernel, firstSliceArg, gridSize, firstSlice);
+	}
+}
+
+/**
+  Number of work items splatting each blob, the power of two nearest to the
+  mean number of lattice points in footprints of blobs, at most groupSize.
+  \param ratio support ratio of the falloff, see getSupportRatio()
+  */
+static unsigned int splatLanes(
+	const float4* const blobs,
+	int nBlobs,
+	float ratio,
+	const float3& voxelSize,
+	const uint3& gridSize,
+	size_t groupSize)
+{
+	double points = 0.0;
+	for(int i=0; i < nBlobs; i++) {
+		float reach = blobs[i].w / 2.0f * ratio;
+		double footprint = 1.0;
+		for(int c=0; c < 3; c++) {
+			double axis = std::floor(2.0f * reach / voxelSize.cell[c]) + 1.0;
+			footprint *= std::min(axis, gridSize.cell[c] + 1.0);
+		}
+		points += footprint;
+	}
+	double mean = points / nBlobs;
+	unsigned int lanes = 1;
+	while(lanes * 2 <= groupSize && lanes * 1.5 < mean) {
+		lanes *= 2;
+	}
+	return lanes;
+}
 
-	cl::Buffer blobBuffer = cl::Buffer(
+/**
+  Adds blobs to the grid with splatBlobs, see setSplatting(). Work items of
+  a group are divided among several blobs when footprints are small. Blobs
+  are dispatched in chunks, so that the number of work items of a dispatch
+  fits in unsigned int.
+  */
+void Blob::runSplat(
+	const float4 *const blobs,
+	int nBlobs,
+	Grid& grid,
+	unsigned int firstSlice)
+{
+	if(nBlobs <= 0) {
+		return;
+	}
+	if(!isUploaded(blobs, nBlobs)) {
+		uploadBlobs(blobs, nBlobs);
+	}
+	
+	cl_uint lanes = splatLanes(
+		blobs, nBlobs, getSupportRatio(mFalloff),
+		grid.getVoxelSize(), grid.getGridSize(), mWorkGroupSize);
+	cl_uint blobsPerGroup = mWorkGroupSize / lanes;
+	
+	uint arg = 0;
+	mSplatBlobsKernel.setArg(arg++, grid.getStartPos());
+	mSplatBlobsKernel.setArg(arg++, grid.getGridSize());
+	mSplatBlobsKernel.setArg(arg++, grid.getVoxelSize());
+	mSplatBlobsKernel.setArg(arg++, mBlobBuffer);
+	mSplatBlobsKernel.setArg(arg++, (cl_int) nBlobs);
+	mSplatBlobsKernel.setArg(arg++, static_cast<cl_uint>(mFalloff));
+	mSplatBlobsKernel.setArg(arg++, grid.getValuesBuffer());
+	mSplatBlobsKernel.setArg(arg++, grid.getFormat());
+	mSplatBlobsKernel.setArg(arg++, grid.getLayout());
+	mSplatBlobsKernel.setArg(arg++, (cl_uint) firstSlice);
+	cl_uint firstBlobArg = arg++;
+	mSplatBlobsKernel.setArg(arg++, blobsPerGroup);
+	mSplatBlobsKernel.setArg(arg++, lanes);
+	
+	unsigned int maxGroups = UINT_MAX / mWorkGroupSize;
+	int blobsPerDispatch = static_cast<int>(std::min<unsigned long long>(
+		static_cast<unsigned long long>(maxGroups) * blobsPerGroup, INT_MAX));
+	for(int first=0; first < nBlobs; first += blobsPerDispatch) {
+		int count = std::min(nBlobs - first, blobsPerDispatch);
+		unsigned int groups = (count + blobsPerGroup - 1) / blobsPerGroup;
+		//Arguments are captured when the kernel is enqueued
+		mSplatBlobsKernel.setArg(firstBlobArg, (cl_int) first);
+		run1DKernelSingleQueue(
+			mSplatBlobsKernel,
+			mCommandQueues[0],
+			groups * mWorkGroupSize,
+			mWorkGroupSize
+		);
+		if(nBlobs - first <= blobsPerDispatch) {
+			break;
+		}
+	}
+}
+
+/**
+  This method adds an array of blobs to tiles of sparse grid. Only lattice
+  points of tiles set in grid are computed.
+  \param blobs array of blobs to be added, as in runBlob(const float4*, int, Grid&)
+  \param nBlobs length of blobs array
+  \param grid grid to which blob values will be added
+  */
+void Blob::runBlob(const float4 *const blobs, int nBlobs, SparseGrid &grid)
+{
+	if(grid.getTileCount() == 0) {
+		return;
+	}
+	cl_int nPoints = grid.getPointCount();
+	cl_uint tileDim = grid.getTileDim();
+	
+	uint arg = 0;
+	mBlobValTiledKernel.setArg(arg++, grid.getStartPos());
+	mBlobValTiledKernel.setArg(arg++, uint3(tileDim, tileDim, tileDim));
+	mBlobValTiledKernel.setArg(arg++, grid.getVoxelSize());
+	mBlobValTiledKernel.setArg(arg++, grid.getTilesBuffer());
+	cl_uint blobsArg = arg;
+	arg += BLOB_ARGS;
+	mBlobValTiledKernel.setArg(arg++, grid.getValuesBuffer());
+	mBlobValTiledKernel.setArg(arg++, grid.getFormat());
+	mBlobValTiledKernel.setArg(arg++, nPoints);
+	
+	runBlobKernel(mBlobValTiledKernel, blobsArg, blobs, nBlobs, nPoints);
+}
+
+/**
+  Coarse pass over arbitrary box divided into regions. For every region
+  conservative bounds of the density function within it are computed and the
+  region is classified against range of iso values. Only REGION_SURFACE
+  regions may contain part of any isosurface with value in the range.
+  
+  \param blobs array of blobs, as in runBlob(const float4*, int, Grid&)
+  \param nBlobs length of blobs array
+  \param startPoint corner of the box with smallest x, y and z
+  \param regionGridSize number of regions along each axis
+  \param regionExtent size of single region
+  \param minIsoValue the smallest value of density function on surfaces
+  \param maxIsoValue the largest value of density function on surfaces
+  \return class of every region (see RegionClass), regions are ordered with
+  x changing fastest
+  */
+vector<cl_uchar> Blob::classifyRegions(
+	const float4 *const blobs,
+	int nBlobs,
+	float3 startPoint,
+	uint3 regionGridSize,
+	float3 regionExtent,
+	float minIsoValue,
+	float maxIsoValue)
+{
+	cl_int nRegions = regionGridSize.x * regionGridSize.y * regionGridSize.z;
+	regionExtent.w = 0.0f;
+	
+	vector<cl_float2> bounds(nRegions, cl_float2{{0.0f, 0.0f}});
+	cl::Buffer boundsBuffer = cl::Buffer(
 		mContext,
-		CL_MEM_READ_ONLY,
-		mConstantBufferSize
+		CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+		nRegions * sizeof(cl_float2),
+		bounds.data()
 	);
 	
-	for(int i=0; i<nBlobs; i+= blobsPerRun) {
-		size_t partStart = i;
-		size_t partSize = std::min(nBlobs - i, blobsPerRun);
-		
-		mFirstQueue.enqueueWriteBuffer(
-			blobBuffer,
-			CL_TRUE,
-			0,
-			partSize * sizeof(float4),
-			blobs + partStart
-		);
-		
-		cl_int nPoints = (grid.getGridSize().x + 1) *
-		                 (grid.getGridSize().y + 1) *
-		                 (grid.getGridSize().z + 1);
-		
-		uint arg = 0;
-		mBlobValKernel.setArg(arg++, grid.getStartPos());
-		mBlobValKernel.setArg(arg++, grid.getGridSize());
-		mBlobValKernel.setArg(arg++, grid.getVoxelSize());
-		mBlobValKernel.setArg(arg++, blobBuffer);
-		mBlobValKernel.setArg(arg++, (int) partSize);
-		mBlobValKernel.setArg(arg++, grid.getValuesBuffer());
-		mBlobValKernel.setArg(arg++, nPoints);
-		
-		if(BLOB_USE_ALL_CARDS) {
-			run1DKernelMultipleQueues(
-				mBlobValKernel,
-				mCommandQueues,
-				nPoints,
-				BLOB_THREADS_PER_WG
-			);
+	uint arg = 0;
+	mClassifyTilesKernel.setArg(arg++, startPoint);
+	mClassifyTilesKernel.setArg(arg++, regionGridSize);
+	mClassifyTilesKernel.setArg(arg++, regionExtent);
+	cl_uint blobsArg = arg;
+	arg += BLOB_ARGS;
+	mClassifyTilesKernel.setArg(arg++, boundsBuffer);
+	mClassifyTilesKernel.setArg(arg++, nRegions);
+	
+	runBlobKernel(mClassifyTilesKernel, blobsArg, blobs, nBlobs, nRegions);
+	
+	mFirstQueue.enqueueReadBuffer(
+		boundsBuffer,
+		CL_TRUE,
+		0,
+		nRegions * sizeof(cl_float2),
+		bounds.data()
+	);
+	
+	vector<cl_uchar> ret(nRegions);
+	for(cl_int i=0; i<nRegions; i++) {
+		float lo = bounds[i].s[0] * (1.0f - TILE_BOUNDS_SLACK);
+		float hi = bounds[i].s[1] * (1.0f + TILE_BOUNDS_SLACK);
+		if(hi < minIsoValue) {
+			ret[i] = REGION_OUTSIDE;
+		} else if(lo > maxIsoValue) {
+			ret[i] = REGION_INSIDE;
 		} else {
-			run1DKernelSingleQueue(
-				mBlobValKernel,
-				mCommandQueues[0],
-				nPoints,
-				BLOB_THREADS_PER_WG
-			);
+			ret[i] = REGION_SURFACE;
 		}
-		
 	}
+	return ret;
+}
+
+/**
+  Coarse pass for sparse grids. Finds tiles of grid through which the
+  isosurface may pass and sets them in the grid (see SparseGrid::setTiles()).
+  
+  A tile is skipped only if whole tile is certainly below or above isoValue
+  (see classifyRegions()), so no part of the surface is lost.
+  
+  \param blobs array of blobs, as in runBlob(const float4*, int, Grid&)
+  \param nBlobs length of blobs array
+  \param grid grid which tiles will be set
+  \param minIsoValue the smallest value of density function on surfaces
+  that will be extracted from the grid
+  \param maxIsoValue the largest one
+  */
+void Blob::findActiveTiles(
+	const float4 *const blobs,
+	int nBlobs,
+	SparseGrid& grid,
+	float minIsoValue,
+	float maxIsoValue)
+{
+	uint3 tileGridSize = grid.getTileGridSize();
+	float3 voxelSize = grid.getVoxelSize();
+	float tileDim = grid.getTileDim();
+	float3 tileExtent(
+		voxelSize.x * tileDim,
+		voxelSize.y * tileDim,
+		voxelSize.z * tileDim,
+		0.0f
+	);
+	
+	vector<cl_uchar> regions = classifyRegions(
+		blobs, nBlobs, grid.getStartPos(), tileGridSize, tileExtent,
+		minIsoValue, maxIsoValue);
+	
+	vector<uint3> tiles;
+	for(size_t i=0; i<regions.size(); i++) {
+		if(regions[i] == REGION_SURFACE) {
+			tiles.push_back(uint3(
+				i % tileGridSize.x,
+				(i / tileGridSize.x) % tileGridSize.y,
+				i / (tileGridSize.x * tileGridSize.y)
+			));
+		}
+	}
+	grid.setTiles(tiles);
+}
+
+/**
+  Makes density on one face of the grid match a neighbouring grid that has
+  ratio times bigger voxels. Every lattice point of the face that is not
+  shared with the coarser lattice gets bilinear interpolation of the
+  surrounding shared points, so Marching cubes produces the same
+  intersections on edges of the coarse lattice in both grids.
+  
+  \param grid grid which face will be modified
+  \param axis axis perpendicular to the face (0 - x, 1 - y, 2 - z)
+  \param upper if true, face at the end of the axis is modified, otherwise
+  the one at grid's start position
+  \param ratio ratio of voxel sizes of the neighbour and the grid. Must be a
+  power of two not bigger than grid size.
+  */
+void Blob::resampleFace(
+	Grid& grid,
+	unsigned int axis,
+	bool upper,
+	unsigned int ratio)
+{
+	if(axis > 2) {
+		throw runtime_error("Blob::resampleFace: invalid axis");
+	}
+	if(ratio <= 1) {
+		return;
+	}
+	grid.copyToDevice();
+	
+	uint3 gridSize = grid.getGridSize();
+	unsigned int sizes[] = {gridSize.x, gridSize.y, gridSize.z};
+	cl_int nPoints = (sizes[(axis + 1) % 3] + 1) * (sizes[(axis + 2) % 3] + 1);
+	
+	uint arg = 0;
+	mResampleFaceKernel.setArg(arg++, grid.getValuesBuffer());
+	mResampleFaceKernel.setArg(arg++, grid.getFormat());
+	mResampleFaceKernel.setArg(arg++, grid.getLayout());
+	mResampleFaceKernel.setArg(arg++, gridSize);
+	mResampleFaceKernel.setArg(arg++, (cl_uint) axis);
+	mResampleFaceKernel.setArg(arg++, (cl_uint) (upper ? 1 : 0));
+	mResampleFaceKernel.setArg(arg++, (cl_uint) ratio);
+	mResampleFaceKernel.setArg(arg++, nPoints);
+	
+	run1DKernelSingleQueue(
+		mResampleFaceKernel,
+		mCommandQueues[0],
+		nPoints,
+		BLOB_THREADS_PER_WG
+	);
 }
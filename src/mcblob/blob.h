@@ -7,12 +7,89 @@
 #include "common/mathtypes.h"
 
 class Grid;
+class SparseGrid;
 
 class Blob : public AbstractProgram
 {
+public:
+	/** Result of classifyRegions() for single region */
+	enum RegionClass {
+		REGION_OUTSIDE = 0, /**< density below iso value in whole region */
+		REGION_INSIDE = 1,  /**< density above iso value in whole region */
+		REGION_SURFACE = 2  /**< isosurface may pass through the region */
+	};
+	/**
+	  Field function of a single blob. Values must match BLOB_FALLOFF_*
+	  defines in kernels/blob.cl. Every function is 1 at half of the blob's
+	  diameter, so a lone blob has the same surface for iso value 1.
+	  */
+	enum class Falloff : cl_uint {
+		GAUSSIAN = 0,          /**< exp(1 - d^2/r^2), never reaches 0 */
+		WYVILL = 1,            /**< soft objects polynomial of degree 6 */
+		MURAKAMI = 2,          /**< (1 - d^2/R^2)^2 */
+		TRUNCATED_GAUSSIAN = 3 /**< Gaussian shifted and rescaled to reach
+		                            0 at 3r */
+	};
 protected:
 	cl::Kernel mBlobValKernel;
-	cl_ulong mConstantBufferSize;
+	cl::Kernel mBlobVal3DKernel;
+	cl::Kernel mBlobValSeparableKernel;
+	cl::Kernel mSplatBlobsKernel;
+	cl::Kernel mBlobValTiledKernel;
+	cl::Kernel mClassifyTilesKernel;
+	cl::Kernel mResampleFaceKernel;
+	size_t mWorkGroupSize;
+	size_t mMaxWorkGroupSize;
+	size_t mMaxWorkGroupSize3D;
+	uint3 mWorkGroupShape;
+	Falloff mFalloff;
+	bool mSeparable;
+	bool mSplatting;
+	size_t mLocalMemSize; /**< local memory of the device, in bytes */
+	std::vector<cl::CommandQueue> mNodeQueues; /**< see setNodeQueues() */
+	
+	cl::Buffer mBlobBuffer; /**< uploaded blobs, see uploadBlobs() */
+	std::vector<float4> mUploadedBlobs; /**< host copy of blobs in
+	                                         mBlobBuffer, as given */
+	
+	bool isUploaded(const float4* const blobs, int nBlobs) const;
+	
+	bool setBlobArgs(
+		cl::Kernel& kernel,
+		cl_uint blobsArg,
+		const float4* const blobs,
+		int nBlobs,
+		size_t groupSize
+	);
+	
+	void runBlobKernel(
+		cl::Kernel& kernel,
+		cl_uint blobsArg,
+		const float4* const blobs,
+		int nBlobs,
+		int nItems
+	);
+	
+	void runSlices(
+		cl::Kernel& kernel,
+		cl_uint firstSliceArg,
+		const uint3& gridSize,
+		unsigned int firstSlice
+	);
+	
+	void runSeparable(
+		const float4* const blobs,
+		int nBlobs,
+		Grid& grid,
+		unsigned int firstSlice
+	);
+	
+	void runSplat(
+		const float4* const blobs,
+		int nBlobs,
+		Grid& grid,
+		unsigned int firstSlice
+	);
 public:
 	Blob(
 		const cl::Context& context, 
@@ -20,10 +97,83 @@ public:
 	);
 	virtual ~Blob() {}
 	
+	void uploadBlobs(const float4* const blobs, int nBlobs);
+	
+	void setFalloff(Falloff falloff);
+	Falloff getFalloff() const { return mFalloff; }
+	static float getSupportRatio(Falloff falloff);
+	
+	void setSeparable(bool separable);
+	bool isSeparable() const { return mSeparable; }
+	
+	void setSplatting(bool splatting);
+	bool isSplatting() const { return mSplatting; }
+	
+	void setNodeQueues(const std::vector<cl::CommandQueue>& queues);
+	
+	void setWorkGroupSize(size_t size);
+	size_t getWorkGroupSize() const { return mWorkGroupSize; }
+	
+	void setWorkGroupShape(const uint3& shape);
+	const uint3& getWorkGroupShape() const { return mWorkGroupShape; }
+	
+	void runBlob(
+		const float4* const blobs,
+		int nBlobs,
+		Grid& grid,
+		unsigned int firstSlice = 0
+	);
+	
 	void runBlob(
 		const float4* const blobs,
 		int nBlobs,
-		Grid& grid
+		SparseGrid& grid
+	);
+	
+	std::vector<cl_uchar> classifyRegions(
+		const float4* const blobs,
+		int nBlobs,
+		float3 startPoint,
+		uint3 regionGridSize,
+		float3 regionExtent,
+		float minIsoValue,
+		float maxIsoValue
+	);
+	
+	std::vector<cl_uchar> classifyRegions(
+		const float4* const blobs,
+		int nBlobs,
+		float3 startPoint,
+		uint3 regionGridSize,
+		float3 regionExtent,
+		float isoValue
+	) {
+		return classifyRegions(blobs, nBlobs, startPoint, regionGridSize,
+		                       regionExtent, isoValue, isoValue);
+	}
+	
+	void findActiveTiles(
+		const float4* const blobs,
+		int nBlobs,
+		SparseGrid& grid,
+		float minIsoValue,
+		float maxIsoValue
+	);
+	
+	void findActiveTiles(
+		const float4* const blobs,
+		int nBlobs,
+		SparseGrid& grid,
+		float isoValue
+	) {
+		findActiveTiles(blobs, nBlobs, grid, isoValue, isoValue);
+	}
+	
+	void resampleFace(
+		Grid& grid,
+		unsigned int axis,
+		bool upper,
+		unsigned int ratio
 	);
 
 };
@@ -3,8 +3,11 @@
 #include "blob.h"
 #include "scan.h"
 #include "marchingcubes.h"
+#include "surfacenets.h"
+#include "histopyramid.h"
 #include "context.h"
 
+#include <cctype>
 #include <stdexcept>
 
 using namespace std;
@@ -15,10 +18,101 @@ utilKernelPath = "kernels/util.cl";
 static const string
 memSetKernelName = "memSet";
 
-Context::Context(bool useAllDevices)
+DeviceSelection::DeviceSelection() :
+	type(CL_DEVICE_TYPE_GPU),
+	useAllDevices(true),
+	numaFission(false)
 {
-	initCL(useAllDevices);
+}
+
+/**
+  \brief Checks if selector given in DeviceSelection picks an object.
+  \param selector index of the object or a part of its name, empty selector
+  picks everything
+  \param index position of the object on the list
+  \param name name of the object
+  */
+static bool
+selects(const string& selector, unsigned int index, const string& name)
+{
+	if(selector.empty()) {
+		return true;
+	}
+	bool isIndex = true;
+	for(char c : selector) {
+		isIndex = isIndex && isdigit(c);
+	}
+	if(isIndex) {
+		return stoul(selector) == index;
+	}
+	return name.find(selector) != string::npos;
+}
+
+/**
+  \brief Splits CPU device into sub-devices, one for each NUMA node.
+  
+  Kernels run on a sub-device use only cores of one node.
+  \return sub-devices, or the device itself if it can't be split
+  */
+static vector<cl::Device>
+splitByNumaNode(cl::Device& device)
+{
+#if defined(CL_VERSION_1_2)
+	cl_device_partition_property props[] = {
+		CL_DEVICE_PARTITION_BY_AFFINITY_DOMAIN,
+		CL_DEVICE_AFFINITY_DOMAIN_NUMA,
+		0
+	};
+	vector<cl::Device> subDevices;
+	try {
+		device.createSubDevices(props, &subDevices);
+	} catch(cl::Error& e) {
+		//Single node machines and devices without affinity domain
+		//partitioning end up here
+		if(e.err() != CL_DEVICE_PARTITION_FAILED &&
+		   e.err() != CL_INVALID_VALUE) {
+			throw;
+		}
+		subDevices.clear();
+	}
+	if(!subDevices.empty()) {
+		cerr << "Device split into " << subDevices.size()
+		     << " NUMA nodes" << endl;
+		return subDevices;
+	}
+#endif
+	cerr << "Device can't be split by NUMA nodes, using it whole" << endl;
+	return vector<cl::Device>{device};
+}
+
+static DeviceSelection
+firstPlatformGpus(bool useAllDevices)
+{
+	DeviceSelection selection;
+	selection.useAllDevices = useAllDevices;
+	return selection;
+}
+
+/**
+  \param useAllDevices create command queue for every GPU of the first
+  platform, not only the first one
+  \param profiling enable profiling of command queues, needed by autotune()
+  */
+Context::Context(bool useAllDevices, bool profiling) :
+	Context(firstPlatformGpus(useAllDevices), profiling)
+{
+}
+
+/**
+  \param selection platform and devices to use
+  \param profiling enable profiling of command queues, needed by autotune()
+  */
+Context::Context(const DeviceSelection& selection, bool profiling) :
+	m_gridLayout(Grid::Layout::LINEAR)
+{
+	initCL(selection, profiling);
 	initKernels();
+	loadTuningFile();
 }
 
 Context::~Context()
@@ -29,27 +123,46 @@ Context::~Context()
 /**
   \brief Initializes OpenCL runtime.
   
-  This function initializes OpenCL context and command queue for each device
-  available on the first platform returned by cl::Platform::get.
+  This function initializes OpenCL context and command queue for each
+  selected device of the selected platform. The first device, if it's a
+  CPU, may be also split into sub-devices by NUMA node, which get a queue
+  each for blob evaluation, see Blob::setNodeQueues().
   */
-void Context::initCL(bool useAllDevices)
+void Context::initCL(const DeviceSelection& selection, bool profiling)
 {
 	vector<cl::Platform> platforms;
 	cl::Platform::get(&platforms);
 	if( platforms.empty() ){
 		throw runtime_error("No OpenCL platforms found");
 	}
-	cl::Platform platform = platforms[0];
+	cl::Platform platform;
 	string platformName;
-	platform.getInfo(CL_PLATFORM_NAME, &platformName);
-	cerr << "First OpenCL platform is: " << platformName << endl;
+	unsigned int platformIdx;
+	for(platformIdx=0; platformIdx<platforms.size(); platformIdx++) {
+		platforms[platformIdx].getInfo(CL_PLATFORM_NAME, &platformName);
+		if(selects(selection.platform, platformIdx, platformName)) {
+			platform = platforms[platformIdx];
+			break;
+		}
+	}
+	if(platformIdx == platforms.size()) {
+		throw runtime_error("No OpenCL platform matching " + selection.platform);
+	}
+	cerr << "OpenCL platform " << platformIdx << " is: " << platformName << endl;
 	
 	vector<cl::Device> devices;
-	platform.getDevices(CL_DEVICE_TYPE_GPU, &devices);
+	try {
+		platform.getDevices(selection.type, &devices);
+	} catch(cl::Error& e) {
+		if(e.err() != CL_DEVICE_NOT_FOUND) {
+			throw;
+		}
+	}
 	if(devices.empty()) {
-		throw runtime_error("No GPU devices found on this platform");
+		throw runtime_error("No devices of requested type found on this platform");
 	}
 	cerr << "OpenCL devices on this platform:" << endl;
+	vector<cl::Device> selected;
 	string devName, vendorName, devVersion, drvVersion;
 	for(int i=0; i<devices.size(); i++) {
 		cl::Device& dev = devices[i];
@@ -63,20 +176,47 @@ void Context::initCL(bool useAllDevices)
 		cerr << "Name:\t\t" << devName    << endl;
 		cerr << "Device version:\t" << devVersion << endl;
 		cerr << "Driver version:\t" << drvVersion << endl;
+		if(selects(selection.device, i, devName)) {
+			selected.push_back(dev);
+		}
+	}
+	if(selected.empty()) {
+		throw runtime_error("No OpenCL device matching " + selection.device);
+	}
+	if(!selection.useAllDevices) {
+		selected.resize(1);
 	}
 	
+	//Sub-devices are added to the context next to their device, so the
+	//device runs everything as a whole and its nodes only evaluate blobs
+	vector<cl::Device> nodes;
+	if(selection.numaFission) {
+		cl_device_type type;
+		selected[0].getInfo(CL_DEVICE_TYPE, &type);
+		if(type & CL_DEVICE_TYPE_CPU) {
+			nodes = splitByNumaNode(selected[0]);
+		} else {
+			cerr << "NUMA split applies to CPU devices only" << endl;
+		}
+		if(nodes.size() < 2) {
+			nodes.clear();
+		}
+	}
+	vector<cl::Device> contextDevices = selected;
+	contextDevices.insert(contextDevices.end(), nodes.begin(), nodes.end());
+	
 	cl_context_properties cps[] = {
 		CL_CONTEXT_PLATFORM, (cl_context_properties)(platform()),
 		0
 	};
-	m_context = cl::Context(CL_DEVICE_TYPE_GPU, cps);
+	m_context = cl::Context(contextDevices, cps);
 	
-	if(useAllDevices) {
-		for(cl::Device &dev : devices) {
-			m_queues.push_back(cl::CommandQueue{m_context, dev});
-		}
-	} else {
-		m_queues.push_back(cl::CommandQueue{m_context, devices[0]});
+	cl_command_queue_properties props = profiling ? CL_QUEUE_PROFILING_ENABLE : 0;
+	for(cl::Device &dev : selected) {
+		m_queues.push_back(cl::CommandQueue{m_context, dev, props});
+	}
+	for(cl::Device &dev : nodes) {
+		m_nodeQueues.push_back(cl::CommandQueue{m_context, dev, props});
 	}
 }
 
@@ -89,8 +229,11 @@ void Context::initKernels()
 		cl::Program utilProgram = buildProgram(utilKernelPath, m_context);
 		m_memSetKernel = cl::Kernel(utilProgram, "memSet");
 		m_blobProgram = new Blob(m_context, m_queues);
+		m_blobProgram->setNodeQueues(m_nodeQueues);
 		m_scanProgram = new Scan(m_context, m_queues);
 		m_mcProgram = new MarchingCubes(m_context, m_queues, m_scanProgram);
+		m_surfaceNetsProgram = new SurfaceNets(m_context, m_queues, m_scanProgram);
+		m_hpProgram = new HistoPyramid(m_context, m_queues, m_mcProgram);
 	} catch (BuildError &e) {
 		cerr << e.what() << endl;
 		cerr << e.log() << endl;
@@ -98,11 +241,68 @@ void Context::initKernels()
 	}
 }
 
+/**
+  Applies tuning of the first device saved by mcblob --autotune, if there is
+  one (see tuningFileName()). Otherwise, or if the file is invalid, defaults
+  of each program are kept.
+  */
+void Context::loadTuningFile()
+{
+	cl::Device dev;
+	m_queues[0].getInfo(CL_QUEUE_DEVICE, &dev);
+	string path = tuningFileName(dev);
+	KernelTuning tuning = getTuning();
+	try {
+		if(loadTuning(path, tuning)) {
+			cerr << "Kernel tuning loaded from " << path << endl;
+			setTuning(tuning);
+		}
+	} catch(runtime_error& e) {
+		cerr << "Ignoring tuning file: " << e.what() << endl;
+	}
+}
+
+/**
+  \return launch parameters currently used by the programs
+  */
+KernelTuning Context::getTuning() const
+{
+	KernelTuning tuning;
+	tuning.blobGroupSize = m_blobProgram->getWorkGroupSize();
+	tuning.blobGroupShape = m_blobProgram->getWorkGroupShape();
+	tuning.classifyGroupSize = m_mcProgram->getClassifyWorkGroupSize();
+	tuning.classifyGroupShape = m_mcProgram->getWorkGroupShape();
+	tuning.compactGroupSize = m_mcProgram->getCompactWorkGroupSize();
+	tuning.generateGroupSize = m_mcProgram->getGenerateWorkGroupSize();
+	tuning.gridLayout = m_gridLayout;
+	return tuning;
+}
+
+/**
+  Sets launch parameters of the programs. Values the device can't handle
+  are lowered by the programs.
+  */
+void Context::setTuning(const KernelTuning& tuning)
+{
+	m_blobProgram->setWorkGroupSize(tuning.blobGroupSize);
+	m_blobProgram->setWorkGroupShape(tuning.blobGroupShape);
+	m_mcProgram->setWorkGroupSizes(
+		tuning.classifyGroupSize,
+		tuning.compactGroupSize,
+		tuning.generateGroupSize
+	);
+	m_mcProgram->setWorkGroupShape(tuning.classifyGroupShape);
+	m_gridLayout = tuning.gridLayout;
+}
+
 /**
   This function cleans all kernel objects
  */
 void Context::deinitKernels()
 {
+	forgetThroughput(m_context);
+	delete m_hpProgram;
+	delete m_surfaceNetsProgram;
 	delete m_mcProgram;
 	delete m_scanProgram;
 	delete m_blobProgram;
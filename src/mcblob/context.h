@@ -2,28 +2,58 @@
 #define __MCBLOB_CONTEXT_H
 
 #include <CL/cl.hpp>
+#include <string>
 #include <vector>
 
+#include "tuning.h"
+
 class Blob;
+class HistoPyramid;
 class MarchingCubes;
 class Scan;
+class SurfaceNets;
+
+/**
+  \brief OpenCL platform and devices for which Context is created.
+  
+  Platform and device are given either by index, as listed by Context on
+  start, or by a part of their name.
+  */
+struct DeviceSelection {
+	std::string platform;   /**< first platform if empty */
+	std::string device;     /**< every device of the type if empty */
+	cl_device_type type;    /**< CL_DEVICE_TYPE_GPU by default */
+	bool useAllDevices;     /**< create queue for every selected device,
+	                             not only the first one */
+	bool numaFission;       /**< split the first device, if it's a CPU, into
+	                             sub-devices by NUMA node, which evaluate
+	                             blobs in parallel */
+	DeviceSelection();
+};
 
 class Context {
 protected:
 	cl::Context m_context;
 	std::vector<cl::CommandQueue> m_queues;
+	std::vector<cl::CommandQueue> m_nodeQueues; /**< queues of NUMA nodes
+	                                                 of the first device */
 	
 	Blob           *m_blobProgram;
 	MarchingCubes  *m_mcProgram;
 	Scan           *m_scanProgram;
+	SurfaceNets    *m_surfaceNetsProgram;
+	HistoPyramid   *m_hpProgram;
 	cl::Kernel     m_memSetKernel;
+	Grid::Layout   m_gridLayout;
 	
-	void initCL(bool useAllDevices);
+	void initCL(const DeviceSelection& selection, bool profiling);
 	void initKernels();
+	void loadTuningFile();
 	
 	void deinitKernels();
 public:
-	Context(bool useAllDevices = true);
+	Context(bool useAllDevices = true, bool profiling = false);
+	Context(const DeviceSelection& selection, bool profiling = false);
 	virtual ~Context();
 	
 	cl::Context&
@@ -41,8 +71,17 @@ public:
 	Scan*
 	getScanProgram() { return m_scanProgram; }
 	
+	SurfaceNets*
+	getSurfaceNetsProgram() { return m_surfaceNetsProgram; }
+	
+	HistoPyramid*
+	getHpProgram()   { return m_hpProgram; }
+	
 	cl::Kernel&
 	getMemsetKernel() { return m_memSetKernel; }
+	
+	KernelTuning getTuning() const;
+	void setTuning(const KernelTuning& tuning);
 
 };
 
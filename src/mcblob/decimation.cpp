@@ -0,0 +1,484 @@
+#include "config.h"
+#include "meshutil.h"
+#include "decimation.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <queue>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+
+using namespace std;
+
+/**
+  Symmetric 4x4 matrix of the quadric error metric (Garland & Heckbert).
+  Error of placing vertex at x is x^T A x + 2 b^T x + c.
+  */
+struct Quadric {
+	double a00 = 0.0, a01 = 0.0, a02 = 0.0;
+	double a11 = 0.0, a12 = 0.0, a22 = 0.0;
+	double b0 = 0.0, b1 = 0.0, b2 = 0.0;
+	double c = 0.0;
+
+	Quadric& operator+=(const Quadric& o) {
+		a00 += o.a00; a01 += o.a01; a02 += o.a02;
+		a11 += o.a11; a12 += o.a12; a22 += o.a22;
+		b0 += o.b0; b1 += o.b1; b2 += o.b2;
+		c += o.c;
+		return *this;
+	}
+
+	double error(const float3& p) const {
+		double x = p.x, y = p.y, z = p.z;
+		double e = a00*x*x + 2*a01*x*y + 2*a02*x*z +
+		           a11*y*y + 2*a12*y*z + a22*z*z +
+		           2*(b0*x + b1*y + b2*z) + c;
+		return std::max(0.0, e);
+	}
+
+	/**
+	  Finds position minimizing the error.
+	  \return false if the matrix is (nearly) singular
+	  */
+	bool optimum(float3& p) const {
+		double c00 = a11*a22 - a12*a12;
+		double c01 = a02*a12 - a01*a22;
+		double c02 = a01*a12 - a02*a11;
+		double det = a00*c00 + a01*c01 + a02*c02;
+		if(std::fabs(det) < 1e-12) {
+			return false;
+		}
+		double c11 = a00*a22 - a02*a02;
+		double c12 = a01*a02 - a00*a12;
+		double c22 = a00*a11 - a01*a01;
+		p.x = -(c00*b0 + c01*b1 + c02*b2) / det;
+		p.y = -(c01*b0 + c11*b1 + c12*b2) / det;
+		p.z = -(c02*b0 + c12*b1 + c22*b2) / det;
+		return true;
+	}
+};
+
+static float3 sub(const float3& a, const float3& b)
+{
+	return float3(a.x - b.x, a.y - b.y, a.z - b.z);
+}
+
+static float3 cross(const float3& a, const float3& b)
+{
+	return float3(
+		a.y*b.z - a.z*b.y,
+		a.z*b.x - a.x*b.z,
+		a.x*b.y - a.y*b.x
+	);
+}
+
+static float dot(const float3& a, const float3& b)
+{
+	return a.x*b.x + a.y*b.y + a.z*b.z;
+}
+
+static float length(const float3& a)
+{
+	return std::sqrt(dot(a, a));
+}
+
+static uint64_t edgeKey(unsigned int a, unsigned int b)
+{
+	if(a > b) {
+		std::swap(a, b);
+	}
+	return (static_cast<uint64_t>(a) << 32) | b;
+}
+
+/**
+  Merges vertices closer than epsilon and turns the mesh into indexed one.
+  Marching cubes generate every vertex once for each triangle using it, so
+  the mesh has to be welded before its connectivity can be used. Normals of
+  merged vertices are averaged.
+  */
+void weldVertices(MCMesh& mesh, float epsilon)
+{
+	unsigned int corners = mesh.indices.empty() ?
+		mesh.verts.size() : mesh.indices.size();
+	auto source = [&](unsigned int c) {
+		return mesh.indices.empty() ? c : mesh.indices[c];
+	};
+
+	unordered_map<uint64_t, vector<unsigned int>> hash;
+	PageAlignedVector<float3> verts;
+	PageAlignedVector<float3> normals;
+	vector<unsigned int> indices(corners);
+	vector<int> remap(mesh.verts.size(), -1);
+	for(unsigned int c=0; c<corners; c++) {
+		unsigned int s = source(c);
+		if(remap[s] >= 0) {
+			indices[c] = remap[s];
+			continue;
+		}
+		const float3& v = mesh.verts[s];
+		int cx = cellCoord(v.x, epsilon);
+		int cy = cellCoord(v.y, epsilon);
+		int cz = cellCoord(v.z, epsilon);
+		int found = -1;
+		for(int x=cx-1; x<=cx+1 && found < 0; x++) {
+			for(int y=cy-1; y<=cy+1 && found < 0; y++) {
+				for(int z=cz-1; z<=cz+1 && found < 0; z++) {
+					auto it = hash.find(cellKey(x, y, z));
+					if(it == hash.end()) {
+						continue;
+					}
+					for(unsigned int w : it->second) {
+						if(length(sub(verts[w], v)) <= epsilon) {
+							found = w;
+							break;
+						}
+					}
+				}
+			}
+		}
+		if(found < 0) {
+			found = verts.size();
+			verts.push_back(v);
+			normals.push_back(float3(0.0f, 0.0f, 0.0f));
+			hash[cellKey(cx, cy, cz)].push_back(found);
+		}
+		const float3& n = mesh.normals[s];
+		normals[found] = float3(
+			normals[found].x + n.x,
+			normals[found].y + n.y,
+			normals[found].z + n.z
+		);
+		remap[s] = found;
+		indices[c] = found;
+	}
+	for(float3& n : normals) {
+		float len = length(n);
+		if(len > 0.0f) {
+			n = float3(n.x / len, n.y / len, n.z / len);
+		}
+	}
+	mesh.verts.swap(verts);
+	mesh.normals.swap(normals);
+	mesh.indices.swap(indices);
+}
+
+namespace {
+
+/** Candidate edge collapse, removes vertex v and moves u to pos */
+struct Collapse {
+	double cost;
+	unsigned int u, v;
+	unsigned int stampU, stampV;
+	float3 pos;
+
+	bool operator<(const Collapse& o) const {
+		//inverted, so priority_queue returns the cheapest collapse
+		return cost > o.cost;
+	}
+};
+
+/**
+  Edge collapse simplification of a single indexed mesh.
+  */
+class Decimator
+{
+	MCMesh& mMesh;
+	vector<unsigned int>& mTris;
+	vector<bool> mTriAlive;
+	vector<vector<unsigned int>> mVertTris;
+	vector<Quadric> mQuadrics;
+	vector<bool> mLocked;
+	vector<bool> mRemoved;
+	vector<unsigned int> mStamp;
+	priority_queue<Collapse> mHeap;
+	unsigned int mAliveTris;
+
+	float3 triNormal(unsigned int t, unsigned int moved, const float3& pos) const {
+		float3 p[3];
+		for(int i=0; i<3; i++) {
+			unsigned int v = mTris[3*t + i];
+			p[i] = v == moved ? pos : mMesh.verts[v];
+		}
+		return cross(sub(p[1], p[0]), sub(p[2], p[0]));
+	}
+
+	void neighbours(unsigned int v, unordered_set<unsigned int>& out) const {
+		for(unsigned int t : mVertTris[v]) {
+			if(!mTriAlive[t]) {
+				continue;
+			}
+			for(int i=0; i<3; i++) {
+				if(mTris[3*t + i] != v) {
+					out.insert(mTris[3*t + i]);
+				}
+			}
+		}
+	}
+
+	void pushCollapse(unsigned int u, unsigned int v) {
+		if(mLocked[u] && mLocked[v]) {
+			return;
+		}
+		if(mLocked[v]) {
+			std::swap(u, v);
+		}
+		Quadric q = mQuadrics[u];
+		q += mQuadrics[v];
+
+		float3 pos;
+		const float3& pu = mMesh.verts[u];
+		const float3& pv = mMesh.verts[v];
+		if(mLocked[u]) {
+			pos = pu;
+		} else {
+			float3 mid((pu.x + pv.x) / 2, (pu.y + pv.y) / 2, (pu.z + pv.z) / 2, pu.w);
+			float3 opt;
+			//Optimum far from the edge comes from nearly flat regions
+			if(q.optimum(opt) &&
+			   length(sub(opt, mid)) <= length(sub(pu, pv))) {
+				opt.w = pu.w;
+				pos = opt;
+			} else {
+				pos = mid;
+				if(q.error(pu) < q.error(pos)) pos = pu;
+				if(q.error(pv) < q.error(pos)) pos = pv;
+			}
+		}
+		mHeap.push(Collapse{q.error(pos), u, v, mStamp[u], mStamp[v], pos});
+	}
+
+	bool collapseAllowed(const Collapse& c) const {
+		//Link condition: only two vertices may be shared by neighbourhoods
+		//of u and v, otherwise the collapse makes the mesh non-manifold
+		unordered_set<unsigned int> nu, nv;
+		neighbours(c.u, nu);
+		neighbours(c.v, nv);
+		unsigned int shared = 0;
+		for(unsigned int w : nv) {
+			shared += nu.count(w);
+		}
+		if(shared > 2) {
+			return false;
+		}
+		//Triangles must not flip
+		for(unsigned int moved : {c.u, c.v}) {
+			for(unsigned int t : mVertTris[moved]) {
+				if(!mTriAlive[t]) {
+					continue;
+				}
+				bool hasU = false, hasV = false;
+				for(int i=0; i<3; i++) {
+					hasU |= mTris[3*t + i] == c.u;
+					hasV |= mTris[3*t + i] == c.v;
+				}
+				if(hasU && hasV) {
+					continue;
+				}
+				float3 before = triNormal(t, moved, mMesh.verts[moved]);
+				float3 after = triNormal(t, moved, c.pos);
+				if(dot(before, after) <= 0.0f) {
+					return false;
+				}
+			}
+		}
+		return true;
+	}
+
+	void collapse(const Collapse& c) {
+		unsigned int u = c.u, v = c.v;
+		for(unsigned int t : mVertTris[v]) {
+			if(!mTriAlive[t]) {
+				continue;
+			}
+			bool hasU = false;
+			for(int i=0; i<3; i++) {
+				hasU |= mTris[3*t + i] == u;
+			}
+			if(hasU) {
+				mTriAlive[t] = false;
+				mAliveTris--;
+			} else {
+				for(int i=0; i<3; i++) {
+					if(mTris[3*t + i] == v) {
+						mTris[3*t + i] = u;
+					}
+				}
+				mVertTris[u].push_back(t);
+			}
+		}
+		mVertTris[v].clear();
+		mRemoved[v] = true;
+		mQuadrics[u] += mQuadrics[v];
+		mMesh.verts[u] = c.pos;
+		float3 n(
+			mMesh.normals[u].x + mMesh.normals[v].x,
+			mMesh.normals[u].y + mMesh.normals[v].y,
+			mMesh.normals[u].z + mMesh.normals[v].z
+		);
+		float len = length(n);
+		if(len > 0.0f) {
+			mMesh.normals[u] = float3(n.x / len, n.y / len, n.z / len);
+		}
+		mStamp[u]++;
+		mStamp[v]++;
+
+		unordered_set<unsigned int> nu;
+		neighbours(u, nu);
+		for(unsigned int w : nu) {
+			pushCollapse(u, w);
+		}
+	}
+
+	void compact() {
+		vector<int> remap(mMesh.verts.size(), -1);
+		PageAlignedVector<float3> verts;
+		PageAlignedVector<float3> normals;
+		vector<unsigned int> tris;
+		for(unsigned int t=0; t<mTriAlive.size(); t++) {
+			if(!mTriAlive[t]) {
+				continue;
+			}
+			for(int i=0; i<3; i++) {
+				unsigned int v = mTris[3*t + i];
+				if(remap[v] < 0) {
+					remap[v] = verts.size();
+					verts.push_back(mMesh.verts[v]);
+					normals.push_back(mMesh.normals[v]);
+				}
+				tris.push_back(remap[v]);
+			}
+		}
+		mMesh.verts.swap(verts);
+		mMesh.normals.swap(normals);
+		mMesh.indices.swap(tris);
+	}
+public:
+	Decimator(MCMesh& mesh) : mMesh(mesh), mTris(mesh.indices) {}
+
+	void run(const DecimationParams& params) {
+		unsigned int nVerts = mMesh.verts.size();
+		unsigned int nTris = mTris.size() / 3;
+		mTriAlive.assign(nTris, true);
+		mVertTris.assign(nVerts, vector<unsigned int>());
+		mQuadrics.assign(nVerts, Quadric());
+		mLocked.assign(nVerts, false);
+		mRemoved.assign(nVerts, false);
+		mStamp.assign(nVerts, 0);
+		mAliveTris = nTris;
+
+		unordered_map<uint64_t, unsigned int> edgeUse;
+		for(unsigned int t=0; t<nTris; t++) {
+			unsigned int a = mTris[3*t], b = mTris[3*t + 1], c = mTris[3*t + 2];
+			const float3& pa = mMesh.verts[a];
+			float3 n = cross(sub(mMesh.verts[b], pa), sub(mMesh.verts[c], pa));
+			float len = length(n);
+			if(len > 0.0f) {
+				n = float3(n.x / len, n.y / len, n.z / len);
+				double d = -dot(n, pa);
+				Quadric q;
+				q.a00 = n.x*n.x; q.a01 = n.x*n.y; q.a02 = n.x*n.z;
+				q.a11 = n.y*n.y; q.a12 = n.y*n.z; q.a22 = n.z*n.z;
+				q.b0 = n.x*d; q.b1 = n.y*d; q.b2 = n.z*d;
+				q.c = d*d;
+				mQuadrics[a] += q;
+				mQuadrics[b] += q;
+				mQuadrics[c] += q;
+			}
+			for(int i=0; i<3; i++) {
+				mVertTris[mTris[3*t + i]].push_back(t);
+				edgeUse[edgeKey(mTris[3*t + i], mTris[3*t + (i + 1) % 3])]++;
+			}
+		}
+		//Vertices on open borders (e.g. where the block meets its
+		//neighbours) must stay, otherwise blocks wouldn't fit each other
+		for(auto& e : edgeUse) {
+			if(e.second == 1) {
+				mLocked[e.first >> 32] = true;
+				mLocked[e.first & 0xffffffffu] = true;
+			}
+		}
+		for(auto& e : edgeUse) {
+			pushCollapse(e.first >> 32, e.first & 0xffffffffu);
+		}
+
+		double maxCost = params.maxError > 0.0f ?
+			static_cast<double>(params.maxError) * params.maxError : -1.0;
+		unsigned int targetTris = params.targetRatio > 0.0f ?
+			static_cast<unsigned int>(nTris * params.targetRatio) : 0;
+		while(!mHeap.empty() && mAliveTris > targetTris) {
+			Collapse c = mHeap.top();
+			mHeap.pop();
+			if(mRemoved[c.u] || mRemoved[c.v] ||
+			   c.stampU != mStamp[c.u] || c.stampV != mStamp[c.v]) {
+				//outdated entry
+				continue;
+			}
+			if(maxCost >= 0.0 && c.cost > maxCost) {
+				break;
+			}
+			if(collapseAllowed(c)) {
+				collapse(c);
+			}
+		}
+		compact();
+	}
+};
+
+} // anonymous namespace
+
+/**
+  Simplifies mesh with quadric error metrics edge collapses. Vertices on open
+  borders of the mesh are never moved, so meshes of neighbouring blocks
+  still fit each other after decimation. Triangle soups are welded first,
+  the result is always an indexed mesh.
+  \param mesh mesh to simplify, modified in place
+  \param params stop conditions of the simplification
+  */
+void decimateMesh(MCMesh& mesh, const DecimationParams& params)
+{
+	if(mesh.verts.empty()) {
+		return;
+	}
+	float3 lo = mesh.verts[0], hi = mesh.verts[0];
+	for(const float3& v : mesh.verts) {
+		lo = float3(std::min(lo.x, v.x), std::min(lo.y, v.y), std::min(lo.z, v.z));
+		hi = float3(std::max(hi.x, v.x), std::max(hi.y, v.y), std::max(hi.z, v.z));
+	}
+	float epsilon = std::max(length(sub(hi, lo)) * 1e-6f, 1e-12f);
+	weldVertices(mesh, epsilon);
+	Decimator(mesh).run(params);
+}
+
+/**
+  Simplifies meshes in parallel, each mesh on its own thread.
+  \param meshes meshes to simplify (e.g. one per block)
+  \param params stop conditions of the simplification
+  \param threads number of threads to use, 0 means one per hardware thread
+  */
+void decimateMeshes(
+	vector<MCMesh>& meshes,
+	const DecimationParams& params,
+	unsigned int threads)
+{
+	if(threads == 0) {
+		threads = std::max(1u, std::thread::hardware_concurrency());
+	}
+	threads = std::min<size_t>(threads, meshes.size());
+
+	std::atomic<size_t> next{0};
+	auto worker = [&]() {
+		for(size_t i = next++; i < meshes.size(); i = next++) {
+			decimateMesh(meshes[i], params);
+		}
+	};
+	vector<std::thread> pool;
+	for(unsigned int i=0; i<threads; i++) {
+		pool.push_back(std::thread(worker));
+	}
+	for(std::thread& t : pool) {
+		t.join();
+	}
+}
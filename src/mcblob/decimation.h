@@ -0,0 +1,33 @@
+#ifndef __MCBLOB_DECIMATION_H__
+#define __MCBLOB_DECIMATION_H__
+
+#include <vector>
+
+#include "common/mathtypes.h"
+#include "marchingcubes.h"
+
+/**
+  \brief Parameters of mesh decimation.
+
+  Decimation stops when the next edge collapse would move the surface
+  further than maxError or when number of triangles drops to targetRatio
+  of the original count, whichever comes first.
+  */
+struct DecimationParams {
+	float maxError = 0.0f; /**< maximal distance of the simplified surface
+	                            from the original one */
+	float targetRatio = 0.0f; /**< fraction of triangles to keep, 0 means
+	                               no limit */
+};
+
+void weldVertices(MCMesh& mesh, float epsilon);
+
+void decimateMesh(MCMesh& mesh, const DecimationParams& params);
+
+void decimateMeshes(
+	std::vector<MCMesh>& meshes,
+	const DecimationParams& params,
+	unsigned int threads = 0
+);
+
+#endif //__MCBLOB_DECIMATION_H__
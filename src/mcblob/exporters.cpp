@@ -39,8 +39,19 @@ void export_avr(vector<MCMesh> meshes, std::string fileName)
 			float3 vert{mcmesh.verts[i]};
 			mesh->addVertex(AVR::vec3{vert.x, vert.y, vert.z});
 		}
-		for(uint i{0}; i<mcmesh.verts.size(); i+=3) {
-			mesh->addFace(AVRFace{{i, i+1, i+2}, {i, i+1, i+2}, {0, 0, 0}});
+		if(mcmesh.indices.empty()) {
+			for(uint i{0}; i<mcmesh.verts.size(); i+=3) {
+				mesh->addFace(AVRFace{{i, i+1, i+2}, {i, i+1, i+2}, {0, 0, 0}});
+			}
+		} else {
+			const vector<unsigned int>& idx = mcmesh.indices;
+			for(uint i{0}; i+2<idx.size(); i+=3) {
+				mesh->addFace(AVRFace{
+					{idx[i], idx[i+1], idx[i+2]},
+					{idx[i], idx[i+1], idx[i+2]},
+					{0, 0, 0}
+				});
+			}
 		}
 		mesh->setMaterialId(0);
 		file.addMesh(mesh);
@@ -54,36 +65,46 @@ void export_avr(vector<MCMesh> meshes, std::string fileName)
 }
 void export_wavefront_obj(std::vector<MCMesh> meshes, std::string fileName)
 {
-	ofstream file;
-	file.exceptions(ofstream::failbit | ofstream::badbit);
-	file.open(fileName);
-	
-	for(int i{0}; i<meshes.size(); i++) {
-		MCMesh& mesh = meshes[i];
-		for(int j{0}; j < mesh.verts.size(); j++) {
-			float3 v = mesh.verts[j];
-			//x negated to make blender importer happy
-			file << "v " << -v.x << " " << v.y << " " << v.z << endl;
-		}
+	WavefrontObjWriter writer(fileName);
+	for(const MCMesh& mesh : meshes) {
+		writer.write(mesh);
 	}
-	for(int i{0}; i<meshes.size(); i++) {
-		MCMesh& mesh = meshes[i];
-		for(int j{0}; j < mesh.normals.size(); j++) {
-			float3 v = mesh.normals[j];
-			//x negated to make blender importer happy
-			file << "vn " << -v.x << " " << v.y << " " << v.z << endl;
-		}
+}
+
+WavefrontObjWriter::WavefrontObjWriter(const std::string& fileName) :
+	mBase{1}
+{
+	mFile.exceptions(ofstream::failbit | ofstream::badbit);
+	mFile.open(fileName);
+}
+
+void WavefrontObjWriter::write(const MCMesh& mesh)
+{
+	for(const float3& v : mesh.verts) {
+		//x negated to make blender importer happy
+		mFile << "v " << -v.x << " " << v.y << " " << v.z << "\n";
 	}
-	
-	int allVerts = 0;
-	for(int i{0}; i<meshes.size(); i++) {
-		allVerts += meshes[i].verts.size();
+	for(const float3& v : mesh.normals) {
+		mFile << "vn " << -v.x << " " << v.y << " " << v.z << "\n";
 	}
-	
-	for(int i{1}; i<allVerts; i+=3) {
-		file << "f " 
-		     << i   << "//" << i   << " "
-		     << i+1 << "//" << i+1 << " "
-		     << i+2 << "//" << i+2 << endl;
+	if(mesh.indices.empty()) {
+		for(unsigned int j{0}; j+2 < mesh.verts.size(); j+=3) {
+			unsigned int v = mBase + j;
+			mFile << "f "
+			      << v   << "//" << v   << " "
+			      << v+1 << "//" << v+1 << " "
+			      << v+2 << "//" << v+2 << "\n";
+		}
+	} else {
+		for(unsigned int j{0}; j+2 < mesh.indices.size(); j+=3) {
+			unsigned int v0 = mBase + mesh.indices[j];
+			unsigned int v1 = mBase + mesh.indices[j+1];
+			unsigned int v2 = mBase + mesh.indices[j+2];
+			mFile << "f "
+			      << v0 << "//" << v0 << " "
+			      << v1 << "//" << v1 << " "
+			      << v2 << "//" << v2 << "\n";
+		}
 	}
+	mBase += mesh.verts.size();
 }
@@ -4,8 +4,27 @@
 #include <vector>
 #include <string>
 #include <memory>
+#include <fstream>
 
 void export_avr(std::vector<MCMesh> meshes, std::string fileName);
 void export_wavefront_obj(std::vector<MCMesh> meshes, std::string fileName);
 
+/**
+  \brief Writes meshes to Wavefront OBJ file one by one, as they are
+  generated.
+
+  Vertices, normals and faces of each mesh are written together, so meshes
+  don't have to be kept in memory. export_wavefront_obj() writes with it
+  as well.
+  */
+class WavefrontObjWriter
+{
+protected:
+	std::ofstream mFile;
+	unsigned int mBase; /**< OBJ index of the first vertex of the next mesh */
+public:
+	WavefrontObjWriter(const std::string& fileName);
+	void write(const MCMesh& mesh);
+};
+
 #endif //__MCBLOB_EXPORTERS_H
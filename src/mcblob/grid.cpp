@@ -2,6 +2,16 @@
 #include "grid.h"
 #include "util.h"
 
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+
+constexpr float Grid::FIXED16_RANGE;
+constexpr cl_uint Grid::BRICK_DIM;
+
 /**
   \param gridDim dimension of grid, i.e. number of voxels in each dimension
   \param voxelSize size of singe voxel
@@ -11,6 +21,9 @@
   \param cq OpenCL command queue (in the same context as context
   parameter) that will be used to move data back and forth between the
   devices.
+  \param memSetKernel kernel used to clear the grid on the device
+  \param format format of data stored for each lattice point
+  \param layout order in which lattice points are stored
   */
 Grid::Grid(
 	uint3 gridDim,
@@ -18,7 +31,9 @@ Grid::Grid(
 	float3 startPos,
 	cl::Context& context,
 	cl::CommandQueue& cq,
-	cl::Kernel& memSetKernel
+	cl::Kernel& memSetKernel,
+	Format format,
+	Layout layout
 ) : 
 	mGridDim{gridDim},
 	mVoxelSize{voxelSize},
@@ -27,35 +42,161 @@ Grid::Grid(
 	mCommandQueue{cq},
 	mMemSetKernel{memSetKernel},
 	mStorage{Storage::HOST},
-	mValues{new float4[getFlatDataSize(gridDim)]}
-{ }
+	mFormat{format},
+	mLayout{layout},
+	mZeroCopy{hasUnifiedMemory(cq)},
+	mMapped{false},
+	mValues{nullptr}
+{
+	void* values;
+	if(posix_memalign(&values, HOST_DATA_ALIGNMENT, getDataSize()) != 0) {
+		throw std::bad_alloc();
+	}
+	mValues = static_cast<unsigned char*>(values);
+}
 
 Grid::~Grid()
 {
-	delete[] mValues;
+	if(mZeroCopy && mValuesBuffer() != nullptr) {
+		//The device may still use mValues. Errors can't be thrown from
+		//destructor, the queue is unusable anyway if these calls fail.
+		try {
+			if(mMapped) {
+				mCommandQueue.enqueueUnmapMemObject(mValuesBuffer, mValues);
+			}
+			mCommandQueue.finish();
+		} catch(cl::Error&) {
+		}
+		mValuesBuffer = cl::Buffer();
+	}
+	free(mValues);
 }
 
 /**
   This function calculates the number of data point on the grid that
   will be needed to keep the grid data. Basically, for x*y*z sized grid
   (in voxels in each dimension) you need (x+1) * (y+1) * (z+1) data
-  points. This is a utility function to compute that.
+  points. This is a utility function to compute that. Bricked layout
+  additionally needs padding up to whole bricks.
   */
 unsigned int
-Grid::getFlatDataSize(const uint3& gridDim)
+Grid::getFlatDataSize(const uint3& gridDim, Layout layout)
 {
+	if(layout == Layout::BRICKED) {
+		auto bricks = [](cl_uint points) {
+			return (points + BRICK_DIM - 1) / BRICK_DIM;
+		};
+		return bricks(gridDim.x + 1) * bricks(gridDim.y + 1) *
+		       bricks(gridDim.z + 1) * BRICK_DIM * BRICK_DIM * BRICK_DIM;
+	}
 	return (gridDim.x + 1) * (gridDim.y + 1) * (gridDim.z + 1);
 }
 
+/**
+  Host side counterpart of latticeIndex() from kernels/grid.cl.
+  
+  \param pos position of the lattice point, each coordinate up to size of
+  the grid (inclusive)
+  \return index of the lattice point in grid data (in elements, not bytes)
+  */
+size_t
+Grid::getPointIndex(const uint3& pos) const
+{
+	uint3 dataDim(mGridDim.x + 1, mGridDim.y + 1, mGridDim.z + 1);
+	if(mLayout == Layout::BRICKED) {
+		uint3 bricks(
+			(dataDim.x + BRICK_DIM - 1) / BRICK_DIM,
+			(dataDim.y + BRICK_DIM - 1) / BRICK_DIM,
+			(dataDim.z + BRICK_DIM - 1) / BRICK_DIM
+		);
+		size_t brick = (pos.z / BRICK_DIM * bricks.y + pos.y / BRICK_DIM) *
+		               bricks.x + pos.x / BRICK_DIM;
+		size_t inner = (pos.z % BRICK_DIM * BRICK_DIM + pos.y % BRICK_DIM) *
+		               BRICK_DIM + pos.x % BRICK_DIM;
+		return brick * BRICK_DIM * BRICK_DIM * BRICK_DIM + inner;
+	}
+	return (static_cast<size_t>(pos.z) * dataDim.y + pos.y) * dataDim.x + pos.x;
+}
+
+/**
+  \return size in bytes of data kept for single lattice point in given format
+  */
+size_t
+Grid::getElementSize(Format format)
+{
+	switch(format) {
+	case Format::SCALAR:
+		return sizeof(cl_float);
+	case Format::HALF:
+		return sizeof(cl_half);
+	case Format::FIXED16:
+		return sizeof(cl_short);
+	case Format::GRADIENT:
+	default:
+		return sizeof(cl_float4);
+	}
+}
+
+/**
+  \return size in bytes of whole grid data. It's rounded up to whole 32-bit
+  words so the grid can be cleared with memSet kernel.
+  */
+size_t
+Grid::getDataSize() const
+{
+	size_t size = getFlatDataSize(mGridDim, mLayout) * getElementSize(mFormat);
+	return (size + sizeof(cl_uint) - 1) / sizeof(cl_uint) * sizeof(cl_uint);
+}
+
+/**
+  \return 32-bit word that, repeated over the whole grid data, sets every
+  lattice point to val
+  */
+cl_uint
+Grid::getClearPattern(Format format, float val)
+{
+	cl_uint pattern;
+	cl_ushort half;
+	switch(format) {
+	case Format::HALF:
+		half = floatToHalf(val);
+		return cl_uint(half) | (cl_uint(half) << 16);
+	case Format::FIXED16:
+		half = static_cast<cl_ushort>(static_cast<cl_short>(std::lround(
+			std::max(-FIXED16_RANGE, std::min(FIXED16_RANGE, val)) /
+			FIXED16_RANGE * 32767.0f)));
+		return cl_uint(half) | (cl_uint(half) << 16);
+	case Format::SCALAR:
+	case Format::GRADIENT:
+	default:
+		std::memcpy(&pattern, &val, sizeof(pattern));
+		return pattern;
+	}
+}
+
 void
 Grid::copyToDevice()
 {
 	if(mStorage != Storage::DEVICE) {
-		size_t dataSize = getFlatDataSize(mGridDim) * sizeof(cl_float4);
-		mValuesBuffer = cl::Buffer(mContext, CL_MEM_READ_WRITE,
-		                           dataSize);
-		mCommandQueue.enqueueWriteBuffer(mValuesBuffer, CL_TRUE,
-		                                 0, dataSize, mValues);
+		size_t dataSize = getDataSize();
+		if(mZeroCopy) {
+			if(mMapped) {
+				mCommandQueue.enqueueUnmapMemObject(mValuesBuffer, mValues);
+				mMapped = false;
+			} else {
+				mValuesBuffer = cl::Buffer(
+					mContext,
+					CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR,
+					dataSize,
+					mValues
+				);
+			}
+		} else {
+			mValuesBuffer = cl::Buffer(mContext, CL_MEM_READ_WRITE,
+			                           dataSize);
+			mCommandQueue.enqueueWriteBuffer(mValuesBuffer, CL_TRUE,
+			                                 0, dataSize, mValues);
+		}
 		mStorage = Storage::DEVICE;
 	} else {
 		//Data already on the device
@@ -67,11 +208,20 @@ void
 Grid::copyToHost()
 {
 	if(mStorage != Storage::HOST) {
-		size_t dataSize = getFlatDataSize(mGridDim) * sizeof(cl_float4);
-		mCommandQueue.enqueueReadBuffer(mValuesBuffer, CL_TRUE, 0,
-		                                dataSize, mValues);
-		//Losing reference to Device buffer so it can get deallocated
-		mValuesBuffer = cl::Buffer();
+		size_t dataSize = getDataSize();
+		if(mZeroCopy) {
+			//Buffer was created with CL_MEM_USE_HOST_PTR, so it's mapped
+			//at mValues and the buffer is kept for the next copyToDevice()
+			mCommandQueue.enqueueMapBuffer(mValuesBuffer, CL_TRUE,
+			                               CL_MAP_READ | CL_MAP_WRITE,
+			                               0, dataSize);
+			mMapped = true;
+		} else {
+			mCommandQueue.enqueueReadBuffer(mValuesBuffer, CL_TRUE, 0,
+			                                dataSize, mValues);
+			//Losing reference to Device buffer so it can get deallocated
+			mValuesBuffer = cl::Buffer();
+		}
 		mStorage = Storage::HOST;
 	} else {
 		//Data already on host
@@ -79,6 +229,47 @@ Grid::copyToHost()
 	}
 }
 
+/**
+  \brief copy lattice slices (perpendicular to z) from other grid on the device
+  
+  Used to share faces of neighbouring blocks instead of computing them
+  twice. Slices sourceSlice..sourceSlice+count-1 of source become slices
+  0..count-1 of this grid. Both grids must have the same size along x and
+  y, the same format and linear layout (slices of bricked grids are not
+  contiguous).
+  
+  \param source grid from which slices are copied
+  \param sourceSlice index of the first copied lattice slice in source
+  \param count number of copied slices
+  */
+void
+Grid::copySlices(Grid& source, unsigned int sourceSlice, unsigned int count)
+{
+	if(source.mGridDim.x != mGridDim.x || source.mGridDim.y != mGridDim.y ||
+	   source.mFormat != mFormat || source.mLayout != Layout::LINEAR ||
+	   mLayout != Layout::LINEAR) {
+		throw std::runtime_error("Slices can be copied only between linear "
+		                         "grids of the same format and size");
+	}
+	if(sourceSlice + count > source.mGridDim.z + 1 || count > mGridDim.z + 1) {
+		throw std::runtime_error("Copied slices out of grid");
+	}
+	if(count == 0) {
+		return;
+	}
+	source.copyToDevice();
+	copyToDevice();
+	size_t sliceSize = static_cast<size_t>(mGridDim.x + 1) *
+	                   (mGridDim.y + 1) * getElementSize(mFormat);
+	mCommandQueue.enqueueCopyBuffer(
+		source.mValuesBuffer,
+		mValuesBuffer,
+		sourceSlice * sliceSize,
+		0,
+		count * sliceSize
+	);
+}
+
 /**
  * @brief clear grid data to specified value
  *
@@ -87,17 +278,22 @@ Grid::copyToHost()
 void
 Grid::clear(float val)
 {
+	cl_uint pattern = getClearPattern(mFormat, val);
 	if(mStorage == Storage::HOST) {
-		std::fill_n(mValues, getFlatDataSize(mGridDim), val);
+		std::fill_n(
+			reinterpret_cast<cl_uint*>(mValues),
+			getDataSize() / sizeof(cl_uint),
+			pattern
+		);
 	} else {
 		unsigned int i = 0;
-		mMemSetKernel.setArg(i++, val);
+		mMemSetKernel.setArg(i++, pattern);
 		mMemSetKernel.setArg(i++, mValuesBuffer);
 		
 		run1DKernelSingleQueue(
 			mMemSetKernel,
 			mCommandQueue,
-			getFlatDataSize(mGridDim)
+			getDataSize() / sizeof(cl_uint)
 		);
 	}
 }
@@ -7,15 +7,19 @@
   \brief Storage for 3D grid of values.
   
   This class keeps values of computed density function at lattice vertices of a
-  grid of voxels and at epsilon-distant positions along each axis (it's a
-  gradient for normal vector calculations). The returned buffer is float4 buffer
-  that keeps gradient values in xyz components, and density function value in w
-  component.
+  grid of voxels. Depending on the format of the grid (see Grid::Format), it
+  may also keep values at epsilon-distant positions along each axis (it's a
+  gradient for normal vector calculations). In that case the returned buffer
+  is float4 buffer that keeps gradient values in xyz components, and density
+  function value in w component. Scalar grids keep only the density and
+  normals are approximated from neighbouring samples when needed.
   
   This class can be fed to MarchingCubes class to run Marching cubes algorithm
   on the lattice.
   
-  It can move data between RAM and VRAM.
+  It can move data between RAM and VRAM. If the device shares memory with
+  the host, the device buffer uses host data directly and is only mapped
+  and unmapped instead.
   */
 class Grid
 {
@@ -25,11 +29,43 @@ public:
 			     (e.g. VRAM) associated with mContext */
 		HOST /**< Valid data is currently stored in host (e.g. RAM) */
 	};
+	
+	/**
+	  Format of data kept for each lattice point. Values must match
+	  GRID_FORMAT_* defines in kernels/grid.cl
+	  */
+	enum class Format : cl_uint {
+		GRADIENT = 0, /**< float4 per point, samples shifted by epsilon
+		                   along each axis in xyz, density in w */
+		SCALAR = 1, /**< single float per point, density only */
+		HALF = 2, /**< half precision float per point, density only */
+		FIXED16 = 3 /**< signed 16-bit fixed point density covering
+		                 <-FIXED16_RANGE, FIXED16_RANGE> */
+	};
+	
+	/**
+	  Order in which lattice points are kept. Values must match
+	  GRID_LAYOUT_* defines in kernels/grid.cl
+	  */
+	enum class Layout : cl_uint {
+		LINEAR = 0, /**< rows along x, then y, then z */
+		BRICKED = 1 /**< cubic bricks of BRICK_DIM^3 points, each stored
+		                 linearly, bricks ordered like rows of LINEAR.
+		                 Corners of most voxels are in a single brick,
+		                 which improves caching in extraction kernels */
+	};
+	
+	/** Range of values representable in Format::FIXED16 grids. Values
+	    outside of it are saturated. */
+	static constexpr float FIXED16_RANGE = 8.0f;
+	/** Size of the brick of Layout::BRICKED along each axis, must match
+	    GRID_BRICK_DIM in kernels/grid.cl */
+	static constexpr cl_uint BRICK_DIM = 4;
 protected:
 	cl::Context mContext;
 	cl::CommandQueue mCommandQueue;
 	cl::Kernel mMemSetKernel;
-	float4 *mValues;
+	unsigned char *mValues;
 	cl::Buffer mValuesBuffer;
 	uint3 mGridDim; /**< Size of the grid, i.e. how many small voxels are
 	                  in each dimension. For example, for a grid made of
@@ -39,8 +75,14 @@ protected:
 	float3 mStartPos;
 	
 	Storage mStorage;
+	Format mFormat;
+	Layout mLayout;
+	bool mZeroCopy; /**< device buffer is created over mValues and mapped
+	                     instead of copied */
+	bool mMapped; /**< mValuesBuffer is mapped to mValues */
 	
-	static unsigned int getFlatDataSize(const uint3& gridDim);
+	static unsigned int getFlatDataSize(const uint3& gridDim, Layout layout);
+	size_t getDataSize() const;
 public:
 
 	Grid(
@@ -49,7 +91,9 @@ public:
 		float3 startPos,
 		cl::Context& context,
 		cl::CommandQueue& cq,
-		cl::Kernel& memSetKernel
+		cl::Kernel& memSetKernel,
+		Format format = Format::GRADIENT,
+		Layout layout = Layout::LINEAR
 	);
 	//Make grid noncopyable
 	Grid(const Grid& other) = delete;
@@ -57,10 +101,16 @@ public:
 	virtual ~Grid();
 	
 	uint3 getGridSize() const { return mGridDim; }
+	cl_uint getVoxelCount() const { return mGridDim.x * mGridDim.y * mGridDim.z; }
 	float3 getStartPos() const { return mStartPos; }
 	float3 getVoxelSize() const { return mVoxelSize; }
 	void setStartPos(const float3& pos) { mStartPos = pos; }
-	float4* getValues() const { return mValues; }
+	Format getFormat() const { return mFormat; }
+	Layout getLayout() const { return mLayout; }
+	size_t getPointIndex(const uint3& pos) const;
+	float4* getValues() const { return reinterpret_cast<float4*>(mValues); }
+	float* getScalarValues() const { return reinterpret_cast<float*>(mValues); }
+	void* getRawValues() const { return mValues; }
 	cl::Buffer getValuesBuffer() const { return mValuesBuffer; }
 	
 	void clear(float val=0.0f);
@@ -72,9 +122,15 @@ public:
 	  this grid.
 	  */
 	Storage getStorage() { return mStorage; }
+	bool isZeroCopy() const { return mZeroCopy; }
 	
 	void copyToDevice();
 	void copyToHost();
+	
+	void copySlices(Grid& source, unsigned int sourceSlice, unsigned int count);
+	
+	static size_t getElementSize(Format format);
+	static cl_uint getClearPattern(Format format, float val);
 };
 
 #endif
@@ -0,0 +1,170 @@
+#include "config.h"
+
+#include "util.h"
+#include "grid.h"
+#include "histopyramid.h"
+
+#include <algorithm>
+#include <memory>
+
+using namespace std;
+
+//path of the cl source
+static const string sPath = "kernels/histopyramid.cl";
+
+//Kernel functions names
+static const char sClassifyFunc[] = "hpClassify";
+static const char sReduceFunc[] = "hpReduce";
+static const char sTraverseFunc[] = "hpTraverse";
+
+//Constants
+static const int HISTOPYRAMID_THREADS_PER_WG = 128;
+
+/**
+  \param mc pointer to initialized marching cubes program object, its
+  tables are shared
+*/
+HistoPyramid::HistoPyramid(
+	const cl::Context& ctx,
+	const vector<cl::CommandQueue>& queues,
+	MarchingCubes *mc) : AbstractProgram(sPath, ctx, queues), mMcOp(mc)
+{
+	mClassifyKernel = cl::Kernel(mProgram, sClassifyFunc);
+	mReduceKernel = cl::Kernel(mProgram, sReduceFunc);
+	mTraverseKernel = cl::Kernel(mProgram, sTraverseFunc);
+}
+
+/**
+  \return number of cells of the pyramid level along each axis, the base
+  size halved level times, but at least 1
+  */
+static uint3 levelSize(const uint3& baseSize, cl_uint level)
+{
+	return uint3(
+		max(baseSize.x >> level, 1u),
+		max(baseSize.y >> level, 1u),
+		max(baseSize.z >> level, 1u)
+	);
+}
+
+/**
+  This function computes triangle mesh from scalar field described
+  by grid.
+  
+  \param grid scalar field which describes isosurface
+  \param isoValue value that will be treated as a frontier of the
+  surface
+  \return triangle soup, the same as MarchingCubes::compute()
+*/
+MCMesh HistoPyramid::compute(Grid &grid, float isoValue)
+{
+	MCMesh ret;
+	grid.copyToDevice();
+	uint3 gridSize = grid.getGridSize();
+	if(grid.getVoxelCount() == 0) {
+		return ret;
+	}
+	
+	//Every axis is padded to a power of two on its own, so flat grids don't
+	//get pyramids of cubes. Axes which reach 1 on some level aren't reduced
+	//any further.
+	uint3 baseSize(1, 1, 1);
+	cl_uint levels = 1;
+	while(baseSize.x < gridSize.x || baseSize.y < gridSize.y ||
+	      baseSize.z < gridSize.z) {
+		for(int c=0; c<3; c++) {
+			if(baseSize.cell[c] < gridSize.cell[c]) {
+				baseSize.cell[c] *= 2;
+			}
+		}
+		levels++;
+	}
+	vector<cl_uint> offsets;
+	vector<cl_uint> levelCells;
+	cl_uint pyramidSize = 0;
+	for(cl_uint l=0; l<levels; l++) {
+		uint3 size = levelSize(baseSize, l);
+		offsets.push_back(pyramidSize);
+		levelCells.push_back(size.x * size.y * size.z);
+		pyramidSize += levelCells.back();
+	}
+	cl::Buffer pyramid = cl::Buffer(
+		mContext, CL_MEM_READ_WRITE, sizeof(cl_uint) * pyramidSize);
+	
+	//Base level with vertex counts
+	cl_uint numCells = levelCells[0];
+	unsigned int i = 0;
+	mClassifyKernel.setArg(i++, grid.getValuesBuffer());
+	mClassifyKernel.setArg(i++, grid.getFormat());
+	mClassifyKernel.setArg(i++, grid.getLayout());
+	mClassifyKernel.setArg(i++, pyramid);
+	mClassifyKernel.setArg(i++, gridSize);
+	mClassifyKernel.setArg(i++, isoValue);
+	mClassifyKernel.setArg(i++, baseSize);
+	mClassifyKernel.setArg(i++, mMcOp->getNumVertsTable());
+	run1DKernelSingleQueue(
+		mClassifyKernel,
+		mFirstQueue,
+		numCells,
+		HISTOPYRAMID_THREADS_PER_WG
+	);
+	
+	//Reduction levels
+	for(cl_uint l=1; l<levels; l++) {
+		i = 0;
+		mReduceKernel.setArg(i++, pyramid);
+		mReduceKernel.setArg(i++, offsets[l-1]);
+		mReduceKernel.setArg(i++, offsets[l]);
+		mReduceKernel.setArg(i++, levelSize(baseSize, l-1));
+		mReduceKernel.setArg(i++, levelSize(baseSize, l));
+		run1DKernelSingleQueue(
+			mReduceKernel,
+			mFirstQueue,
+			levelCells[l],
+			HISTOPYRAMID_THREADS_PER_WG
+		);
+	}
+	
+	cl_uint totalVerts;
+	mFirstQueue.enqueueReadBuffer(
+		pyramid, CL_TRUE, sizeof(cl_uint) * offsets.back(),
+		sizeof(cl_uint), &totalVerts);
+	if(totalVerts == 0) {
+		return ret;
+	}
+	
+	cl::Buffer verts = cl::Buffer(
+		mContext, CL_MEM_WRITE_ONLY, sizeof(cl_float4) * totalVerts);
+	cl::Buffer normals = cl::Buffer(
+		mContext, CL_MEM_WRITE_ONLY, sizeof(cl_float4) * totalVerts);
+	i = 0;
+	mTraverseKernel.setArg(i++, verts);
+	mTraverseKernel.setArg(i++, normals);
+	mTraverseKernel.setArg(i++, grid.getValuesBuffer());
+	mTraverseKernel.setArg(i++, grid.getFormat());
+	mTraverseKernel.setArg(i++, grid.getLayout());
+	mTraverseKernel.setArg(i++, pyramid);
+	mTraverseKernel.setArg(i++, levels);
+	mTraverseKernel.setArg(i++, baseSize);
+	mTraverseKernel.setArg(i++, gridSize);
+	mTraverseKernel.setArg(i++, grid.getVoxelSize());
+	mTraverseKernel.setArg(i++, grid.getStartPos());
+	mTraverseKernel.setArg(i++, isoValue);
+	mTraverseKernel.setArg(i++, totalVerts);
+	mTraverseKernel.setArg(i++, mMcOp->getTriangleTable());
+	run1DKernelSingleQueue(
+		mTraverseKernel,
+		mFirstQueue,
+		totalVerts,
+		HISTOPYRAMID_THREADS_PER_WG
+	);
+	
+	unique_ptr<float3[]> hVertices{new float3[totalVerts]};
+	unique_ptr<float3[]> hNormals{new float3[totalVerts]};
+	mFirstQueue.enqueueReadBuffer(verts, CL_TRUE, 0, sizeof(float3) * totalVerts, hVertices.get());
+	mFirstQueue.enqueueReadBuffer(normals, CL_TRUE, 0, sizeof(float3) * totalVerts, hNormals.get());
+	ret.verts.assign(hVertices.get(), hVertices.get() + totalVerts);
+	ret.normals.assign(hNormals.get(), hNormals.get() + totalVerts);
+	
+	return ret;
+}
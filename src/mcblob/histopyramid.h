@@ -0,0 +1,41 @@
+#ifndef __MCBLOB_HISTOPYRAMID_H__
+#define __MCBLOB_HISTOPYRAMID_H__
+
+#include "abstractprogram.h"
+#include "marchingcubes.h"
+#include "common/mathtypes.h"
+
+class Grid;
+
+/**
+  \brief Histogram pyramid (HPMC) variant of Marching cubes.
+  
+  Produces the same meshes as MarchingCubes, but instead of compacting
+  occupied voxels and scanning per voxel vertex counts it builds a
+  reduction pyramid over vertex counts and generates each output vertex by
+  descending it. Apart from the output, only the pyramid (about 8/7 of a
+  single per voxel array) is allocated.
+  
+  The pyramid covers a box with power of two edges, so grids which have
+  other sizes are padded along each axis separately.
+  */
+class HistoPyramid : public AbstractProgram
+{
+protected:
+	cl::Kernel mClassifyKernel;
+	cl::Kernel mReduceKernel;
+	cl::Kernel mTraverseKernel;
+	
+	MarchingCubes* mMcOp;
+public:
+	HistoPyramid(
+		const cl::Context& ctx,
+		const std::vector<cl::CommandQueue> &queues,
+		MarchingCubes* mc
+	);
+	virtual ~HistoPyramid() {}
+	
+	MCMesh compute(Grid& grid, float isoValue);
+};
+
+#endif // __MCBLOB_HISTOPYRAMID_H__
@@ -1,73 +1,574 @@
+#include "grid.cl"
+
 #define EPSILON 0.0001
 
 #define BLOBINESS 1.0f
 
-uint4 calcGridPos(uint i, uint4 gridSize)
+/*
+ * Blobs are passed to kernels as (x, y, z, 1/R^2), see Blob::uploadBlobs(),
+ * where R is the radius of influence of the blob.
+ * Work items of a work group read them from global memory together, tile
+ * of work group size at a time, into local memory passed as blobTile
+ * argument.
+ * Work groups may be one or three dimensional.
+ * All work items of the group must thus take part in the loop over blobs,
+ * even ones without lattice point to compute.
+ */
+
+/*
+ * Field function of a single blob. BLOB_FALLOFF_* must match Blob::Falloff
+ * enum on the host side. Every function is 1 at the blob's radius r (half of
+ * its diameter). All but BLOB_FALLOFF_GAUSSIAN are 0 at distance R and
+ * further, R / r is given by Blob::getSupportRatio().
+ */
+#define BLOB_FALLOFF_GAUSSIAN           0 /* exp(1 - d^2/r^2), R = r */
+#define BLOB_FALLOFF_WYVILL             1 /* soft objects polynomial, R = 2r */
+#define BLOB_FALLOFF_MURAKAMI           2 /* (1 - d^2/R^2)^2, R = 2r */
+#define BLOB_FALLOFF_TRUNCATED_GAUSSIAN 3 /* Gaussian shifted to 0 at R = 3r */
+
+/** exp(1 - 3^2), value of the Gaussian at R of BLOB_FALLOFF_TRUNCATED_GAUSSIAN */
+#define TRUNCATED_GAUSSIAN_TAIL 3.3546262790251185e-4f
+
+/**
+  Value of the field function at squared distance from the blob's center
+  given in units of R^2.
+  */
+float
+falloffValue(float s2, uint falloff)
 {
-	uint z = i / (gridSize.x * gridSize.y);
-	i -= z * (gridSize.x * gridSize.y);
-	uint y = i / gridSize.x;
-	i -= y * gridSize.x;
-	uint x = i;
-	
-	return (uint4) (x, y, z, 0);
+	float t;
+	switch(falloff) {
+	case BLOB_FALLOFF_WYVILL:
+		s2 = fmin(s2, 1.0f);
+		//scaled by 2 to be 1 at s = 1/2
+		return 2.0f * (1.0f + s2 * (-22.0f / 9.0f +
+		                      s2 * (17.0f / 9.0f - 4.0f / 9.0f * s2)));
+	case BLOB_FALLOFF_MURAKAMI:
+		t = 1.0f - fmin(s2, 1.0f);
+		//scaled by 16/9 to be 1 at s = 1/2
+		return 16.0f / 9.0f * t * t;
+	case BLOB_FALLOFF_TRUNCATED_GAUSSIAN:
+		s2 = fmin(s2, 1.0f);
+		return (native_exp(BLOBINESS - BLOBINESS * 9.0f * s2) - TRUNCATED_GAUSSIAN_TAIL) /
+		       (1.0f - TRUNCATED_GAUSSIAN_TAIL);
+	default:
+		return native_exp(BLOBINESS - BLOBINESS * s2);
+	}
 }
 
 float
-singleBlobVal(float4 blob, float4 pos)
+singleBlobVal(float4 blob, float4 pos, uint falloff)
 {
 	float4 dist = (float4)(blob.xyz - pos.xyz, 0.0f);
 	
-	return native_exp(
-		-BLOBINESS * native_recip(blob.w*blob.w) * dot(dist, dist) + BLOBINESS
-	);
+	return falloffValue(blob.w * dot(dist, dist), falloff);
+}
+
+/** Index of the work item within its work group, in x-y-z order */
+uint
+localLinearId()
+{
+	return (get_local_id(2) * get_local_size(1) + get_local_id(1)) *
+	       get_local_size(0) + get_local_id(0);
+}
+
+/** Number of work items in the work group */
+uint
+localLinearSize()
+{
+	return get_local_size(0) * get_local_size(1) * get_local_size(2);
+}
+
+/**
+  Copies blobs first..first+count-1 to blobTile. Must be called by all work
+  items of the group.
+  */
+void
+loadBlobTile(
+	__global const float4* blobs,
+	int first,
+	int count,
+	__local float4* blobTile)
+{
+	uint lid = localLinearId();
+	barrier(CLK_LOCAL_MEM_FENCE);
+	if(lid < count) {
+		blobTile[lid] = blobs[first + lid];
+	}
+	barrier(CLK_LOCAL_MEM_FENCE);
+}
+
+/**
+  Sums values of blobs at pos. Density is returned in w component, for
+  GRID_FORMAT_GRADIENT also values at positions shifted by EPSILON along each
+  axis are returned in x, y and z. With compact support falloff, blobs
+  farther than R from all of these positions are skipped.
+  */
+float4
+blobSample(
+	float4 pos,
+	__global const float4* blobs,
+	int nBlobs,
+	__local float4* blobTile,
+	uint falloff,
+	uint format)
+{
+	float val = 0.0f;
+	float3 norm = (float3) (0.0f, 0.0f, 0.0f);
+	float4 blob;
+	float3 tmpNorm;
+	int groupSize = localLinearSize();
+	for(int first=0; first<nBlobs; first+=groupSize) {
+		int count = min(nBlobs - first, groupSize);
+		loadBlobTile(blobs, first, count, blobTile);
+		for(int i=0; i<count; i++) {
+			blob = blobTile[i];
+			if(falloff != BLOB_FALLOFF_GAUSSIAN) {
+				float reach = native_rsqrt(blob.w) + EPSILON;
+				float4 dist = (float4)(blob.xyz - pos.xyz, 0.0f);
+				if(dot(dist, dist) >= reach * reach) {
+					continue;
+				}
+			}
+			val += singleBlobVal(blob, pos, falloff);
+			
+			if(format == GRID_FORMAT_GRADIENT) {
+				//Calculate gradient
+				tmpNorm.x = singleBlobVal(blob, pos + (float4)(EPSILON, 0.0f, 0.0f, 0.0f), falloff);
+				tmpNorm.y = singleBlobVal(blob, pos + (float4)(0.0f, EPSILON, 0.0f, 0.0f), falloff);
+				tmpNorm.z = singleBlobVal(blob, pos + (float4)(0.0f, 0.0f, EPSILON, 0.0f), falloff);
+				
+				norm += tmpNorm;
+			}
+		}
+	}
+	return (float4) (norm.x, norm.y, norm.z, val);
 }
 
 /**
   This kernel adds a set of blobs to the grid.
-  Output parameter is values, density function values
-  are kept in w component and values of gradient are kept in
-  x,y,z components.
+  Output parameter is values. For GRID_FORMAT_GRADIENT density function values
+  are kept in w component and values of gradient are kept in x,y,z
+  components. For GRID_FORMAT_SCALAR only density is computed and stored.
+  Only nPoints lattice points starting at firstPoint (in x-y-z order) are
+  computed, so leading slices along z may be skipped. All blobs are summed
+  in a single run, so every lattice point is written once.
   */
 __kernel void
 blobValue(
 	float4 startPoint,
 	uint4 gridSize,
 	float4 voxelSize,
-	__constant float4* blobs,
+	__global const float4* blobs,
 	int nBlobs,
-	__global float4* values,
+	__local float4* blobTile,
+	uint falloff,
+	__global void* values,
+	uint format,
+	uint layout,
+	uint firstPoint,
 	int nPoints
 	)
 {
 	uint tid = get_global_id(0);
-	uint4 gridPos = calcGridPos(tid, gridSize + (uint4)(1,1,1,0));
+	bool active = tid < nPoints;
+	uint4 dataGridSize = gridSize + (uint4)(1,1,1,0);
+	uint4 gridPos = calcGridPos(firstPoint + (active ? tid : 0), dataGridSize);
 	float4 pos;
 	pos.x = startPoint.x + gridPos.x * voxelSize.x;
 	pos.y = startPoint.y + gridPos.y * voxelSize.y;
 	pos.z = startPoint.z + gridPos.z * voxelSize.z;
 	pos.w = 1.0f;
 	
-	float val = values[tid].w;
-	float3 norm = values[tid].xyz;
-	float4 blob;
-	float tmpVal;
-	float3 tmpNorm;
-	for(int i=0; i<nBlobs; i++) {
-		blob = blobs[i];
-		blob.w /= 2.0f; //HACK: we have diameter in parameter, but equations in form below treat .w as radius
-		
-		tmpVal = singleBlobVal(blob, pos);
-		val += tmpVal;
-		
-		//Calculate gradient
-		tmpNorm.x = singleBlobVal(blob, pos + (float4)(EPSILON, 0.0f, 0.0f, 0.0f));
-		tmpNorm.y = singleBlobVal(blob, pos + (float4)(0.0f, EPSILON, 0.0f, 0.0f));
-		tmpNorm.z = singleBlobVal(blob, pos + (float4)(0.0f, 0.0f, EPSILON, 0.0f));
+	float4 value = blobSample(pos, blobs, nBlobs, blobTile, falloff, format);
+	if(active) {
+		addValue(values, latticeIndex(gridPos, dataGridSize, layout),
+		         format, value);
+	}
+}
+
+/**
+  Variant of blobValue launched over 3D range, one work item per lattice
+  point, so no division is needed to find it. The range starts at slice
+  firstSlice and may be rounded up to whole work groups.
+  */
+__kernel void
+blobValue3D(
+	float4 startPoint,
+	uint4 gridSize,
+	float4 voxelSize,
+	__global const float4* blobs,
+	int nBlobs,
+	__local float4* blobTile,
+	uint falloff,
+	__global void* values,
+	uint format,
+	uint layout,
+	uint firstSlice
+	)
+{
+	uint4 dataGridSize = gridSize + (uint4)(1,1,1,0);
+	uint4 gridPos = (uint4) (
+		get_global_id(0), get_global_id(1), firstSlice + get_global_id(2), 0);
+	bool active = gridPos.x < dataGridSize.x &&
+	              gridPos.y < dataGridSize.y &&
+	              gridPos.z < dataGridSize.z;
+	float4 pos;
+	pos.x = startPoint.x + gridPos.x * voxelSize.x;
+	pos.y = startPoint.y + gridPos.y * voxelSize.y;
+	pos.z = startPoint.z + gridPos.z * voxelSize.z;
+	pos.w = 1.0f;
+	
+	float4 value = blobSample(pos, blobs, nBlobs, blobTile, falloff, format);
+	if(active) {
+		addValue(values, latticeIndex(gridPos, dataGridSize, layout),
+		         format, value);
+	}
+}
+
+/**
+  Variant of blobValue3D for BLOB_FALLOFF_GAUSSIAN, which factors into
+  exp(1 - |d|^2/r^2) = e * exp(-dx^2/r^2) * exp(-dy^2/r^2) * exp(-dz^2/r^2).
+  For every tile of blobs the work group first computes these factors for
+  lattice coordinates of its box along each axis, sx + sy + sz exponentials
+  per blob instead of sx * sy * sz, then every work item multiplies three of
+  them. Gradient is analytic, 2/r^2 * (blob - pos) times the blob's value,
+  and for GRID_FORMAT_GRADIENT is stored as samples shifted by EPSILON to the
+  first order.
+  Blobs are loaded blobsPerTile at a time, which can't exceed work group
+  size. factors must hold blobsPerTile * (sx + sy + sz) floats, where
+  (sx, sy, sz) is the shape of the work group.
+  */
+__kernel void
+blobValueSeparable(
+	float4 startPoint,
+	uint4 gridSize,
+	float4 voxelSize,
+	__global const float4* blobs,
+	int nBlobs,
+	__local float4* blobTile,
+	uint falloff,
+	__global void* values,
+	uint format,
+	uint layout,
+	uint firstSlice,
+	__local float* factors,
+	int blobsPerTile
+	)
+{
+	uint4 dataGridSize = gridSize + (uint4)(1,1,1,0);
+	uint4 gridPos = (uint4) (
+		get_global_id(0), get_global_id(1), firstSlice + get_global_id(2), 0);
+	bool active = gridPos.x < dataGridSize.x &&
+	              gridPos.y < dataGridSize.y &&
+	              gridPos.z < dataGridSize.z;
+	float4 pos;
+	pos.x = startPoint.x + gridPos.x * voxelSize.x;
+	pos.y = startPoint.y + gridPos.y * voxelSize.y;
+	pos.z = startPoint.z + gridPos.z * voxelSize.z;
+	pos.w = 1.0f;
+	
+	//Position of the work group's first lattice point and offsets of
+	//factors of this work item along each axis
+	float4 corner;
+	corner.x = pos.x - get_local_id(0) * voxelSize.x;
+	corner.y = pos.y - get_local_id(1) * voxelSize.y;
+	corner.z = pos.z - get_local_id(2) * voxelSize.z;
+	uint sx = get_local_size(0);
+	uint sy = get_local_size(1);
+	uint axesLen = sx + sy + get_local_size(2);
+	uint fx = get_local_id(0);
+	uint fy = sx + get_local_id(1);
+	uint fz = sx + sy + get_local_id(2);
+	
+	uint lid = localLinearId();
+	uint groupSize = localLinearSize();
+	float val = 0.0f;
+	float4 grad = (float4) (0.0f, 0.0f, 0.0f, 0.0f);
+	for(int first=0; first<nBlobs; first+=blobsPerTile) {
+		int count = min(nBlobs - first, blobsPerTile);
+		loadBlobTile(blobs, first, count, blobTile);
+		for(uint f=lid; f<count*axesLen; f+=groupSize) {
+			uint b = f / axesLen;
+			uint a = f - b * axesLen;
+			float4 blob = blobTile[b];
+			float d;
+			if(a < sx) {
+				d = corner.x + a * voxelSize.x - blob.x;
+			} else if(a < sx + sy) {
+				d = corner.y + (a - sx) * voxelSize.y - blob.y;
+			} else {
+				d = corner.z + (a - sx - sy) * voxelSize.z - blob.z;
+			}
+			factors[f] = native_exp(-BLOBINESS * blob.w * d * d);
+		}
+		barrier(CLK_LOCAL_MEM_FENCE);
+		for(int i=0; i<count; i++) {
+			__local const float* blobFactors = factors + i * axesLen;
+			float v = blobFactors[fx] * blobFactors[fy] * blobFactors[fz];
+			val += v;
+			if(format == GRID_FORMAT_GRADIENT) {
+				float4 blob = blobTile[i];
+				grad += v * blob.w * (float4) (blob.xyz - pos.xyz, 0.0f);
+			}
+		}
+	}
+	
+	float scale = native_exp(BLOBINESS);
+	val *= scale;
+	grad *= 2.0f * BLOBINESS * scale;
+	float4 value = (float4) (val + EPSILON * grad.xyz, val);
+	if(active) {
+		addValue(values, latticeIndex(gridPos, dataGridSize, layout),
+		         format, value);
+	}
+}
+
+/**
+  Scatter variant of blobValue3D for falloffs with compact support. Each
+  blob is added by lanesPerBlob work items to lattice points of its
+  footprint, the box around the blob's radius of influence R (extended by
+  EPSILON for shifted samples), clipped to the grid and to slices from
+  firstSlice on. Work is thus proportional to the sum of footprints, not to
+  lattice points times blobs. A work group adds blobsPerGroup consecutive
+  blobs starting from firstBlob, so small footprints don't leave most of
+  the group idle; work items past blobsPerGroup * lanesPerBlob do nothing.
+  Footprints of blobs overlap, so values are accumulated atomically, which
+  limits format to GRID_FORMAT_GRADIENT and GRID_FORMAT_SCALAR.
+  */
+__kernel void
+splatBlobs(
+	float4 startPoint,
+	uint4 gridSize,
+	float4 voxelSize,
+	__global const float4* blobs,
+	int nBlobs,
+	uint falloff,
+	__global void* values,
+	uint format,
+	uint layout,
+	uint firstSlice,
+	int firstBlob,
+	uint blobsPerGroup,
+	uint lanesPerBlob
+	)
+{
+	uint slot = get_local_id(0) / lanesPerBlob;
+	uint lane = get_local_id(0) - slot * lanesPerBlob;
+	if(slot >= blobsPerGroup) {
+		return;
+	}
+	int b = firstBlob + (int) (get_group_id(0) * blobsPerGroup + slot);
+	if(b >= nBlobs) {
+		return;
+	}
+	float4 blob = blobs[b];
+	float reach = native_rsqrt(blob.w) + EPSILON;
+	int4 dataGridSize = convert_int4(gridSize) + (int4)(1,1,1,0);
+	float4 c = (float4) (blob.xyz, 0.0f);
+	float4 start = (float4) (startPoint.xyz, 0.0f);
+	float4 step = (float4) (voxelSize.xyz, 1.0f);
+	//Blobs far from the grid would overflow plain conversions, bounds are
+	//clamped to the lattice (or just past it) so box can't overflow either
+	int4 lo = convert_int4_sat_rtp((c - reach - start) / step);
+	int4 hi = convert_int4_sat_rtn((c + reach - start) / step);
+	lo = min(max(lo, (int4) (0, 0, (int) firstSlice, 0)), dataGridSize);
+	hi = max(min(hi, dataGridSize - (int4)(1,1,1,1)), (int4) (-1,-1,-1,-1));
+	int4 box = hi - lo + (int4)(1,1,1,1);
+	if(box.x <= 0 || box.y <= 0 || box.z <= 0) {
+		return;
+	}
+	
+	int nPoints = box.x * box.y * box.z;
+	for(int p=lane; p<nPoints; p+=lanesPerBlob) {
+		uint4 gridPos = convert_uint4(lo) + calcGridPos(p, convert_uint4(box));
+		float4 pos;
+		pos.x = startPoint.x + gridPos.x * voxelSize.x;
+		pos.y = startPoint.y + gridPos.y * voxelSize.y;
+		pos.z = startPoint.z + gridPos.z * voxelSize.z;
+		pos.w = 1.0f;
 		
-		norm += tmpNorm;
+		float4 value;
+		value.w = singleBlobVal(blob, pos, falloff);
+		if(format == GRID_FORMAT_GRADIENT) {
+			value.x = singleBlobVal(blob, pos + (float4)(EPSILON, 0.0f, 0.0f, 0.0f), falloff);
+			value.y = singleBlobVal(blob, pos + (float4)(0.0f, EPSILON, 0.0f, 0.0f), falloff);
+			value.z = singleBlobVal(blob, pos + (float4)(0.0f, 0.0f, EPSILON, 0.0f), falloff);
+			if(all(value == (float4) (0.0f))) {
+				continue;
+			}
+		} else if(value.w == 0.0f) {
+			continue;
+		}
+		atomicAddValue(values, latticeIndex(gridPos, convert_uint4(dataGridSize), layout),
+		               format, value);
 	}
-	if(tid < nPoints) {
-		values[tid] += (float4) (norm.x, norm.y, norm.z, val);
+}
+
+/**
+  Variant of blobValue for grids made of tiles stored one after another (see
+  SparseGrid). tiles keeps position of each tile in tile units, each tile
+  stores (tileSize+1)^3 lattice points.
+  */
+__kernel void
+blobValueTiled(
+	float4 startPoint,
+	uint4 tileSize,
+	float4 voxelSize,
+	__global const uint4* tiles,
+	__global const float4* blobs,
+	int nBlobs,
+	__local float4* blobTile,
+	uint falloff,
+	__global void* values,
+	uint format,
+	int nPoints
+	)
+{
+	uint tid = get_global_id(0);
+	bool active = tid < nPoints;
+	if(!active) {
+		tid = 0;
 	}
+	uint4 dataTileSize = tileSize + (uint4)(1,1,1,0);
+	uint pointsPerTile = dataTileSize.x * dataTileSize.y * dataTileSize.z;
+	uint tile = tid / pointsPerTile;
+	uint4 gridPos = tiles[tile] * tileSize +
+	                calcGridPos(tid - tile * pointsPerTile, dataTileSize);
+	float4 pos;
+	pos.x = startPoint.x + gridPos.x * voxelSize.x;
+	pos.y = startPoint.y + gridPos.y * voxelSize.y;
+	pos.z = startPoint.z + gridPos.z * voxelSize.z;
+	pos.w = 1.0f;
+	
+	float4 value = blobSample(pos, blobs, nBlobs, blobTile, falloff, format);
+	if(active) {
+		addValue(values, tid, format, value);
+	}
+}
+
+/**
+  Coarse pass for SparseGrid. For every tile of the tile grid it adds to
+  bounds conservative lower (x) and upper (y) bound of density function
+  within the tile's box. Bounds come from the farthest and the nearest point
+  of the box to each blob. Tiles whose bounds don't enclose iso value can't
+  contain the surface. With compact support falloff blobs farther than R
+  from the box add nothing, so bounds of tiles away from all blobs are
+  exactly 0.
+  */
+__kernel void
+classifyTiles(
+	float4 startPoint,
+	uint4 tileGridSize,
+	float4 tileExtent,
+	__global const float4* blobs,
+	int nBlobs,
+	__local float4* blobTile,
+	uint falloff,
+	__global float2* bounds,
+	int nTiles
+	)
+{
+	uint tid = get_global_id(0);
+	bool active = tid < nTiles;
+	uint4 tilePos = calcGridPos(active ? tid : 0, tileGridSize);
+	float4 boxMin = startPoint + convert_float4(tilePos) * tileExtent;
+	float4 boxMax = boxMin + tileExtent;
+	
+	float2 b = (float2) (0.0f, 0.0f);
+	int groupSize = localLinearSize();
+	for(int first=0; first<nBlobs; first+=groupSize) {
+		int count = min(nBlobs - first, groupSize);
+		loadBlobTile(blobs, first, count, blobTile);
+		for(int i=0; i<count; i++) {
+			float4 blob = blobTile[i];
+			float4 c = (float4) (blob.xyz, 0.0f);
+			
+			float4 nearest = clamp(c, boxMin, boxMax) - c;
+			float4 farthest = fmax(fabs(c - boxMin), fabs(c - boxMax));
+			nearest.w = 0.0f;
+			farthest.w = 0.0f;
+			
+			b.x += falloffValue(blob.w * dot(farthest, farthest), falloff);
+			b.y += falloffValue(blob.w * dot(nearest, nearest), falloff);
+		}
+	}
+	if(active) {
+		bounds[tid] += b;
+	}
+}
+
+/**
+  Returns position of lattice point (u, v) of the grid face perpendicular to
+  axis and located at w along it. u and v run along next axes in cyclic
+  order.
+  */
+uint4
+faceGridPos(uint axis, uint w, uint u, uint v)
+{
+	switch(axis) {
+	case 0:
+		return (uint4) (w, u, v, 0);
+	case 1:
+		return (uint4) (v, w, u, 0);
+	default:
+		return (uint4) (u, v, w, 0);
+	}
+}
+
+/**
+  Replaces density on a face of the grid with bilinear interpolation of
+  every ratio-th lattice point of the face, i.e. with values the neighbouring
+  block, coarser ratio times, sees there. Needed to stitch blocks of
+  different resolution without cracks.
+  
+  \param axis axis perpendicular to the face (0 - x, 1 - y, 2 - z)
+  \param side 0 for the face at the start of the axis, 1 for the other one
+  \param ratio ratio of voxel sizes, must divide size of the grid along the
+  face
+  */
+__kernel void
+resampleFace(
+	__global void* values,
+	uint format,
+	uint layout,
+	uint4 gridSize,
+	uint axis,
+	uint side,
+	uint ratio,
+	int nPoints
+	)
+{
+	uint tid = get_global_id(0);
+	if(tid >= nPoints) {
+		return;
+	}
+	uint4 dataGridSize = gridSize + (uint4)(1,1,1,0);
+	uint sizes[3] = {gridSize.x, gridSize.y, gridSize.z};
+	uint uSize = sizes[(axis + 1) % 3];
+	uint w = side ? sizes[axis] : 0;
+	uint u = tid % (uSize + 1);
+	uint v = tid / (uSize + 1);
+	if(u % ratio == 0 && v % ratio == 0) {
+		//point shared with coarser lattice, nothing to do
+		return;
+	}
+	uint u0 = u - u % ratio;
+	uint v0 = v - v % ratio;
+	uint u1 = u0 + (u % ratio ? ratio : 0);
+	uint v1 = v0 + (v % ratio ? ratio : 0);
+	float fu = (float) (u - u0) / ratio;
+	float fv = (float) (v - v0) / ratio;
+	
+	float d00 = loadDensity(values, latticeIndex(faceGridPos(axis, w, u0, v0), dataGridSize, layout), format);
+	float d10 = loadDensity(values, latticeIndex(faceGridPos(axis, w, u1, v0), dataGridSize, layout), format);
+	float d01 = loadDensity(values, latticeIndex(faceGridPos(axis, w, u0, v1), dataGridSize, layout), format);
+	float d11 = loadDensity(values, latticeIndex(faceGridPos(axis, w, u1, v1), dataGridSize, layout), format);
+	
+	storeDensity(
+		values,
+		latticeIndex(faceGridPos(axis, w, u, v), dataGridSize, layout),
+		format,
+		mix(mix(d00, d10, fu), mix(d01, d11, fu), fv)
+	);
 }
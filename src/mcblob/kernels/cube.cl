@@ -0,0 +1,112 @@
+#ifndef __MCBLOB_CUBE_CL__
+#define __MCBLOB_CUBE_CL__
+
+#include "grid.cl"
+
+/*
+ * Helpers operating on single voxel (cube) of the grid, shared by all
+ * extraction programs. Corners and edges are numbered as in tables.h.
+ */
+
+__constant uint4 cornerOffsets[8] = {
+	(uint4)(0,0,0,0), (uint4)(1,0,0,0), (uint4)(1,1,0,0), (uint4)(0,1,0,0),
+	(uint4)(0,0,1,0), (uint4)(1,0,1,0), (uint4)(1,1,1,0), (uint4)(0,1,1,0)
+};
+
+__constant uint2 cubeEdges[12] = {
+	(uint2)(0,1), (uint2)(1,2), (uint2)(2,3), (uint2)(3,0),
+	(uint2)(4,5), (uint2)(5,6), (uint2)(6,7), (uint2)(7,4),
+	(uint2)(0,4), (uint2)(1,5), (uint2)(2,6), (uint2)(3,7)
+};
+
+sampler_t tableSampler = CLK_NORMALIZED_COORDS_FALSE | CLK_ADDRESS_CLAMP_TO_EDGE | CLK_FILTER_NEAREST;
+
+void getCubeValues(
+	uint4 voxelPos,
+	__global const void *gridValues,
+	uint format,
+	uint layout,
+	uint4 dataGridSize,
+	float *values)
+{
+	int vertexIndex;
+	vertexIndex = latticeIndex(voxelPos, dataGridSize, layout);
+	values[0] = loadDensity(gridValues, vertexIndex, format);
+
+	vertexIndex = (latticeIndex(voxelPos + (uint4)(1,0,0,0), dataGridSize, layout));
+	values[1] = loadDensity(gridValues, vertexIndex, format);
+
+	vertexIndex = (latticeIndex(voxelPos + (uint4)(1,1,0,0), dataGridSize, layout));
+	values[2] = loadDensity(gridValues, vertexIndex, format);
+
+	vertexIndex = (latticeIndex(voxelPos + (uint4)(0,1,0,0), dataGridSize, layout));
+	values[3] = loadDensity(gridValues, vertexIndex, format);
+
+	vertexIndex = (latticeIndex(voxelPos + (uint4)(0,0,1,0), dataGridSize, layout));
+	values[4] = loadDensity(gridValues, vertexIndex, format);
+
+	vertexIndex = (latticeIndex(voxelPos + (uint4)(1,0,1,0), dataGridSize, layout));
+	values[5] = loadDensity(gridValues, vertexIndex, format);
+
+	vertexIndex = (latticeIndex(voxelPos + (uint4)(1,1,1,0), dataGridSize, layout));
+	values[6] = loadDensity(gridValues, vertexIndex, format);
+
+	vertexIndex = (latticeIndex(voxelPos + (uint4)(0,1,1,0), dataGridSize, layout));
+	values[7] = loadDensity(gridValues, vertexIndex, format);
+}
+
+void getCubeNormals(
+	uint4 voxelPos,
+	__global const void *gridValues,
+	uint format,
+	uint layout,
+	uint4 dataGridSize,
+	float4 voxelSize,
+	float4 *normals)
+{
+	normals[0] = calcNormal(gridValues, voxelPos, dataGridSize, voxelSize, format, layout);
+	normals[1] = calcNormal(gridValues, voxelPos + (uint4)(1,0,0,0), dataGridSize, voxelSize, format, layout);
+	normals[2] = calcNormal(gridValues, voxelPos + (uint4)(1,1,0,0), dataGridSize, voxelSize, format, layout);
+	normals[3] = calcNormal(gridValues, voxelPos + (uint4)(0,1,0,0), dataGridSize, voxelSize, format, layout);
+	normals[4] = calcNormal(gridValues, voxelPos + (uint4)(0,0,1,0), dataGridSize, voxelSize, format, layout);
+	normals[5] = calcNormal(gridValues, voxelPos + (uint4)(1,0,1,0), dataGridSize, voxelSize, format, layout);
+	normals[6] = calcNormal(gridValues, voxelPos + (uint4)(1,1,1,0), dataGridSize, voxelSize, format, layout);
+	normals[7] = calcNormal(gridValues, voxelPos + (uint4)(0,1,1,0), dataGridSize, voxelSize, format, layout);
+}
+
+int getCubeIndex(float *cubeValues, float isoValue)
+{
+	//Loop unrolled for better performance
+	int cubeIndex;
+	cubeIndex =  (cubeValues[0] < isoValue);
+	cubeIndex += (cubeValues[1] < isoValue) << 1;
+	cubeIndex += (cubeValues[2] < isoValue) << 2;
+	cubeIndex += (cubeValues[3] < isoValue) << 3;
+	cubeIndex += (cubeValues[4] < isoValue) << 4;
+	cubeIndex += (cubeValues[5] < isoValue) << 5;
+	cubeIndex += (cubeValues[6] < isoValue) << 6;
+	cubeIndex += (cubeValues[7] < isoValue) << 7;
+	return cubeIndex;
+}
+
+/**
+  Computes number of vertices that marching cubes will generate for voxel at
+  voxelPos of grid data pointed by gridValues.
+  */
+uint classifyCube(
+	uint4 voxelPos,
+	__global const void *gridValues,
+	uint format,
+	uint layout,
+	uint4 dataGridSize,
+	float isoValue,
+	__read_only image2d_t numVertsTex)
+{
+	float cubeValues[8];
+	getCubeValues(voxelPos, gridValues, format, layout, dataGridSize, cubeValues);
+
+	int cubeIndex = getCubeIndex(cubeValues, isoValue);
+	return read_imageui(numVertsTex, tableSampler, (int2)(cubeIndex, 0)).x;
+}
+
+#endif //__MCBLOB_CUBE_CL__
@@ -0,0 +1,248 @@
+#ifndef __MCBLOB_GRID_CL__
+#define __MCBLOB_GRID_CL__
+
+/*
+ * Helpers shared by all programs that operate on Grid data. Values of
+ * GRID_FORMAT_* must match Grid::Format enum on the host side.
+ */
+
+#define GRID_FORMAT_GRADIENT 0
+#define GRID_FORMAT_SCALAR   1
+#define GRID_FORMAT_HALF     2
+#define GRID_FORMAT_FIXED16  3
+
+/*
+ * Fixed point values are kept as signed 16-bit integers covering
+ * <-GRID_FIXED16_RANGE, GRID_FIXED16_RANGE>. Must match
+ * Grid::FIXED16_RANGE on the host side.
+ */
+#define GRID_FIXED16_RANGE 8.0f
+#define GRID_FIXED16_SCALE (GRID_FIXED16_RANGE / 32767.0f)
+
+/*
+ * Order in which lattice points are stored. Values must match Grid::Layout
+ * on the host side. GRID_LAYOUT_BRICKED keeps lattice in cubic bricks of
+ * GRID_BRICK_DIM^3 points (bricks and points within them in x-y-z order),
+ * so all corners of a voxel are usually in the same brick. Must match
+ * Grid::BRICK_DIM on the host side.
+ */
+#define GRID_LAYOUT_LINEAR  0
+#define GRID_LAYOUT_BRICKED 1
+
+#define GRID_BRICK_LOG_DIM 2
+#define GRID_BRICK_DIM (1 << GRID_BRICK_LOG_DIM)
+
+uint4 calcGridPos(uint i, uint4 gridSize)
+{
+	uint z = i / (gridSize.x * gridSize.y);
+	i -= z * (gridSize.x * gridSize.y);
+	uint y = i / gridSize.x;
+	i -= y * gridSize.x;
+	uint x = i;
+
+	return (uint4) (x, y, z, 0);
+}
+
+uint calcFlatPos(uint4 gridPos, uint4 gridSize)
+{
+	uint position = 0;
+	position += gridPos.z * gridSize.x * gridSize.y;
+	position += gridPos.y * gridSize.x;
+	position += gridPos.x;
+	return position;
+}
+
+/**
+  Index of lattice point gridPos in data of grid with dataGridSize lattice
+  points stored in given layout. All kernels addressing lattice data of
+  Grid must use it.
+  */
+uint latticeIndex(uint4 gridPos, uint4 dataGridSize, uint layout)
+{
+	if(layout == GRID_LAYOUT_BRICKED) {
+		uint4 bricks = (dataGridSize + (uint4) (GRID_BRICK_DIM - 1)) >> GRID_BRICK_LOG_DIM;
+		uint4 inner = gridPos & (uint4) (GRID_BRICK_DIM - 1);
+		uint brick = calcFlatPos(gridPos >> GRID_BRICK_LOG_DIM, bricks);
+		return (brick << (3 * GRID_BRICK_LOG_DIM)) +
+		       (((inner.z << GRID_BRICK_LOG_DIM) + inner.y) << GRID_BRICK_LOG_DIM) +
+		       inner.x;
+	}
+	return calcFlatPos(gridPos, dataGridSize);
+}
+
+/**
+  Size in bytes of single lattice point stored in given format.
+  */
+uint gridElementSize(uint format)
+{
+	switch(format) {
+	case GRID_FORMAT_GRADIENT:
+		return sizeof(float4);
+	case GRID_FORMAT_HALF:
+	case GRID_FORMAT_FIXED16:
+		return sizeof(short);
+	case GRID_FORMAT_SCALAR:
+	default:
+		return sizeof(float);
+	}
+}
+
+/**
+  Returns pointer to i-th lattice point of grid values. Used to address
+  separately stored parts (tiles) of one buffer.
+  */
+__global const void* gridOffset(__global const void *values, uint format, uint i)
+{
+	return (__global const uchar*) values + i * gridElementSize(format);
+}
+
+/**
+  Reads density function value of i-th lattice point regardless of the format
+  in which the grid is stored.
+  */
+float loadDensity(__global const void *values, uint i, uint format)
+{
+	switch(format) {
+	case GRID_FORMAT_GRADIENT:
+		return ((__global const float4*) values)[i].w;
+	case GRID_FORMAT_HALF:
+		return vload_half(i, (__global const half*) values);
+	case GRID_FORMAT_FIXED16:
+		return ((__global const short*) values)[i] * GRID_FIXED16_SCALE;
+	case GRID_FORMAT_SCALAR:
+	default:
+		return ((__global const float*) values)[i];
+	}
+}
+
+/**
+  Adds density (and, for GRID_FORMAT_GRADIENT, shifted samples kept in xyz)
+  to the i-th lattice point.
+  */
+void addValue(__global void *values, uint i, uint format, float4 value)
+{
+	switch(format) {
+	case GRID_FORMAT_GRADIENT:
+		((__global float4*) values)[i] += value;
+		break;
+	case GRID_FORMAT_HALF:
+		vstore_half(
+			vload_half(i, (__global const half*) values) + value.w,
+			i,
+			(__global half*) values
+		);
+		break;
+	case GRID_FORMAT_FIXED16:
+		((__global short*) values)[i] = convert_short_sat_rte(
+			(loadDensity(values, i, format) + value.w) / GRID_FIXED16_SCALE
+		);
+		break;
+	case GRID_FORMAT_SCALAR:
+	default:
+		((__global float*) values)[i] += value.w;
+	}
+}
+
+/**
+  Atomically adds v to *p. There are no float atomics in OpenCL 1.1, so the
+  sum is retried with compare-and-swap of its bits until no other work item
+  changed *p in between.
+  */
+void atomicAddFloat(volatile __global float *p, float v)
+{
+	union { uint u; float f; } old, sum;
+	do {
+		old.f = *p;
+		sum.f = old.f + v;
+	} while(atomic_cmpxchg((volatile __global uint*) p, old.u, sum.u) != old.u);
+}
+
+/**
+  Variant of addValue that may be called by many work items for the same
+  lattice point. Supports only GRID_FORMAT_GRADIENT and GRID_FORMAT_SCALAR,
+  16-bit formats can't be updated atomically.
+  */
+void atomicAddValue(__global void *values, uint i, uint format, float4 value)
+{
+	volatile __global float* p;
+	switch(format) {
+	case GRID_FORMAT_GRADIENT:
+		p = (volatile __global float*) ((__global float4*) values + i);
+		atomicAddFloat(p, value.x);
+		atomicAddFloat(p + 1, value.y);
+		atomicAddFloat(p + 2, value.z);
+		atomicAddFloat(p + 3, value.w);
+		break;
+	case GRID_FORMAT_SCALAR:
+	default:
+		atomicAddFloat((volatile __global float*) values + i, value.w);
+	}
+}
+
+/**
+  Sets density of the i-th lattice point to value. For GRID_FORMAT_GRADIENT
+  shifted samples are moved by the same amount, so the gradient is kept.
+  */
+void storeDensity(__global void *values, uint i, uint format, float value)
+{
+	float4 v;
+	switch(format) {
+	case GRID_FORMAT_GRADIENT:
+		v = ((__global float4*) values)[i];
+		((__global float4*) values)[i] = v + (float4) (value - v.w);
+		break;
+	case GRID_FORMAT_HALF:
+		vstore_half(value, i, (__global half*) values);
+		break;
+	case GRID_FORMAT_FIXED16:
+		((__global short*) values)[i] = convert_short_sat_rte(value / GRID_FIXED16_SCALE);
+		break;
+	case GRID_FORMAT_SCALAR:
+	default:
+		((__global float*) values)[i] = value;
+	}
+}
+
+/**
+  Calculates normal vector of the surface at lattice point gridPos.
+
+  For GRID_FORMAT_GRADIENT samples stored in xyz are used. For scalar grid,
+  gradient is approximated with central differences of neighbouring
+  samples, falling back to one-sided differences on the grid boundary.
+  The result is not normalized.
+  */
+float4 calcNormal(
+	__global const void *values,
+	uint4 gridPos,
+	uint4 dataGridSize,
+	float4 voxelSize,
+	uint format,
+	uint layout)
+{
+	if(format == GRID_FORMAT_GRADIENT) {
+		float4 v = ((__global const float4*) values)[latticeIndex(gridPos, dataGridSize, layout)];
+		return -1.0f * (float4) (v.x - v.w, v.y - v.w, v.z - v.w, 0.0f);
+	}
+
+	uint4 lo = (uint4) (
+		gridPos.x > 0 ? gridPos.x - 1 : 0,
+		gridPos.y > 0 ? gridPos.y - 1 : 0,
+		gridPos.z > 0 ? gridPos.z - 1 : 0,
+		0);
+	uint4 hi = min(gridPos + (uint4)(1,1,1,0), dataGridSize - (uint4)(1,1,1,0));
+
+	float4 grad;
+	grad.x = loadDensity(values, latticeIndex((uint4)(hi.x, gridPos.y, gridPos.z, 0), dataGridSize, layout), format) -
+	         loadDensity(values, latticeIndex((uint4)(lo.x, gridPos.y, gridPos.z, 0), dataGridSize, layout), format);
+	grad.y = loadDensity(values, latticeIndex((uint4)(gridPos.x, hi.y, gridPos.z, 0), dataGridSize, layout), format) -
+	         loadDensity(values, latticeIndex((uint4)(gridPos.x, lo.y, gridPos.z, 0), dataGridSize, layout), format);
+	grad.z = loadDensity(values, latticeIndex((uint4)(gridPos.x, gridPos.y, hi.z, 0), dataGridSize, layout), format) -
+	         loadDensity(values, latticeIndex((uint4)(gridPos.x, gridPos.y, lo.z, 0), dataGridSize, layout), format);
+	grad.w = 0.0f;
+
+	float4 step = convert_float4(hi - lo) * voxelSize;
+	step.w = 1.0f;
+	return -1.0f * grad / step;
+}
+
+#endif //__MCBLOB_GRID_CL__
@@ -0,0 +1,186 @@
+#include "cube.cl"
+
+/*
+ * Histogram pyramid marching cubes. Level 0 of the pyramid keeps number of
+ * vertices generated by each voxel of a grid padded to power of two size
+ * along each axis, each next level keeps sums of 2x2x2 cells of the
+ * previous one, up to the single cell with the total. Axes which are
+ * already 1 cell long are not halved, so cells sum 2x2x1 or fewer children
+ * then. All levels are stored one after another in a single buffer,
+ * starting with level 0.
+ *
+ * Every output vertex is then generated by a separate work-item, which finds
+ * its voxel by descending the pyramid, so neither compaction of the voxels
+ * nor scans of per voxel counts are needed.
+ */
+
+/**
+  \return number of cells of given level along each axis
+  */
+uint4 levelSize(uint level, uint4 baseSize)
+{
+	return max(baseSize >> level, (uint4) (1,1,1,0));
+}
+
+/**
+  \return index of the first cell of given level in the pyramid buffer
+  */
+uint levelOffset(uint level, uint4 baseSize)
+{
+	uint offset = 0;
+	for(uint l=0; l<level; l++) {
+		uint4 size = levelSize(l, baseSize);
+		offset += size.x * size.y * size.z;
+	}
+	return offset;
+}
+
+/**
+  Fills level 0 of the pyramid. Cells outside of the grid (padding up to
+  baseSize) are set to 0.
+  */
+__kernel
+void hpClassify(
+	__global const void *gridValues,
+	uint format,
+	uint layout,
+	__global uint *pyramid,
+	uint4 gridSize,
+	float isoValue,
+	uint4 baseSize,
+	__read_only image2d_t numVertsTex)
+{
+	uint i = get_global_id(0);
+	if(i >= baseSize.x * baseSize.y * baseSize.z) {
+		return;
+	}
+	uint4 voxelPos = calcGridPos(i, baseSize);
+
+	uint numVerts = 0;
+	if(voxelPos.x < gridSize.x &&
+	   voxelPos.y < gridSize.y &&
+	   voxelPos.z < gridSize.z) {
+		numVerts = classifyCube(voxelPos, gridValues, format, layout,
+		                        gridSize + (uint4) (1,1,1,0),
+		                        isoValue, numVertsTex);
+	}
+	pyramid[i] = numVerts;
+}
+
+/**
+  \return position of the first child of cell p of a level of given size,
+  which is at most twice smaller than childSize along each axis
+  */
+uint4 firstChild(uint4 p, uint4 parentSize, uint4 childSize)
+{
+	return p * (uint4) (
+		childSize.x > parentSize.x ? 2 : 1,
+		childSize.y > parentSize.y ? 2 : 1,
+		childSize.z > parentSize.z ? 2 : 1,
+		0
+	);
+}
+
+/**
+  Builds one level of the pyramid from the previous one, twice larger along
+  axes not yet reduced to a single cell.
+  */
+__kernel
+void hpReduce(
+	__global uint *pyramid,
+	uint childOffset,
+	uint parentOffset,
+	uint4 childSize,
+	uint4 parentSize)
+{
+	uint i = get_global_id(0);
+	if(i >= parentSize.x * parentSize.y * parentSize.z) {
+		return;
+	}
+	uint4 p = firstChild(calcGridPos(i, parentSize), parentSize, childSize);
+
+	uint sum = 0;
+	for(int c=0; c<8; c++) {
+		uint4 child = p + cornerOffsets[c];
+		if(child.x < childSize.x && child.y < childSize.y && child.z < childSize.z) {
+			sum += pyramid[childOffset + calcFlatPos(child, childSize)];
+		}
+	}
+	pyramid[parentOffset + i] = sum;
+}
+
+/**
+  Generates i-th vertex of the mesh. Children of each cell are visited in
+  the order of cornerOffsets, so vertices of every voxel (and thus every
+  triangle) are kept together and in the order of the triangle table.
+  */
+__kernel
+void hpTraverse(
+	__global float4 *pos,
+	__global float4 *norm,
+	__global const void *gridValues,
+	uint format,
+	uint layout,
+	__global const uint *pyramid,
+	uint levels,
+	uint4 baseSize,
+	uint4 gridSize,
+	float4 voxelSize,
+	float4 startPoint,
+	float isoValue,
+	uint totalVerts,
+	__read_only image2d_t triTex)
+{
+	uint i = get_global_id(0);
+	if(i >= totalVerts) {
+		return;
+	}
+
+	//k is index of the vertex within currently visited cell
+	uint k = i;
+	uint4 p = (uint4) (0,0,0,0);
+	//Levels are stored from the base up, so offset of each level is the
+	//one of the level above minus its own size
+	uint offset = levelOffset(levels - 1, baseSize);
+	for(int level = levels - 2; level >= 0; level--) {
+		uint4 size = levelSize(level, baseSize);
+		offset -= size.x * size.y * size.z;
+		p = firstChild(p, levelSize(level + 1, baseSize), size);
+		for(int c=0; c<8; c++) {
+			uint4 child = p + cornerOffsets[c];
+			if(child.x >= size.x || child.y >= size.y || child.z >= size.z) {
+				continue;
+			}
+			uint count = pyramid[offset + calcFlatPos(child, size)];
+			if(k < count) {
+				p = child;
+				break;
+			}
+			k -= count;
+		}
+	}
+
+	uint4 dataGridSize = gridSize + (uint4) (1,1,1,0);
+	float cubeValues[8];
+	getCubeValues(p, gridValues, format, layout, dataGridSize, cubeValues);
+	int cubeIndex = getCubeIndex(cubeValues, isoValue);
+	uint edge = read_imageui(triTex, tableSampler, (int2)(k, cubeIndex)).x;
+
+	uint2 corners = cubeEdges[edge];
+	uint4 p1 = p + cornerOffsets[corners.x];
+	uint4 p2 = p + cornerOffsets[corners.y];
+	float f1 = cubeValues[corners.x];
+	float f2 = cubeValues[corners.y];
+	float4 n1 = calcNormal(gridValues, p1, dataGridSize, voxelSize, format, layout);
+	float4 n2 = calcNormal(gridValues, p2, dataGridSize, voxelSize, format, layout);
+
+	float t = (isoValue - f1) / (f2 - f1);
+	float4 v = mix(convert_float4(p1), convert_float4(p2), t);
+	pos[i] = (float4) (
+		startPoint.x + v.x * voxelSize.x,
+		startPoint.y + v.y * voxelSize.y,
+		startPoint.z + v.z * voxelSize.z,
+		1.0f
+	);
+	norm[i] = normalize(mix(n1, n2, t));
+}
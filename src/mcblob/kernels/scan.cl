@@ -177,3 +177,54 @@ void uniformUpdate(
     data4 += (uint4)buf[0];
     d_Data[get_global_id(0)] = data4;
 }
+
+////////////////////////////////////////////////////////////////////////////////
+// Kernels for arrays of arbitrary length
+////////////////////////////////////////////////////////////////////////////////
+
+//Exclusive scan of chunks of (4 * WORKGROUP_SIZE) elements. Elements beyond N
+//are treated as zeros. Total of each chunk is written to d_Sums
+__kernel __attribute__((reqd_work_group_size(WORKGROUP_SIZE, 1, 1)))
+void scanExclusiveChunks(
+    __global uint *d_Dst,
+    __global uint *d_Src,
+    __global uint *d_Sums,
+    __local uint *l_Data,
+    uint N
+){
+    uint pos = 4 * get_global_id(0);
+
+    uint4 idata4;
+    idata4.x = (pos + 0 < N) ? d_Src[pos + 0] : 0;
+    idata4.y = (pos + 1 < N) ? d_Src[pos + 1] : 0;
+    idata4.z = (pos + 2 < N) ? d_Src[pos + 2] : 0;
+    idata4.w = (pos + 3 < N) ? d_Src[pos + 3] : 0;
+
+    uint4 odata4 = scan4Exclusive(idata4, l_Data, 4 * WORKGROUP_SIZE);
+
+    if(pos + 0 < N) d_Dst[pos + 0] = odata4.x;
+    if(pos + 1 < N) d_Dst[pos + 1] = odata4.y;
+    if(pos + 2 < N) d_Dst[pos + 2] = odata4.z;
+    if(pos + 3 < N) d_Dst[pos + 3] = odata4.w;
+
+    if(get_local_id(0) == WORKGROUP_SIZE - 1)
+        d_Sums[get_group_id(0)] = odata4.w + idata4.w;
+}
+
+//Adds scanned chunk totals to first N elements of d_Data
+__kernel __attribute__((reqd_work_group_size(WORKGROUP_SIZE, 1, 1)))
+void uniformUpdateBounded(
+    __global uint *d_Data,
+    __global uint *d_Buf,
+    uint N
+){
+    __local uint buf[1];
+
+    if(get_local_id(0) == 0)
+        buf[0] = d_Buf[get_group_id(0)];
+
+    barrier(CLK_LOCAL_MEM_FENCE);
+    uint pos = 4 * get_global_id(0);
+    for(uint i = pos; i < pos + 4 && i < N; i++)
+        d_Data[i] += buf[0];
+}
@@ -0,0 +1,290 @@
+#include "cube.cl"
+
+/*
+ * Surface nets place one vertex inside every voxel crossed by the surface and
+ * connect vertices of four voxels sharing each lattice edge crossed by the
+ * surface with a quad. Corners and edges of voxels are numbered as in
+ * cube.cl.
+ */
+
+/** Relative weight of the mass point in dual contouring error function */
+#define DC_MASS_POINT_WEIGHT 0.05f
+
+/**
+  Marks voxels crossed by the surface, i.e. having corners on both sides of
+  isoValue.
+  */
+__kernel
+void classifyCells(
+	__global const void *gridValues,
+	uint format,
+	uint layout,
+	__global uint *cellActive,
+	uint4 gridSize,
+	float isoValue,
+	uint numCells)
+{
+	uint i = get_global_id(0);
+	if(i >= numCells) {
+		return;
+	}
+	uint4 dataGridSize = gridSize + (uint4)(1,1,1,0);
+	uint4 gridPos = calcGridPos(i, gridSize);
+
+	uint inside = 0;
+	for(int c=0; c<8; c++) {
+		float v = loadDensity(
+			gridValues,
+			latticeIndex(gridPos + cornerOffsets[c], dataGridSize, layout),
+			format
+		);
+		inside += (v >= isoValue);
+	}
+	cellActive[i] = (inside != 0 && inside != 8);
+}
+
+/**
+  Solves symmetric 3x3 system ata * x = atb.
+  \param ata matrix stored as (xx, xy, xz, yy, yz, zz)
+  \return solution or fallback if the system is singular
+  */
+float4 solveSymmetric3(float *ata, float4 atb, float4 fallback)
+{
+	float a = ata[0], b = ata[1], c = ata[2];
+	float d = ata[3], e = ata[4], f = ata[5];
+
+	float c00 = d*f - e*e;
+	float c01 = c*e - b*f;
+	float c02 = b*e - c*d;
+	float det = a*c00 + b*c01 + c*c02;
+	if(fabs(det) < 1e-12f) {
+		return fallback;
+	}
+	float c11 = a*f - c*c;
+	float c12 = b*c - a*e;
+	float c22 = a*d - b*b;
+
+	return (float4) (
+		c00*atb.x + c01*atb.y + c02*atb.z,
+		c01*atb.x + c11*atb.y + c12*atb.z,
+		c02*atb.x + c12*atb.y + c22*atb.z,
+		0.0f
+	) / det;
+}
+
+/**
+  Computes vertex of every active voxel. Vertex is written at position given
+  by exclusive scan of cellActive.
+
+  Naive surface nets put the vertex in the mass point of intersections of
+  the surface with voxel edges. With dualContouring set, vertex minimizes
+  squared distances to planes tangent to the surface at these
+  intersections (regularized towards the mass point), which keeps sharp
+  features.
+  */
+__kernel
+void generateVertices(
+	__global float4 *pos,
+	__global float4 *norm,
+	__global const void *gridValues,
+	uint format,
+	uint layout,
+	__global const uint *cellActive,
+	__global const uint *cellScan,
+	uint4 gridSize,
+	float4 voxelSize,
+	float4 startPoint,
+	float isoValue,
+	uint dualContouring,
+	uint numCells)
+{
+	uint i = get_global_id(0);
+	if(i >= numCells || !cellActive[i]) {
+		return;
+	}
+	uint4 dataGridSize = gridSize + (uint4)(1,1,1,0);
+	uint4 gridPos = calcGridPos(i, gridSize);
+
+	float values[8];
+	float4 normals[8];
+	for(int c=0; c<8; c++) {
+		uint4 p = gridPos + cornerOffsets[c];
+		values[c] = loadDensity(gridValues, latticeIndex(p, dataGridSize, layout), format);
+		normals[c] = calcNormal(gridValues, p, dataGridSize, voxelSize, format, layout);
+	}
+
+	//Computed in voxel units, relative to voxel's lowest corner
+	float4 massPoint = (float4) (0.0f);
+	float4 normal = (float4) (0.0f);
+	float ata[6] = {0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f};
+	float4 atb = (float4) (0.0f);
+	float crossings = 0.0f;
+	for(int e=0; e<12; e++) {
+		uint2 edge = cubeEdges[e];
+		float f0 = values[edge.x];
+		float f1 = values[edge.y];
+		if((f0 >= isoValue) == (f1 >= isoValue)) {
+			continue;
+		}
+		float t = (isoValue - f0) / (f1 - f0);
+		float4 p = mix(
+			convert_float4(cornerOffsets[edge.x]),
+			convert_float4(cornerOffsets[edge.y]),
+			t
+		);
+		float4 n = mix(normals[edge.x], normals[edge.y], t);
+		normal += n;
+		massPoint += p;
+		crossings += 1.0f;
+
+		if(dualContouring) {
+			n = n * voxelSize;
+			n.w = 0.0f;
+			n = normalize(n);
+			float d = dot(n, p);
+			ata[0] += n.x*n.x; ata[1] += n.x*n.y; ata[2] += n.x*n.z;
+			ata[3] += n.y*n.y; ata[4] += n.y*n.z; ata[5] += n.z*n.z;
+			atb += n * d;
+		}
+	}
+	massPoint /= crossings;
+
+	float4 v = massPoint;
+	if(dualContouring) {
+		ata[0] += DC_MASS_POINT_WEIGHT;
+		ata[3] += DC_MASS_POINT_WEIGHT;
+		ata[5] += DC_MASS_POINT_WEIGHT;
+		atb += DC_MASS_POINT_WEIGHT * massPoint;
+		v = clamp(solveSymmetric3(ata, atb, massPoint), 0.0f, 1.0f);
+	}
+
+	uint index = cellScan[i];
+	pos[index] = (float4) (
+		startPoint.x + (gridPos.x + v.x) * voxelSize.x,
+		startPoint.y + (gridPos.y + v.y) * voxelSize.y,
+		startPoint.z + (gridPos.z + v.z) * voxelSize.z,
+		1.0f
+	);
+	normal.w = 0.0f;
+	norm[index] = normalize(normal);
+}
+
+/**
+  Checks whether the lattice edge starting at lattice point p and going along
+  axis is crossed by the surface and all four voxels sharing it are in the
+  grid. Edges starting in the first apron lattice layers along axis are
+  skipped, they belong to the previous block.
+  \return 0 if no quad should be generated, 1 if the surface normal points
+  along axis, -1 if it points in opposite direction
+  */
+int edgeCrossing(
+	__global const void *gridValues,
+	uint format,
+	uint layout,
+	uint4 gridSize,
+	uint4 p,
+	uint axis,
+	float isoValue,
+	uint apron)
+{
+	uint pc[3] = {p.x, p.y, p.z};
+	uint size[3] = {gridSize.x, gridSize.y, gridSize.z};
+	uint b = (axis + 1) % 3;
+	uint c = (axis + 2) % 3;
+	if(pc[axis] < apron || pc[axis] >= size[axis] ||
+	   pc[b] < 1 || pc[b] >= size[b] ||
+	   pc[c] < 1 || pc[c] >= size[c]) {
+		return 0;
+	}
+	uint4 dataGridSize = gridSize + (uint4)(1,1,1,0);
+	pc[axis]++;
+	uint4 q = (uint4) (pc[0], pc[1], pc[2], 0);
+
+	bool in0 = loadDensity(gridValues, latticeIndex(p, dataGridSize, layout), format) >= isoValue;
+	bool in1 = loadDensity(gridValues, latticeIndex(q, dataGridSize, layout), format) >= isoValue;
+	if(in0 == in1) {
+		return 0;
+	}
+	return in0 ? 1 : -1;
+}
+
+uint4 axisVector(uint axis)
+{
+	return (uint4) (axis == 0, axis == 1, axis == 2, 0);
+}
+
+/**
+  Counts quads generated for three edges starting at each lattice point.
+  */
+__kernel
+void countQuads(
+	__global const void *gridValues,
+	uint format,
+	uint layout,
+	__global uint *quadCount,
+	uint4 gridSize,
+	float isoValue,
+	uint apron,
+	uint numPoints)
+{
+	uint i = get_global_id(0);
+	if(i >= numPoints) {
+		return;
+	}
+	uint4 p = calcGridPos(i, gridSize + (uint4)(1,1,1,0));
+	uint count = 0;
+	for(uint axis=0; axis<3; axis++) {
+		count += edgeCrossing(gridValues, format, layout, gridSize, p, axis,
+		                      isoValue, apron) != 0;
+	}
+	quadCount[i] = count;
+}
+
+/**
+  Writes two triangles for every quad counted by countQuads. Quads are
+  written at positions given by exclusive scan of quad counts.
+  */
+__kernel
+void generateQuads(
+	__global uint *indices,
+	__global const void *gridValues,
+	uint format,
+	uint layout,
+	__global const uint *cellScan,
+	__global const uint *quadScan,
+	uint4 gridSize,
+	float isoValue,
+	uint apron,
+	uint numPoints)
+{
+	uint i = get_global_id(0);
+	if(i >= numPoints) {
+		return;
+	}
+	uint4 p = calcGridPos(i, gridSize + (uint4)(1,1,1,0));
+	uint quad = quadScan[i];
+	for(uint axis=0; axis<3; axis++) {
+		int dir = edgeCrossing(gridValues, format, layout, gridSize, p, axis,
+		                       isoValue, apron);
+		if(dir == 0) {
+			continue;
+		}
+		//Voxels around the edge, counter-clockwise looking from axis
+		uint4 eb = axisVector((axis + 1) % 3);
+		uint4 ec = axisVector((axis + 2) % 3);
+		uint v00 = cellScan[calcFlatPos(p - eb - ec, gridSize)];
+		uint v10 = cellScan[calcFlatPos(p - ec, gridSize)];
+		uint v11 = cellScan[calcFlatPos(p, gridSize)];
+		uint v01 = cellScan[calcFlatPos(p - eb, gridSize)];
+
+		__global uint *out = indices + 6 * quad;
+		if(dir > 0) {
+			out[0] = v00; out[1] = v10; out[2] = v11;
+			out[3] = v00; out[4] = v11; out[5] = v01;
+		} else {
+			out[0] = v00; out[1] = v11; out[2] = v10;
+			out[3] = v00; out[4] = v01; out[5] = v11;
+		}
+		quad++;
+	}
+}
@@ -1,4 +1,8 @@
-__kernel void memSet(float value, __global float *mem)
+/**
+  Sets every 32-bit word of mem to value. Callers pass bit pattern of the
+  value they want to store (e.g. float or two packed 16-bit values).
+  */
+__kernel void memSet(uint value, __global uint *mem)
 {
 	mem[get_global_id(0)] = value;
 }
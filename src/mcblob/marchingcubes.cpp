@@ -3,9 +3,11 @@
 
 #include "util.h"
 #include "grid.h"
+#include "sparsegrid.h"
 #include "scan.h"
 #include "marchingcubes.h"
 
+#include <algorithm>
 #include <memory>
 
 using namespace std;
@@ -15,12 +17,16 @@ static const string sPath = "kernels/marchingcubes.cl";
 
 //Kernel fucntions names
 static const char sClassifyVoxelFunc[] = "classifyVoxel";
+static const char sClassifyVoxel3DFunc[] = "classifyVoxel3D";
 static const char sCompactVoxelsFunc[] = "compactVoxels";
 static const char sGenerateTrianglesFunc[] = "generateTriangles";
+static const char sClassifyVoxelTiledFunc[] = "classifyVoxelTiled";
+static const char sGenerateTrianglesTiledFunc[] = "generateTrianglesTiled";
 
 //Constants
 static const int CLASSIFY_VOXELS_THREADS_PER_WG = 128;
 static const bool CLASSIFY_VOXELS_USE_ALL_CARDS = false;
+static const uint3 CLASSIFY_VOXELS_WORK_GROUP_SHAPE(8, 8, 4);
 
 static const int COMPACT_VOXELS_THREADS_PER_WG = 128;
 static const bool COMPACT_VOXELS_USE_ALL_CARDS = false;
@@ -34,12 +40,19 @@ static const int GENERATE_TRIANGLES_USE_ALL_CARDS = false;
 MarchingCubes::MarchingCubes(
 	const cl::Context ctx,
 	const vector<cl::CommandQueue>& queues,
-	Scan *scan) : AbstractProgram(sPath, ctx, queues), mScanOp(scan)
+	Scan *scan) : AbstractProgram(sPath, ctx, queues), mScanOp(scan),
+	mClassifyGroupSize(CLASSIFY_VOXELS_THREADS_PER_WG),
+	mCompactGroupSize(COMPACT_VOXELS_THREADS_PER_WG),
+	mGenerateGroupSize(GENERATE_TRIANGLES_THREADS_PER_WG),
+	mUnifiedMemory(hasUnifiedMemory(queues[0]))
 {
 	//initializing kernels
 	mClassifyVoxelKernel = cl::Kernel(mProgram, sClassifyVoxelFunc);
+	mClassifyVoxel3DKernel = cl::Kernel(mProgram, sClassifyVoxel3DFunc);
 	mCompactVoxelsKernel = cl::Kernel(mProgram, sCompactVoxelsFunc);
 	mGenerateTrianglesKernel = cl::Kernel(mProgram, sGenerateTrianglesFunc);
+	mClassifyVoxelTiledKernel = cl::Kernel(mProgram, sClassifyVoxelTiledFunc);
+	mGenerateTrianglesTiledKernel = cl::Kernel(mProgram, sGenerateTrianglesTiledFunc);
 	
 	//initializing textures with tables for Marching Cubes
 	cl::ImageFormat format;
@@ -60,6 +73,64 @@ MarchingCubes::MarchingCubes(
 	                             1,
 	                             0,
 	                             (void*) mcNumVertsTable);
+	
+	cl::Device dev;
+	mFirstQueue.getInfo(CL_QUEUE_DEVICE, &dev);
+	mMaxWorkGroupSize3D =
+		mClassifyVoxel3DKernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(dev);
+	mMaxWorkGroupSize = mMaxWorkGroupSize3D;
+	for(cl::Kernel* k : {&mClassifyVoxelKernel, &mCompactVoxelsKernel,
+	                     &mGenerateTrianglesKernel, &mClassifyVoxelTiledKernel,
+	                     &mGenerateTrianglesTiledKernel}) {
+		size_t kernelMax =
+			k->getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(dev);
+		mMaxWorkGroupSize = std::min(mMaxWorkGroupSize, kernelMax);
+	}
+	//generateTriangles keeps positions and normals of 12 edges per work item
+	//in local memory
+	cl_ulong localMemSize;
+	dev.getInfo(CL_DEVICE_LOCAL_MEM_SIZE, &localMemSize);
+	mMaxGenerateGroupSize = std::min<size_t>(
+		mMaxWorkGroupSize,
+		localMemSize / (2 * 12 * sizeof(cl_float4))
+	);
+	setWorkGroupShape(CLASSIFY_VOXELS_WORK_GROUP_SHAPE);
+}
+
+/**
+  Sets sizes of work groups of 1D kernels. Sizes bigger than the device
+  can run are lowered, 0 is raised to 1.
+  \param classify size of work groups classifying voxels (if 1D kernel is
+  used, see setWorkGroupShape())
+  \param compact size of work groups compacting active voxels
+  \param generate size of work groups generating triangles
+  */
+void MarchingCubes::setWorkGroupSizes(
+	unsigned int classify,
+	unsigned int compact,
+	unsigned int generate)
+{
+	mClassifyGroupSize = std::max<size_t>(1, std::min<size_t>(classify, mMaxWorkGroupSize));
+	mCompactGroupSize = std::max<size_t>(1, std::min<size_t>(compact, mMaxWorkGroupSize));
+	mGenerateGroupSize = std::max<size_t>(1, std::min<size_t>(generate, mMaxGenerateGroupSize));
+}
+
+/**
+  Sets shape of work groups used to classify voxels of dense grids, so
+  corners fetched by neighbouring work items are close to each other in the
+  grid. Shape is shrunk if the device can't run that many work items in a
+  group.
+  \param shape number of work items along x, y and z. If x is 0, voxels are
+  classified with 1D kernel instead.
+  */
+void MarchingCubes::setWorkGroupShape(const uint3& shape)
+{
+	mWorkGroupShape = shape.x == 0 ?
+		uint3(0, 0, 0) :
+		fitWorkGroupShape(
+			uint3(shape.x, std::max(shape.y, 1u), std::max(shape.z, 1u)),
+			mMaxWorkGroupSize3D
+		);
 }
 
 void MarchingCubes::launchClassifyVoxel(
@@ -72,7 +143,27 @@ void MarchingCubes::launchClassifyVoxel(
 	uint3 gridSize = grid.getGridSize();
 	unsigned int numVoxels = gridSize.x * gridSize.y * gridSize.z;
 	unsigned int i = 0;
+	if(mWorkGroupShape.x > 0) {
+		mClassifyVoxel3DKernel.setArg(i++, grid.getValuesBuffer());
+		mClassifyVoxel3DKernel.setArg(i++, grid.getFormat());
+		mClassifyVoxel3DKernel.setArg(i++, grid.getLayout());
+		mClassifyVoxel3DKernel.setArg(i++, voxelVerts);
+		mClassifyVoxel3DKernel.setArg(i++, voxelOccupied);
+		mClassifyVoxel3DKernel.setArg(i++, gridSize);
+		mClassifyVoxel3DKernel.setArg(i++, isoValue);
+		mClassifyVoxel3DKernel.setArg(i++, mNumVertsTable);
+		
+		run3DKernel(
+			mClassifyVoxel3DKernel,
+			mCommandQueues[0],
+			gridSize,
+			mWorkGroupShape
+		);
+		return;
+	}
 	mClassifyVoxelKernel.setArg(i++, grid.getValuesBuffer());
+	mClassifyVoxelKernel.setArg(i++, grid.getFormat());
+	mClassifyVoxelKernel.setArg(i++, grid.getLayout());
 	mClassifyVoxelKernel.setArg(i++, voxelVerts);
 	mClassifyVoxelKernel.setArg(i++, voxelOccupied);
 	mClassifyVoxelKernel.setArg(i++, grid.getGridSize());
@@ -86,14 +177,50 @@ void MarchingCubes::launchClassifyVoxel(
 			mClassifyVoxelKernel,
 			mCommandQueues,
 			numVoxels,
-			CLASSIFY_VOXELS_THREADS_PER_WG
+			mClassifyGroupSize
 		);
 	} else {
 		run1DKernelSingleQueue(
 			mClassifyVoxelKernel,
 			mCommandQueues[0],
 			numVoxels,
-			CLASSIFY_VOXELS_THREADS_PER_WG
+			mClassifyGroupSize
+		);
+	}
+}
+
+void MarchingCubes::launchClassifyVoxel(
+	const SparseGrid& grid,
+	cl::Buffer voxelVerts,
+	cl::Buffer voxelOccupied,
+	float isoValue
+)
+{
+	cl_uint tileDim = grid.getTileDim();
+	unsigned int numVoxels = grid.getVoxelCount();
+	unsigned int i = 0;
+	mClassifyVoxelTiledKernel.setArg(i++, grid.getValuesBuffer());
+	mClassifyVoxelTiledKernel.setArg(i++, grid.getFormat());
+	mClassifyVoxelTiledKernel.setArg(i++, voxelVerts);
+	mClassifyVoxelTiledKernel.setArg(i++, voxelOccupied);
+	mClassifyVoxelTiledKernel.setArg(i++, uint3(tileDim, tileDim, tileDim));
+	mClassifyVoxelTiledKernel.setArg(i++, isoValue);
+	mClassifyVoxelTiledKernel.setArg(i++, numVoxels);
+	mClassifyVoxelTiledKernel.setArg(i++, mNumVertsTable);
+
+	if(CLASSIFY_VOXELS_USE_ALL_CARDS) {
+		run1DKernelMultipleQueues(
+			mClassifyVoxelTiledKernel,
+			mCommandQueues,
+			numVoxels,
+			mClassifyGroupSize
+		);
+	} else {
+		run1DKernelSingleQueue(
+			mClassifyVoxelTiledKernel,
+			mCommandQueues[0],
+			numVoxels,
+			mClassifyGroupSize
 		);
 	}
 }
@@ -115,14 +242,14 @@ void MarchingCubes::launchCompactVoxels(
 			mCompactVoxelsKernel,
 			mCommandQueues,
 			numVoxels,
-			COMPACT_VOXELS_THREADS_PER_WG
+			mCompactGroupSize
 		);
 	} else {
 		run1DKernelSingleQueue(
 			mCompactVoxelsKernel,
 			mCommandQueues[0],
 			numVoxels,
-			COMPACT_VOXELS_THREADS_PER_WG
+			mCompactGroupSize
 		);
 	}
 }
@@ -141,6 +268,8 @@ void MarchingCubes::launchGenerateTriangles(
 	mGenerateTrianglesKernel.setArg(i++, pos);
 	mGenerateTrianglesKernel.setArg(i++, norm);
 	mGenerateTrianglesKernel.setArg(i++, grid.getValuesBuffer());
+	mGenerateTrianglesKernel.setArg(i++, grid.getFormat());
+	mGenerateTrianglesKernel.setArg(i++, grid.getLayout());
 	mGenerateTrianglesKernel.setArg(i++, compVoxelArray);
 	mGenerateTrianglesKernel.setArg(i++, numVertsScanned);
 	mGenerateTrianglesKernel.setArg(i++, grid.getGridSize());
@@ -151,41 +280,96 @@ void MarchingCubes::launchGenerateTriangles(
 	mGenerateTrianglesKernel.setArg(i++, maxVerts);
 	mGenerateTrianglesKernel.setArg(i++, mNumVertsTable);
 	mGenerateTrianglesKernel.setArg(i++, mTriangleTable);
+	mGenerateTrianglesKernel.setArg(i++, cl::__local(12 * mGenerateGroupSize * sizeof(cl_float4)));
+	mGenerateTrianglesKernel.setArg(i++, cl::__local(12 * mGenerateGroupSize * sizeof(cl_float4)));
 	if(GENERATE_TRIANGLES_USE_ALL_CARDS) {
 		run1DKernelMultipleQueues(
 			mGenerateTrianglesKernel,
 			mCommandQueues,
 			activeVoxels,
-			GENERATE_TRIANGLES_THREADS_PER_WG
+			mGenerateGroupSize
 		);
 	} else {
 		run1DKernelSingleQueue(
-			mCompactVoxelsKernel,
+			mGenerateTrianglesKernel,
+			mCommandQueues[0],
+			activeVoxels,
+			mGenerateGroupSize
+		);
+	}
+}
+
+void MarchingCubes::launchGenerateTriangles(
+	cl::Buffer pos,
+	cl::Buffer norm,
+	cl::Buffer compVoxelArray,
+	cl::Buffer numVertsScanned,
+	float isoValue,
+	unsigned int activeVoxels,
+	unsigned int maxVerts,
+	const SparseGrid& grid)
+{
+	cl_uint tileDim = grid.getTileDim();
+	int i=0;
+	mGenerateTrianglesTiledKernel.setArg(i++, pos);
+	mGenerateTrianglesTiledKernel.setArg(i++, norm);
+	mGenerateTrianglesTiledKernel.setArg(i++, grid.getValuesBuffer());
+	mGenerateTrianglesTiledKernel.setArg(i++, grid.getFormat());
+	mGenerateTrianglesTiledKernel.setArg(i++, grid.getTilesBuffer());
+	mGenerateTrianglesTiledKernel.setArg(i++, compVoxelArray);
+	mGenerateTrianglesTiledKernel.setArg(i++, numVertsScanned);
+	mGenerateTrianglesTiledKernel.setArg(i++, uint3(tileDim, tileDim, tileDim));
+	mGenerateTrianglesTiledKernel.setArg(i++, grid.getVoxelSize());
+	mGenerateTrianglesTiledKernel.setArg(i++, grid.getStartPos());
+	mGenerateTrianglesTiledKernel.setArg(i++, isoValue);
+	mGenerateTrianglesTiledKernel.setArg(i++, activeVoxels);
+	mGenerateTrianglesTiledKernel.setArg(i++, maxVerts);
+	mGenerateTrianglesTiledKernel.setArg(i++, mNumVertsTable);
+	mGenerateTrianglesTiledKernel.setArg(i++, mTriangleTable);
+	mGenerateTrianglesTiledKernel.setArg(i++, cl::__local(12 * mGenerateGroupSize * sizeof(cl_float4)));
+	mGenerateTrianglesTiledKernel.setArg(i++, cl::__local(12 * mGenerateGroupSize * sizeof(cl_float4)));
+	if(GENERATE_TRIANGLES_USE_ALL_CARDS) {
+		run1DKernelMultipleQueues(
+			mGenerateTrianglesTiledKernel,
+			mCommandQueues,
+			activeVoxels,
+			mGenerateGroupSize
+		);
+	} else {
+		run1DKernelSingleQueue(
+			mGenerateTrianglesTiledKernel,
 			mCommandQueues[0],
 			activeVoxels,
-			GENERATE_TRIANGLES_THREADS_PER_WG
+			mGenerateGroupSize
 		);
 	}
 }
 
 /**
-  This function computes triangle mesh from scalar field described
-  by grid. Value that will be treated as the frontier of the isosurface
-  is passed in isoValue parameter.
+  Runs all stages of the algorithm on grid which data is already on the
+  device. GridType is either Grid or SparseGrid, launch* methods are
+  overloaded for both of them.
   
-  \param grid scalar field which describes isosurface
-  \param isoValue value that will be treated as a frontier of the
-  surface
-  \return simple structure containing pointers to vector of vertices
-  (triplets of coordinates) and normals (triplets of coordinates as well)
-*/
-MCMesh MarchingCubes::compute(Grid &grid, float isoValue)
+  \param splits if not NULL, indices of voxels for which index of the first
+  generated vertex should be returned. Indices are replaced with these
+  vertex indices, so the mesh can be split into parts made of consecutive
+  voxels.
+  */
+template<class GridType>
+MCMesh MarchingCubes::extract(
+	const GridType &grid,
+	float isoValue,
+	vector<cl_uint>* splits)
 {
-	MCMesh ret = { vector<float3>(), vector<float3>()};
-	grid.copyToDevice();
-	uint3 gridSize = grid.getGridSize();
+	MCMesh ret;
 	
-	unsigned int numVoxels = gridSize.x * gridSize.y * gridSize.z;
+	unsigned int numVoxels = grid.getVoxelCount();
+	if(numVoxels == 0) {
+		if(splits) {
+			splits->assign(splits->size(), 0);
+		}
+		return ret;
+	}
 	cl::Buffer voxelVerts = cl::Buffer(
 		mContext, CL_MEM_READ_WRITE, sizeof(cl_uint) * numVoxels);
 	
@@ -199,25 +383,12 @@ MCMesh MarchingCubes::compute(Grid &grid, float isoValue)
 	mScanOp->compute(voxelOccupied, voxelOccupiedScan, numVoxels);
 	
 	//Reading total number of non-empty voxels
-	uint lastElement, lastScanElement;
-	cl::CommandQueue q = mCommandQueues[0];
-	q.enqueueReadBuffer(
-		voxelOccupied,
-		CL_TRUE,
-		(numVoxels-1) * sizeof(uint),
-		sizeof(uint),
-		&lastElement
-	);
-	q.enqueueReadBuffer(
-		voxelOccupiedScan,
-		CL_TRUE,
-		(numVoxels-2) * sizeof(uint),
-		sizeof(uint),
-		&lastScanElement
-	);
-	int activeVoxels = lastElement + lastScanElement;
+	int activeVoxels = readScanTotal(mFirstQueue, voxelOccupied, voxelOccupiedScan, numVoxels);
 	
 	if(activeVoxels == 0) {
+		if(splits) {
+			splits->assign(splits->size(), 0);
+		}
 		return ret;
 	}
 	
@@ -231,27 +402,40 @@ MCMesh MarchingCubes::compute(Grid &grid, float isoValue)
 	cl::Buffer voxelVertsScan = cl::Buffer(mContext, CL_MEM_READ_WRITE,
 		sizeof(cl_uint) * numVoxels);
 	mScanOp->compute(voxelVerts, voxelVertsScan, numVoxels);
-	q.enqueueReadBuffer(
-		voxelVerts,
-		CL_TRUE,
-		(numVoxels - 1) * sizeof(uint),
-		sizeof(uint),
-		&lastElement
-	);
-	q.enqueueReadBuffer(
-		voxelVertsScan,
-		CL_TRUE,
-		(numVoxels - 2) * sizeof(uint),
-		sizeof(uint),
-		&lastScanElement
-	);
-	int totalVerts = lastElement + lastScanElement;
+	int totalVerts = readScanTotal(mFirstQueue, voxelVerts, voxelVertsScan, numVoxels);
+	if(splits) {
+		for(cl_uint& split : *splits) {
+			cl_uint voxel = split;
+			if(voxel >= numVoxels) {
+				split = totalVerts;
+				continue;
+			}
+			mFirstQueue.enqueueReadBuffer(
+				voxelVertsScan, CL_FALSE, sizeof(cl_uint) * voxel,
+				sizeof(cl_uint), &split);
+		}
+		mFirstQueue.finish();
+	}
 	//this is not needed anymore
 	voxelVerts = cl::Buffer();
+	
+	ret.verts.resize(totalVerts);
+	ret.normals.resize(totalVerts);
+	size_t resultSize = sizeof(float3) * totalVerts;
+	
+	//On devices sharing memory with the host triangles are written straight
+	//into the page aligned mesh vectors, otherwise they are read back into
+	//them
+	cl_mem_flags resultFlags = CL_MEM_WRITE_ONLY;
+	if(mUnifiedMemory) {
+		resultFlags |= CL_MEM_USE_HOST_PTR;
+	}
 	cl::Buffer normals = cl::Buffer(
-		mContext, CL_MEM_WRITE_ONLY, sizeof(cl_float4) * totalVerts);
+		mContext, resultFlags, resultSize,
+		mUnifiedMemory ? ret.normals.data() : nullptr);
 	cl::Buffer verts = cl::Buffer(
-		mContext, CL_MEM_WRITE_ONLY, sizeof(cl_float4) * totalVerts);
+		mContext, resultFlags, resultSize,
+		mUnifiedMemory ? ret.verts.data() : nullptr);
 	
 	launchGenerateTriangles(
 		verts,
@@ -264,15 +448,82 @@ MCMesh MarchingCubes::compute(Grid &grid, float isoValue)
 		grid
 	);
 	
-	unique_ptr<float3[]> hVertices{new float3[totalVerts]};
-	unique_ptr<float3[]> hNormals{new float3[totalVerts]};
-	
-	q.enqueueReadBuffer(verts, CL_TRUE, 0, sizeof(float3) * totalVerts, hVertices.get());
-	q.enqueueReadBuffer(normals, CL_TRUE, 0, sizeof(float3) * totalVerts, hNormals.get());
-	
-	ret.verts.assign(hVertices.get(), hVertices.get() + totalVerts);
-	ret.normals.assign(hNormals.get(), hNormals.get() + totalVerts);
+	cl::CommandQueue q = mCommandQueues[0];
+	if(mUnifiedMemory) {
+		//Mapping synchronizes the vectors with the device, map and unmap
+		//don't copy page aligned memory of CL_MEM_USE_HOST_PTR buffers
+		void* mappedVerts = q.enqueueMapBuffer(
+			verts, CL_TRUE, CL_MAP_READ, 0, resultSize);
+		void* mappedNormals = q.enqueueMapBuffer(
+			normals, CL_TRUE, CL_MAP_READ, 0, resultSize);
+		q.enqueueUnmapMemObject(verts, mappedVerts);
+		q.enqueueUnmapMemObject(normals, mappedNormals);
+		q.finish();
+	} else {
+		q.enqueueReadBuffer(verts, CL_TRUE, 0, resultSize, ret.verts.data());
+		q.enqueueReadBuffer(normals, CL_TRUE, 0, resultSize, ret.normals.data());
+	}
 	
 	return ret;
 }
 
+/**
+  This function computes triangle mesh from scalar field described
+  by grid. Value that will be treated as the frontier of the isosurface
+  is passed in isoValue parameter.
+  
+  \param grid scalar field which describes isosurface
+  \param isoValue value that will be treated as a frontier of the
+  surface
+  \return simple structure containing pointers to vector of vertices
+  (triplets of coordinates) and normals (triplets of coordinates as well)
+*/
+MCMesh MarchingCubes::compute(Grid &grid, float isoValue)
+{
+	grid.copyToDevice();
+	return extract(grid, isoValue);
+}
+
+/**
+  This function computes triangle mesh from tiles of sparse grid. Voxels
+  outside of tiles set in the grid are not visited at all.
+  
+  \param grid sparse scalar field which describes isosurface
+  \param isoValue value that will be treated as a frontier of the
+  surface
+  \return the same as compute(Grid&, float)
+*/
+MCMesh MarchingCubes::compute(SparseGrid &grid, float isoValue)
+{
+	return extract(grid, isoValue);
+}
+
+/**
+  This function computes triangle meshes of all tiles of sparse grid at
+  once. All stages run once for the whole grid, so many small blocks can be
+  computed in a batch by putting each of them in a separate tile.
+  
+  \param grid sparse scalar field which describes isosurface
+  \param isoValue value that will be treated as a frontier of the
+  surface
+  \return one mesh for each tile, in the order of SparseGrid::getTiles()
+*/
+vector<MCMesh> MarchingCubes::computeTiles(SparseGrid &grid, float isoValue)
+{
+	size_t nTiles = grid.getTileCount();
+	vector<cl_uint> splits(nTiles);
+	for(size_t t=0; t<nTiles; t++) {
+		splits[t] = t * grid.getVoxelsPerTile();
+	}
+	MCMesh mesh = extract(grid, isoValue, &splits);
+	splits.push_back(mesh.verts.size());
+	
+	vector<MCMesh> ret(nTiles);
+	for(size_t t=0; t<nTiles; t++) {
+		ret[t].verts.assign(
+			mesh.verts.begin() + splits[t], mesh.verts.begin() + splits[t+1]);
+		ret[t].normals.assign(
+			mesh.normals.begin() + splits[t], mesh.normals.begin() + splits[t+1]);
+	}
+	return ret;
+}
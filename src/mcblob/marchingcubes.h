@@ -3,13 +3,23 @@
 
 #include "abstractprogram.h"
 #include "common/mathtypes.h"
+#include "util.h"
 
 class Grid;
+class SparseGrid;
 class Scan;
 
+/**
+  Triangle mesh produced by extraction engines. If indices is empty, every
+  three consecutive vertices form a triangle (triangle soup, as produced by
+  MarchingCubes), otherwise every three consecutive indices do. Vertices
+  and normals are page aligned, so devices sharing memory with the host
+  write them in place.
+  */
 typedef struct {
-	std::vector<float3> verts;
-	std::vector<float3> normals;
+	PageAlignedVector<float3> verts;
+	PageAlignedVector<float3> normals;
+	std::vector<unsigned int> indices;
 } MCMesh;
 
 class MarchingCubes : public AbstractProgram
@@ -18,8 +28,11 @@ protected:
 	
 	//kernels
 	cl::Kernel mClassifyVoxelKernel;
+	cl::Kernel mClassifyVoxel3DKernel;
 	cl::Kernel mCompactVoxelsKernel;
 	cl::Kernel mGenerateTrianglesKernel;
+	cl::Kernel mClassifyVoxelTiledKernel;
+	cl::Kernel mGenerateTrianglesTiledKernel;
 	
 	//textures with tables
 	cl::Image2D mTriangleTable;
@@ -27,6 +40,22 @@ protected:
 	
 	Scan* mScanOp;
 	
+	size_t mMaxWorkGroupSize;
+	size_t mMaxGenerateGroupSize;
+	size_t mMaxWorkGroupSize3D;
+	uint3 mWorkGroupShape;
+	unsigned int mClassifyGroupSize;
+	unsigned int mCompactGroupSize;
+	unsigned int mGenerateGroupSize;
+	bool mUnifiedMemory; /**< result buffers are created over mesh vectors */
+	
+	template<class GridType>
+	MCMesh extract(
+		const GridType& grid,
+		float isoValue,
+		std::vector<cl_uint>* splits = NULL
+	);
+	
 public:
 	void launchClassifyVoxel(
 		const Grid& grid,
@@ -35,6 +64,13 @@ public:
 		float isoValue
 	);
 	
+	void launchClassifyVoxel(
+		const SparseGrid& grid,
+		cl::Buffer voxelVerts,
+		cl::Buffer voxelOccupied,
+		float isoValue
+	);
+	
 	void launchCompactVoxels(
 		cl::Buffer compVoxelArray,
 		cl::Buffer voxelOccupied,
@@ -52,6 +88,17 @@ public:
 		unsigned int maxVerts,
 		const Grid& grid
 	);
+	
+	void launchGenerateTriangles(
+		cl::Buffer pos,
+		cl::Buffer norm,
+		cl::Buffer compVoxelArray,
+		cl::Buffer numVertsScanned, 
+		float isoValue,
+		unsigned int activeVoxels,
+		unsigned int maxVerts,
+		const SparseGrid& grid
+	);
 	MarchingCubes(
 		const cl::Context ctx,
 		const std::vector<cl::CommandQueue> &queues,
@@ -60,6 +107,23 @@ public:
 	virtual ~MarchingCubes() {}
 
 	MCMesh compute(Grid &grid, float isoValue);
+	MCMesh compute(SparseGrid &grid, float isoValue);
+	std::vector<MCMesh> computeTiles(SparseGrid &grid, float isoValue);
+	
+	const cl::Image2D& getTriangleTable() const { return mTriangleTable; }
+	const cl::Image2D& getNumVertsTable() const { return mNumVertsTable; }
+	
+	void setWorkGroupShape(const uint3& shape);
+	const uint3& getWorkGroupShape() const { return mWorkGroupShape; }
+	
+	void setWorkGroupSizes(
+		unsigned int classify,
+		unsigned int compact,
+		unsigned int generate
+	);
+	unsigned int getClassifyWorkGroupSize() const { return mClassifyGroupSize; }
+	unsigned int getCompactWorkGroupSize() const { return mCompactGroupSize; }
+	unsigned int getGenerateWorkGroupSize() const { return mGenerateGroupSize; }
 };
 
 #endif
@@ -3,16 +3,29 @@
 #include <iostream>
 #include <vector>
 #include <tuple>
+#include <algorithm>
+#include <cmath>
+#include <sstream>
 #include <avr/avr++.h>
 #include <boost/program_options.hpp>
 #include <signal.h>
+#include <unistd.h>
+#include <climits>
 
 #include "util.h"
 #include "grid.h"
+#include "sparsegrid.h"
 #include "context.h"
 #include "marchingcubes.h"
+#include "surfacenets.h"
+#include "histopyramid.h"
 #include "blob.h"
 #include "exporters.h"
+#include "meshutil.h"
+#include "decimation.h"
+#include "server.h"
+#include "pipeline.h"
+#include "tuning.h"
 
 using namespace AVR;
 using namespace std;
@@ -24,15 +37,41 @@ enum class OutputFormat {
 	OUTPUT_FORMAT_AVR
 } outputFormat = OutputFormat::OUTPUT_FORMAT_OBJ;
 
+Engine engine = Engine::MARCHING_CUBES;
+
 string outputFormatString;
+string engineString;
+string gridFormatString;
+Grid::Format gridFormat = Grid::Format::GRADIENT;
+string gridLayoutString;
+Grid::Layout gridLayout = Grid::Layout::LINEAR;
+string falloffString;
+Blob::Falloff falloff = Blob::Falloff::GAUSSIAN;
 string outputFile;
 string inputFile;
 bool debug = false;
+bool precisionReport = false;
+bool sparse = false;
+bool adaptive = false;
+unsigned int batchSize = 1;
+bool noPrepass = false;
+bool streaming = false;
+bool fit = false;
+bool separable = false;
+bool splatting = false;
+bool autotuneKernels = false;
+string deviceTypeString;
+DeviceSelection deviceSelection;
+vector<float> isoValues;
+string serveSocket;
+string connectSocket;
+DecimationParams decimation;
 
 /**
- * @brief if true, stop calculations and dump results so far
+ * @brief pipeline of the current job, cancelled on SIGUSR1 to dump results
+ * so far
  */
-bool bailout = false;
+Pipeline* runningPipeline = NULL;
 
 //Input data
 static float3 startPoint{0.0f, 0.0f, 0.0f};
@@ -40,16 +79,51 @@ static float3 blockSize{1.0f, 1.0f, 1.0f};
 static unsigned int logBlockDim{5}; //32 x 32 x 32
 static uint3 gridConf{1, 1, 1};
 
-//static float maxX = 0.0f;
-//static float minX = 0.0f;
-//static float maxY = 0.0f;
-//static float minY = 0.0f;
-//static float maxZ = 0.0f;
-//static float minZ = 0.0f;
-//
-//static float minDiam = 0.0f;
+/**
+  @brief restore default values of all options
+  
+  Needed in server mode, where options are parsed again for every job.
+ */
+void reset_options()
+{
+	outputFormat = OutputFormat::OUTPUT_FORMAT_OBJ;
+	engine = Engine::MARCHING_CUBES;
+	gridFormat = Grid::Format::GRADIENT;
+	outputFormatString.clear();
+	engineString.clear();
+	gridFormatString.clear();
+	gridLayout = Grid::Layout::LINEAR;
+	gridLayoutString.clear();
+	falloff = Blob::Falloff::GAUSSIAN;
+	falloffString.clear();
+	outputFile.clear();
+	inputFile.clear();
+	debug = false;
+	precisionReport = false;
+	sparse = false;
+	adaptive = false;
+	decimation = DecimationParams();
+	batchSize = 1;
+	noPrepass = false;
+	streaming = false;
+	fit = false;
+	separable = false;
+	splatting = false;
+	autotuneKernels = false;
+	deviceTypeString.clear();
+	deviceSelection = DeviceSelection();
+	isoValues.clear();
+	serveSocket.clear();
+	connectSocket.clear();
+}
 
-void parse_options(int argc, char** argv)
+/**
+ * @brief parse command line into option variables
+ *
+ * @param usage set to description of all options if --help was given
+ * @return false if --help was given, so nothing should be computed
+ */
+bool parse_options(int argc, char** argv, string& usage)
 {
 	po::options_description desc("Available options");
 	desc.add_options()
@@ -60,6 +134,130 @@ void parse_options(int argc, char** argv)
 	  "Format of the file to be create (avr or obj)")
 	    ("output,o", po::value<string>(&outputFile),
 	  "Name of the file to which the mesh will be saved")
+	    ("engine,e", po::value<string>(&engineString)->default_value(string("mc")),
+	  "Isosurface extraction engine:\n"
+	  "  mc - Marching cubes (triangle soup)\n"
+	  "  hpmc - Marching cubes using histogram pyramid instead of scans, "
+	  "the same output as mc with less memory\n"
+	  "  surfacenets - naive surface nets (indexed mesh, about half of "
+	  "triangles of mc)\n"
+	  "  dc - dual contouring, surface nets with vertices placed using "
+	  "surface normals, keeps sharp features")
+	    ("grid-format,g", po::value<string>(&gridFormatString)->default_value(string("gradient")),
+	  "Format of values kept in each block's grid:\n"
+	  "  gradient - density and three shifted samples for normals "
+	  "(16 bytes per lattice point)\n"
+	  "  scalar - density only, normals are computed from neighbouring "
+	  "samples (4 bytes per lattice point)\n"
+	  "  half - like scalar, but kept as half precision floats "
+	  "(2 bytes per lattice point)\n"
+	  "  fixed16 - like scalar, but kept as 16-bit fixed point numbers "
+	  "(2 bytes per lattice point)")
+	    ("layout", po::value<string>(&gridLayoutString)->default_value(string("auto")),
+	  "Order in which lattice points of each block's grid are stored:\n"
+	  "  auto - the faster one found by --autotune for the device, linear "
+	  "if the device wasn't tuned or with --sparse and --batch\n"
+	  "  linear - rows along x, then y, then z\n"
+	  "  bricked - cubes of 4x4x4 points, so corners of a voxel are close "
+	  "to each other in memory, which is faster for large blocks. Can't be "
+	  "used with --sparse and --batch")
+	    ("falloff", po::value<string>(&falloffString)->default_value(string("gaussian")),
+	  "Field function of a single blob, each is 1 at half of the blob's "
+	  "diameter d:\n"
+	  "  gaussian - exp(1 - 4x^2/d^2), never reaches 0, so every blob "
+	  "adds to density everywhere\n"
+	  "  wyvill - soft objects polynomial, 0 from distance d\n"
+	  "  murakami - scaled (1 - x^2/d^2)^2, 0 from distance d\n"
+	  "  truncated-gaussian - gaussian lowered and rescaled to reach 0 at "
+	  "distance 1.5d\n"
+	  "Blocks and tiles farther than that from all blobs are skipped "
+	  "exactly with the last three")
+	    ("separable", po::value(&separable)->zero_tokens(),
+	  "Evaluate gaussian blobs as products of exponentials along each "
+	  "axis, computed once for a box of lattice points, with analytic "
+	  "gradient. Needs far fewer exponentials per lattice point. Used "
+	  "for dense grids with gaussian falloff only")
+	    ("splat", po::value(&splatting)->zero_tokens(),
+	  "Add each blob only to lattice points within its reach instead of "
+	  "summing all blobs at every lattice point, so time follows the total "
+	  "volume of blobs rather than their number times the volume of the "
+	  "domain. Used for dense grids in gradient or scalar format with "
+	  "falloffs other than gaussian")
+	    ("sparse,s", po::value(&sparse)->zero_tokens(),
+	  "Keep each block's grid only in tiles of 8x8x8 voxels through which "
+	  "the surface may pass. Memory and time needed scale with area of "
+	  "the surface instead of volume of the domain")
+	    ("adaptive,a", po::value(&adaptive)->zero_tokens(),
+	  "Choose resolution of each block from the smallest blob intersecting "
+	  "it. Size of the block given in the input becomes the highest "
+	  "resolution. Faces shared by blocks of different resolution are "
+	  "stitched (with --sparse only meshes are stitched, grids are not "
+	  "resampled)")
+	    ("serve", po::value<string>(&serveSocket),
+	  "Run as a server accepting jobs on Unix socket with given path. "
+	  "OpenCL is initialized once, jobs are sent with --connect")
+	    ("connect", po::value<string>(&connectSocket),
+	  "Don't compute anything, send the job given by the remaining options "
+	  "to mcblob started with --serve on given socket and wait for it. Input "
+	  "read from standard input is sent along with the job")
+	    ("iso", po::value<vector<float>>(&isoValues)->multitoken(),
+	  "Values of density function on the surface, 1.0 by default. With "
+	  "several values the field is evaluated once and one output file is "
+	  "written for each of them, named after the output file with the "
+	  "iso value appended, e.g. out-iso0.8.obj")
+	    ("no-prepass", po::value(&noPrepass)->zero_tokens(),
+	  "Don't run coarse pass over the whole domain before computation. By "
+	  "default blocks (and, with --sparse, tiles) through which the surface "
+	  "certainly doesn't pass are skipped")
+	    ("batch,b", po::value(&batchSize),
+	  "Compute this many blocks at once. Grids of all blocks of a batch are "
+	  "kept in one buffer and every stage of the computation is run once "
+	  "for the whole batch, which lowers number of kernel launches for "
+	  "small blocks (mc engine only)")
+	    ("fit", po::value(&fit)->zero_tokens(),
+	  "Ignore starting point and number of blocks given in the input and "
+	  "compute only blocks around regions influenced by blobs. Blocks are "
+	  "aligned to the ones given in the input and have the same resolution, "
+	  "but may be made smaller if all blobs fit in one of them")
+	    ("stream", po::value(&streaming)->zero_tokens(),
+	  "Treat the whole domain as a single block and compute it in slabs of "
+	  "8 voxels along z, writing triangles of each slab to the output file "
+	  "as soon as it's done. Device memory needed grows with the area of "
+	  "the domain's xy cross-section instead of its volume and there are no "
+	  "seams between blocks (mc engine, obj format and gradient grid "
+	  "format only)")
+	    ("autotune", po::value(&autotuneKernels)->zero_tokens(),
+	  "Don't compute anything, time kernels on the first device with "
+	  "different work group sizes and shapes and grid layouts, and save "
+	  "the fastest ones to a tuning file named after the device in the "
+	  "working directory. Later runs in that directory load it")
+	    ("platform", po::value<string>(&deviceSelection.platform),
+	  "OpenCL platform to use, given by its index or a part of its name. "
+	  "Available platforms and devices are listed on start. The first "
+	  "platform by default. Like other device options, ignored in jobs "
+	  "sent to a server")
+	    ("device", po::value<string>(&deviceSelection.device),
+	  "OpenCL device to use, given by its index on the platform or a part "
+	  "of its name. All devices of --device-type by default")
+	    ("device-type", po::value<string>(&deviceTypeString)->default_value(string("gpu")),
+	  "Type of devices to use: gpu, cpu, accelerator or all")
+	    ("numa", po::value(&deviceSelection.numaFission)->zero_tokens(),
+	  "Split the first device, if it's a CPU, into sub-devices, one for "
+	  "each NUMA node, and evaluate blobs on all of them at once, each "
+	  "node in its own part of the grid. Other stages run on the whole "
+	  "device")
+	    ("decimate-error", po::value(&decimation.maxError),
+	  "Simplify meshes with quadric error metrics so that the surface moves "
+	  "by at most this distance. Vertices on borders of blocks are kept, so "
+	  "blocks still fit each other")
+	    ("decimate-ratio", po::value(&decimation.targetRatio),
+	  "Simplify meshes until only this fraction (0-1) of triangles of each "
+	  "block is left. May be combined with --decimate-error, decimation "
+	  "stops at whichever limit is reached first")
+	    ("precision-report", po::value(&precisionReport)->zero_tokens(),
+	  "Additionally compute each block with single precision scalar grid and "
+	  "print deviation of vertex positions of the resulting mesh from it to "
+	  "stderr")
 	    ("input,i", po::value<string>(&inputFile)->default_value(string("-")),
 	  "Input file with blob data and Marching cubes parameters\n"
 	  "If not specified, or speciefied as \"-\" will be read from standard input\n"
@@ -113,12 +311,16 @@ void parse_options(int argc, char** argv)
 	po::notify(vm);
 	
 	if(vm.count("help")) {
-		cerr << desc << "\n";
-		exit(1);
+		ostringstream description;
+		description << desc << "\n";
+		usage = description.str();
+		return false;
+	}
+	if(!serveSocket.empty() && !connectSocket.empty()) {
+		throw runtime_error("--serve and --connect are mutually exclusive");
 	}
-	if(!vm.count("output")) {
+	if(!vm.count("output") && serveSocket.empty() && !autotuneKernels) {
 		throw runtime_error("No output file specified");
-		exit(1);
 	}
 	
 	if(outputFormatString == "avr") {
@@ -127,8 +329,67 @@ void parse_options(int argc, char** argv)
 		//already set as default
 	} else {
 		throw runtime_error("Unsupported file format");
-		exit(1);
 	}
+	
+	if(engineString == "mc") {
+		//already set as default
+	} else if(engineString == "hpmc") {
+		engine = Engine::HISTOPYRAMID;
+	} else if(engineString == "surfacenets") {
+		engine = Engine::SURFACE_NETS;
+	} else if(engineString == "dc") {
+		engine = Engine::DUAL_CONTOURING;
+	} else {
+		throw runtime_error("Unsupported engine");
+	}
+	if(isoValues.empty()) {
+		isoValues.push_back(1.0f);
+	}
+	
+	if(gridFormatString == "gradient") {
+		//already set as default
+	} else if(gridFormatString == "scalar") {
+		gridFormat = Grid::Format::SCALAR;
+	} else if(gridFormatString == "half") {
+		gridFormat = Grid::Format::HALF;
+	} else if(gridFormatString == "fixed16") {
+		gridFormat = Grid::Format::FIXED16;
+	} else {
+		throw runtime_error("Unsupported grid format");
+	}
+	
+	if(falloffString == "gaussian") {
+		//already set as default
+	} else if(falloffString == "wyvill") {
+		falloff = Blob::Falloff::WYVILL;
+	} else if(falloffString == "murakami") {
+		falloff = Blob::Falloff::MURAKAMI;
+	} else if(falloffString == "truncated-gaussian") {
+		falloff = Blob::Falloff::TRUNCATED_GAUSSIAN;
+	} else {
+		throw runtime_error("Unsupported falloff");
+	}
+	
+	if(deviceTypeString == "gpu") {
+		deviceSelection.type = CL_DEVICE_TYPE_GPU;
+	} else if(deviceTypeString == "cpu") {
+		deviceSelection.type = CL_DEVICE_TYPE_CPU;
+	} else if(deviceTypeString == "accelerator") {
+		deviceSelection.type = CL_DEVICE_TYPE_ACCELERATOR;
+	} else if(deviceTypeString == "all") {
+		deviceSelection.type = CL_DEVICE_TYPE_ALL;
+	} else {
+		throw runtime_error("Unsupported device type");
+	}
+	
+	if(gridLayoutString == "linear" || gridLayoutString == "auto") {
+		//already set as default, auto is resolved in run_job
+	} else if(gridLayoutString == "bricked") {
+		gridLayout = Grid::Layout::BRICKED;
+	} else {
+		throw runtime_error("Unsupported grid layout");
+	}
+	return true;
 }
 
 tuple<unique_ptr<float4[]>, int>
@@ -158,128 +419,299 @@ read_input(istream& is)
 	return make_tuple(unique_ptr<float4[]>(blobs), nBlobs);
 }
 
-///**
-//  @brief find boundaries in which the domain should be enclosed
-//  
-//  Function iterates over all blobs and find maximal and minimal value on each
-//  axis of (center + diameter) the blob. Results are put in global variables.
-// */
-//void find_boundaries_and_smallest_blob(float4* blobs, int nBlobs)
-//{
-//	maxX = blobs[0].x + blobs[0].w;
-//	minX = blobs[0].x - blobs[0].w;
-//	
-//	maxY = blobs[0].y + blobs[0].w;
-//	minY = blobs[0].y - blobs[0].w;
-//	
-//	maxZ = blobs[0].z + blobs[0].w;
-//	minZ = blobs[0].z - blobs[0].w;
-//	
-//	minDiam = blobs[0].w;
-//	
-//	for(int i{1}; i<nBlobs; i++) {
-//		maxX = std::max(maxX, blobs[i].x + blobs[i].w);
-//		minX = std::min(minX, blobs[i].x - blobs[i].w);
-//		
-//		maxY = std::max(maxY, blobs[i].y + blobs[i].w);
-//		minY = std::min(minY, blobs[i].y - blobs[i].w);
-//		
-//		maxZ = std::max(maxZ, blobs[i].z + blobs[i].w);
-//		minZ = std::min(minZ, blobs[i].z - blobs[i].w);
-//		
-//		minDiam = std::min(minDiam, blobs[i].w);
-//	}
-//}
+/**
+  @brief name of the output file for one of several iso values
+  
+  Iso value is inserted before the extension of outputFile, e.g.
+  out.obj becomes out-iso0.8.obj.
+ */
+string iso_output_name(const string& outputFile, float isoValue)
+{
+	ostringstream suffix;
+	suffix << "-iso" << isoValue;
+	size_t dot = outputFile.find_last_of('.');
+	size_t slash = outputFile.find_last_of('/');
+	if(dot == string::npos || (slash != string::npos && dot < slash)) {
+		return outputFile + suffix.str();
+	}
+	return outputFile.substr(0, dot) + suffix.str() + outputFile.substr(dot);
+}
 
 void usr1_handler(int signal)
 {
-	bailout = true;
+	if(runningPipeline) {
+		runningPipeline->cancel();
+	}
 }
 
+/**
+  @brief makes pipeline cancellable by SIGUSR1 while the guard exists
+  
+  The pointer is cleared however the job ends, so the handler never reaches
+  a destroyed pipeline. Cancellation is reset before the pointer is set, so
+  a signal that arrives before run() starts still cancels it.
+ */
+struct RunningPipelineGuard {
+	RunningPipelineGuard(Pipeline& pipeline) {
+		pipeline.resetCancellation();
+		runningPipeline = &pipeline;
+	}
+	~RunningPipelineGuard() {
+		runningPipeline = NULL;
+	}
+};
+
 struct sigaction usr1_action = {
 	usr1_handler, 0, 0, 0, 0
 };
 
-int main(int argc, char** argv)
+/**
+  @brief compute meshes of one input and write them to output file(s)
+  
+  Options must be already parsed.
+  
+  @param ctx initialized OpenCL context, may be reused between jobs
+  @param input stream with blob data, used if input file is "-"
+ */
+void run_job(Context& ctx, istream& input)
 {
-	try {
-		parse_options(argc, argv);
-		
-		unique_ptr<float4[]> blobs;
-		int nBlobs;
-		if(inputFile == "-") {
-			tie(blobs, nBlobs) = read_input(cin);
-		} else {
-			ifstream inputStream(inputFile);
-			tie(blobs, nBlobs) = read_input(inputStream);
-		}
-		
-		//find_boundaries_and_smallest_blob(blobs.get(), nBlobs);
-		
-		Context ctx;
-		
-		sigaction(SIGUSR1, &usr1_action, NULL);
-		
-		//Main algorithm
-		
-		vector<MCMesh> meshes;
-		
-		uint3 gridDim = uint3(static_cast<uint>(1) << logBlockDim);
-		
-		float3 voxelSize{
-			blockSize.x / gridDim.x,
-			blockSize.y / gridDim.y,
-			blockSize.z / gridDim.z
-		};
+	unique_ptr<float4[]> blobs;
+	int nBlobs;
+	if(inputFile == "-") {
+		tie(blobs, nBlobs) = read_input(input);
+	} else {
+		ifstream inputStream(inputFile);
+		tie(blobs, nBlobs) = read_input(inputStream);
+	}
+	
+	PipelineConfig config;
+	config.startPoint = startPoint;
+	config.gridConf = gridConf;
+	config.blockSize = blockSize;
+	config.logBlockDim = logBlockDim;
+	config.engine = engine;
+	config.gridFormat = gridFormat;
+	config.gridLayout = gridLayout;
+	if(gridLayoutString == "auto" && !sparse && batchSize <= 1) {
+		config.gridLayout = ctx.getTuning().gridLayout;
+	}
+	config.sparse = sparse;
+	config.adaptive = adaptive;
+	config.prepass = !noPrepass;
+	config.precisionReport = precisionReport;
+	config.batchSize = batchSize;
+	config.isoValues = isoValues;
+	config.streaming = streaming;
+	config.falloff = falloff;
+	config.separable = separable;
+	config.splatting = splatting;
+	if(fit) {
+		fitDomain(config, blobs.get(), nBlobs);
 		if(debug) {
-			cerr << "Processed blocks 0/"<< gridConf.x * gridConf.y * gridConf.z;
+			cerr << "Fitted domain: start " << config.startPoint
+			     << ", blocks " << config.gridConf
+			     << ", block size " << config.blockSize
+			     << ", log2 of block dimension " << config.logBlockDim << "\n";
+		}
+	}
+	Pipeline pipeline(ctx, config);
+	
+	//Meshes of all blocks, separately for each iso value
+	unsigned int nBlocks = pipeline.getBlockCount();
+	vector<vector<MCMesh>> meshes(isoValues.size());
+	//In streaming mode slabs are written right away instead
+	vector<unique_ptr<WavefrontObjWriter>> writers;
+	bool decimate = decimation.maxError > 0.0f || decimation.targetRatio > 0.0f;
+	if(streaming) {
+		if(outputFormat != OutputFormat::OUTPUT_FORMAT_OBJ) {
+			throw runtime_error("--stream supports only obj format");
 		}
-		int generatedVertices = 0;
-		for(int i=0; i<gridConf.x; i++) {
-			for(int j=0; j<gridConf.y; j++){
-				for(int k=0; k<gridConf.z; k++){
-					float3 blockStart {
-						startPoint.x + blockSize.x * i,
-						startPoint.y + blockSize.y * j,
-						startPoint.z + blockSize.z * k,
-						1.0f
-					};
-					Grid grid{
-						gridDim,
-						voxelSize,
-						blockStart,
-						ctx.getClContext(),
-						ctx.getQueues()[0],
-						ctx.getMemsetKernel()
-					};
-					grid.clear();
-					ctx.getBlobProgram()->runBlob(blobs.get(), nBlobs, grid);
-					MarchingCubes* mc = ctx.getMcProgram();
-					meshes.push_back(mc->compute(grid, 1.0f));
-					if(debug) {
-						generatedVertices += meshes.at(meshes.size() - 1).verts.size();
-						cerr << '\r' << "Processed blocks "
-						     << i*(gridConf.z*gridConf.y) + j*gridConf.z + k
-						     << "/"
-						     << gridConf.x * gridConf.y * gridConf.z << " "
-						     << "Vertices generated " << generatedVertices;
-					}
-					if(bailout) goto after_computation;
+		nBlocks = pipeline.getSlabCount();
+		for(float isoValue : isoValues) {
+			writers.emplace_back(new WavefrontObjWriter(isoValues.size() > 1 ?
+				iso_output_name(outputFile, isoValue) : outputFile));
+		}
+	} else {
+		for(vector<MCMesh>& isoMeshes : meshes) {
+			isoMeshes.resize(nBlocks);
+		}
+	}
+	
+	if(debug) {
+		cerr << "Processed blocks 0/"<< nBlocks;
+	}
+	unsigned int processedBlocks = 0;
+	int generatedVertices = 0;
+	RunningPipelineGuard guard(pipeline);
+	pipeline.run(blobs.get(), nBlobs, [&](BlockResult& result) {
+		for(size_t n=0; n<result.meshes.size(); n++) {
+			generatedVertices += result.meshes[n].verts.size();
+			if(streaming) {
+				if(decimate) {
+					decimateMesh(result.meshes[n], decimation);
 				}
+				writers[n]->write(result.meshes[n]);
+			} else {
+				meshes[n][result.index] = std::move(result.meshes[n]);
 			}
 		}
-after_computation:
+		processedBlocks++;
 		if(debug) {
-			cout<< "\n";
+			cerr << '\r' << "Processed blocks " << processedBlocks << "/"
+			     << nBlocks << " "
+			     << "Vertices generated " << generatedVertices;
+		}
+	});
+	if(debug) {
+		cout<< "\n";
+	}
+	if(streaming) {
+		return;
+	}
+	
+	float finestVoxelSize = pipeline.getFinestVoxelSize();
+	const MeshDeviation& deviation = pipeline.getDeviation();
+	if(precisionReport) {
+		cerr << "Vertex deviation against single precision scalar grid:\n"
+		     << "  max:  " << deviation.maxDeviation << " ("
+		     << deviation.maxDeviation / finestVoxelSize << " voxels)\n"
+		     << "  mean: " << deviation.meanDeviation() << " ("
+		     << deviation.meanDeviation() / finestVoxelSize << " voxels)\n"
+		     << "  compared vertices: " << deviation.comparedVertices << "\n"
+		     << "  vertices without counterpart: "
+		     << deviation.unmatchedVertices << "\n";
+	}
+	
+	for(size_t n=0; n<isoValues.size(); n++) {
+		if(decimate) {
+			decimateMeshes(meshes[n], decimation);
 		}
 		
+		string file = isoValues.size() > 1 ?
+			iso_output_name(outputFile, isoValues[n]) : outputFile;
 		switch(outputFormat) {
 		case OutputFormat::OUTPUT_FORMAT_AVR:
-			export_avr(meshes, outputFile);
+			export_avr(meshes[n], file);
 			break;
 		case OutputFormat::OUTPUT_FORMAT_OBJ:
 		default:
-			export_wavefront_obj(meshes, outputFile);
+			export_wavefront_obj(meshes[n], file);
+		}
+	}
+}
+
+/**
+  @brief send job described by command line to the server and wait for it
+ */
+void run_client(int argc, char** argv)
+{
+	JobRequest request;
+	char cwd[PATH_MAX];
+	if(getcwd(cwd, sizeof(cwd)) == NULL) {
+		throw runtime_error("Can't get working directory");
+	}
+	request.workingDirectory = cwd;
+	request.args.assign(argv + 1, argv + argc);
+	if(inputFile == "-") {
+		ostringstream data;
+		data << cin.rdbuf();
+		request.data = data.str();
+	}
+	submitJob(connectSocket, request);
+}
+
+/**
+  @brief path relative to directory, unless it's absolute or "-"
+ */
+static string resolve_path(const string& directory, const string& path)
+{
+	if(path.empty() || path == "-" || path[0] == '/') {
+		return path;
+	}
+	return directory + "/" + path;
+}
+
+/**
+  @brief compute jobs sent with run_client() until killed
+ */
+void run_server(Context& ctx)
+{
+	string socketPath = serveSocket;
+	bool serverDebug = debug;
+	if(serverDebug) {
+		cerr << "Listening on " << socketPath << "\n";
+	}
+	serveJobs(socketPath, [&](const JobRequest& request) {
+		vector<char*> argv;
+		string programName = "mcblob";
+		argv.push_back(&programName[0]);
+		vector<string> args = request.args;
+		for(string& arg : args) {
+			argv.push_back(&arg[0]);
+		}
+		argv.push_back(NULL);
+		
+		reset_options();
+		string usage;
+		if(!parse_options(argv.size() - 1, argv.data(), usage)) {
+			//Sent back to the client as the job's error
+			throw runtime_error(usage);
+		}
+		if(!serveSocket.empty() || !connectSocket.empty() || autotuneKernels) {
+			throw runtime_error(
+				"--serve, --connect and --autotune can't be used in jobs");
+		}
+		if(outputFile.empty()) {
+			throw runtime_error("No output file specified");
+		}
+		//Server's working directory is shared by all jobs, so paths are
+		//resolved against the client's one instead of changing it
+		inputFile = resolve_path(request.workingDirectory, inputFile);
+		outputFile = resolve_path(request.workingDirectory, outputFile);
+		istringstream input(request.data);
+		run_job(ctx, input);
+		if(serverDebug) {
+			cerr << "Job done: " << outputFile << "\n";
+		}
+	});
+}
+
+int main(int argc, char** argv)
+{
+	try {
+		string usage;
+		if(!parse_options(argc, argv, usage)) {
+			cerr << usage;
+			return 1;
+		}
+		
+		if(!connectSocket.empty()) {
+			run_client(argc, argv);
+			return 0;
+		}
+		
+		if(autotuneKernels) {
+			DeviceSelection selection = deviceSelection;
+			selection.useAllDevices = false;
+			selection.numaFission = false;
+			Context ctx{selection, true};
+			KernelTuning tuning = autotune(ctx, cerr);
+			cl::Device dev;
+			ctx.getQueues()[0].getInfo(CL_QUEUE_DEVICE, &dev);
+			string path = tuningFileName(dev);
+			saveTuning(path, tuning);
+			cerr << "Tuning saved to " << path << "\n";
+			return 0;
+		}
+		
+		Context ctx{deviceSelection};
+		
+		sigaction(SIGUSR1, &usr1_action, NULL);
+		
+		if(!serveSocket.empty()) {
+			run_server(ctx);
+		} else {
+			run_job(ctx, cin);
 		}
 		
 	} catch ( cl::Error &e ) {
@@ -0,0 +1,213 @@
+#include "config.h"
+#include "meshutil.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+typedef unordered_map<uint64_t, vector<unsigned int>> SpatialHash;
+
+/**
+  Packs integer cell coordinates into single hash key. 21 bits are used for
+  each coordinate, which is more than enough for meshes of a single block.
+  */
+uint64_t cellKey(int x, int y, int z)
+{
+	const uint64_t mask = (1 << 21) - 1;
+	return ((uint64_t) (x & mask)) |
+	       ((uint64_t) (y & mask) << 21) |
+	       ((uint64_t) (z & mask) << 42);
+}
+
+/**
+  \return coordinate of the cell of a spatial hash containing v
+  */
+int cellCoord(float v, float cellSize)
+{
+	return static_cast<int>(std::floor(v / cellSize));
+}
+
+static float distance(const float3& a, const float3& b)
+{
+	float dx = a.x - b.x;
+	float dy = a.y - b.y;
+	float dz = a.z - b.z;
+	return std::sqrt(dx*dx + dy*dy + dz*dz);
+}
+
+/**
+  Measures how far vertices of mesh are from vertices of reference mesh.
+  For each vertex of mesh the nearest vertex of reference is found and
+  the distance is added to deviation statistics. Marching cubes places
+  vertices on lattice edges, so for meshes extracted from the same field
+  stored with different precision the nearest vertex is the one generated
+  on the same edge, even if triangulation differs between the meshes.
+  
+  \param reference mesh treated as exact
+  \param mesh mesh whose deviation is measured
+  \param searchRadius vertices further than this from any reference vertex
+  are counted as unmatched. Size of a voxel is a good choice.
+  \param deviation statistics to which results are accumulated
+  */
+void measureDeviation(
+	const MCMesh& reference,
+	const MCMesh& mesh,
+	float searchRadius,
+	MeshDeviation& deviation)
+{
+	SpatialHash hash;
+	for(unsigned int i=0; i<reference.verts.size(); i++) {
+		const float3& v = reference.verts[i];
+		hash[cellKey(
+			cellCoord(v.x, searchRadius),
+			cellCoord(v.y, searchRadius),
+			cellCoord(v.z, searchRadius)
+		)].push_back(i);
+	}
+	
+	for(const float3& v : mesh.verts) {
+		int cx = cellCoord(v.x, searchRadius);
+		int cy = cellCoord(v.y, searchRadius);
+		int cz = cellCoord(v.z, searchRadius);
+		
+		float nearest = searchRadius;
+		bool found = false;
+		for(int x=cx-1; x<=cx+1; x++) {
+			for(int y=cy-1; y<=cy+1; y++) {
+				for(int z=cz-1; z<=cz+1; z++) {
+					auto it = hash.find(cellKey(x, y, z));
+					if(it == hash.end()) {
+						continue;
+					}
+					for(unsigned int idx : it->second) {
+						float d = distance(v, reference.verts[idx]);
+						if(d <= nearest) {
+							nearest = d;
+							found = true;
+						}
+					}
+				}
+			}
+		}
+		
+		if(found) {
+			deviation.maxDeviation = std::max(deviation.maxDeviation, nearest);
+			deviation.sumDeviation += nearest;
+			deviation.comparedVertices++;
+		} else {
+			deviation.unmatchedVertices++;
+		}
+	}
+}
+
+/**
+  \return point of segment ab nearest to p
+  */
+static float3 nearestOnSegment(const float3& p, const float3& a, const float3& b)
+{
+	float3 ab(b.x - a.x, b.y - a.y, b.z - a.z);
+	float len2 = ab.x*ab.x + ab.y*ab.y + ab.z*ab.z;
+	float t = 0.0f;
+	if(len2 > 0.0f) {
+		t = ((p.x - a.x)*ab.x + (p.y - a.y)*ab.y + (p.z - a.z)*ab.z) / len2;
+		t = std::max(0.0f, std::min(1.0f, t));
+	}
+	return float3(a.x + t*ab.x, a.y + t*ab.y, a.z + t*ab.z, a.w);
+}
+
+/**
+  Closes cracks between meshes of two neighbouring blocks of different
+  resolution. Boundary of coarse mesh on the shared face is a polyline made
+  of straight segments, while fine mesh follows the surface more closely
+  there. Every vertex of fine mesh lying on the face is moved onto the
+  nearest segment of that polyline.
+  
+  Works best when face of the fine grid was resampled to the coarse lattice
+  first (see Blob::resampleFace()), so both meshes cross edges of the coarse
+  lattice in the same points.
+  
+  \param fine mesh of the block with smaller voxels, modified in place
+  \param coarse mesh of the neighbouring block with bigger voxels
+  \param axis axis perpendicular to the shared face (0 - x, 1 - y, 2 - z)
+  \param planePos coordinate of the shared face along axis
+  \param coarseVoxelSize size of a voxel of coarse block
+  \return number of moved vertices
+  */
+unsigned int stitchFace(
+	MCMesh& fine,
+	const MCMesh& coarse,
+	unsigned int axis,
+	float planePos,
+	float coarseVoxelSize)
+{
+	const float tolerance = coarseVoxelSize * 1e-3f;
+	const unsigned int uAxis = (axis + 1) % 3;
+	const unsigned int vAxis = (axis + 2) % 3;
+	auto onPlane = [&](const float3& p) {
+		return std::fabs(p.cell[axis] - planePos) <= tolerance;
+	};
+	
+	//Segments of coarse mesh boundary bucketed by their middle point
+	vector<pair<float3, float3>> segments;
+	SpatialHash hash;
+	bool indexed = !coarse.indices.empty();
+	unsigned int corners = indexed ? coarse.indices.size() : coarse.verts.size();
+	auto corner = [&](unsigned int c) -> const float3& {
+		return coarse.verts[indexed ? coarse.indices[c] : c];
+	};
+	for(unsigned int t=0; t+2<corners; t+=3) {
+		for(unsigned int e=0; e<3; e++) {
+			const float3& a = corner(t + e);
+			const float3& b = corner(t + (e + 1) % 3);
+			if(!onPlane(a) || !onPlane(b)) {
+				continue;
+			}
+			hash[cellKey(
+				cellCoord((a.cell[uAxis] + b.cell[uAxis]) / 2, coarseVoxelSize),
+				cellCoord((a.cell[vAxis] + b.cell[vAxis]) / 2, coarseVoxelSize),
+				0
+			)].push_back(segments.size());
+			segments.push_back(make_pair(a, b));
+		}
+	}
+	if(segments.empty()) {
+		return 0;
+	}
+	
+	unsigned int moved = 0;
+	for(float3& v : fine.verts) {
+		if(!onPlane(v)) {
+			continue;
+		}
+		int cu = cellCoord(v.cell[uAxis], coarseVoxelSize);
+		int cv = cellCoord(v.cell[vAxis], coarseVoxelSize);
+		float nearest = coarseVoxelSize;
+		float3 target = v;
+		for(int u=cu-1; u<=cu+1; u++) {
+			for(int w=cv-1; w<=cv+1; w++) {
+				auto it = hash.find(cellKey(u, w, 0));
+				if(it == hash.end()) {
+					continue;
+				}
+				for(unsigned int s : it->second) {
+					float3 p = nearestOnSegment(
+						v, segments[s].first, segments[s].second);
+					float d = distance(v, p);
+					if(d < nearest) {
+						nearest = d;
+						target = p;
+					}
+				}
+			}
+		}
+		if(nearest < coarseVoxelSize) {
+			v = target;
+			moved++;
+		}
+	}
+	return moved;
+}
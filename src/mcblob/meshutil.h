@@ -0,0 +1,49 @@
+#ifndef __MCBLOB_MESHUTIL_H__
+#define __MCBLOB_MESHUTIL_H__
+
+#include <cstdint>
+
+#include "common/mathtypes.h"
+#include "marchingcubes.h"
+
+/**
+  \brief Statistics of vertex position deviation between two meshes.
+  
+  Can be accumulated over many meshes (e.g. all blocks of the domain) with
+  measureDeviation.
+  */
+struct MeshDeviation {
+	float maxDeviation = 0.0f; /**< largest distance to the nearest
+	                                reference vertex */
+	double sumDeviation = 0.0; /**< sum of distances of all compared
+	                                vertices */
+	unsigned long comparedVertices = 0; /**< vertices that had reference
+	                                         vertex within search radius */
+	unsigned long unmatchedVertices = 0; /**< vertices without reference
+	                                          vertex within search radius */
+	
+	double meanDeviation() const {
+		return comparedVertices ? sumDeviation / comparedVertices : 0.0;
+	}
+};
+
+uint64_t cellKey(int x, int y, int z);
+
+int cellCoord(float v, float cellSize);
+
+void measureDeviation(
+	const MCMesh& reference,
+	const MCMesh& mesh,
+	float searchRadius,
+	MeshDeviation& deviation
+);
+
+unsigned int stitchFace(
+	MCMesh& fine,
+	const MCMesh& coarse,
+	unsigned int axis,
+	float planePos,
+	float coarseVoxelSize
+);
+
+#endif //__MCBLOB_MESHUTIL_H__
@@ -0,0 +1,819 @@
+#include "config.h"
+#include "pipeline.h"
+#include "context.h"
+#include "grid.h"
+#include "sparsegrid.h"
+#include "blob.h"
+#include "marchingcubes.h"
+#include "histopyramid.h"
+#include "surfacenets.h"
+#include "meshutil.h"
+
+#include <algorithm>
+#include <cmath>
+#include <thread>
+#include <stdexcept>
+
+using namespace std;
+
+/** Size (in voxels) of tiles of sparse grids */
+static const unsigned int SPARSE_TILE_DIM = 8;
+
+/** In adaptive mode, number of voxels along diameter of the smallest blob
+    intersecting a block */
+static const float ADAPTIVE_VOXELS_PER_DIAMETER = 8.0f;
+/** In adaptive mode, log2 of the smallest block size in voxels */
+static const unsigned int ADAPTIVE_MIN_LOG_DIM = 2;
+
+/** Fitted domain encloses all points where density of any single blob is
+    at least this fraction of the smallest iso value divided by number of
+    blobs, so that their sum stays below the iso value outside of it */
+static const float FIT_DENSITY_CUTOFF = 0.1f;
+/** Smallest number of blobs worth a separate thread when fitting domain */
+static const int FIT_BLOBS_PER_THREAD = 100000;
+
+/**
+  \param ctx initialized OpenCL context, may be shared by many pipelines
+  (but not used by two of them at the same time)
+  \param config description of the domain and meshing options
+  \throws runtime_error if options can't be used together
+  */
+Pipeline::Pipeline(Context& ctx, const PipelineConfig& config) :
+	mCtx(ctx),
+	mConfig(config),
+	mCancelled(false),
+	mBlobs(NULL),
+	mNBlobs(0),
+	mCallback(NULL),
+	mRegionsPerBlock(1)
+{
+	if(mConfig.isoValues.empty()) {
+		throw runtime_error("No iso values given");
+	}
+	if(*min_element(mConfig.isoValues.begin(), mConfig.isoValues.end()) <= 0.0f) {
+		throw runtime_error("Iso values must be positive");
+	}
+	if(mConfig.batchSize == 0) {
+		throw runtime_error("Batch size must be positive");
+	}
+	Engine engine = mConfig.engine;
+	if(mConfig.batchSize > 1 &&
+	   (engine != Engine::MARCHING_CUBES || mConfig.sparse ||
+	    mConfig.adaptive || mConfig.precisionReport)) {
+		throw runtime_error("--batch can't be used with engines other than mc, "
+		                    "--sparse, --adaptive and --precision-report");
+	}
+	if(mConfig.streaming &&
+	   (engine != Engine::MARCHING_CUBES || mConfig.sparse || mConfig.adaptive ||
+	    mConfig.batchSize > 1 || mConfig.precisionReport)) {
+		throw runtime_error("--stream can't be used with engines other than mc, "
+		                    "--sparse, --adaptive, --batch and --precision-report");
+	}
+	//Normals of other formats come from neighbouring samples, which would
+	//be one-sided on slab borders and leave shading seams
+	if(mConfig.streaming && mConfig.gridFormat != Grid::Format::GRADIENT) {
+		throw runtime_error("--stream can be used only with gradient grid format");
+	}
+	if(mConfig.gridLayout != Grid::Layout::LINEAR &&
+	   (mConfig.sparse || mConfig.batchSize > 1)) {
+		throw runtime_error("--layout can't be used with --sparse and --batch");
+	}
+	if(engine != Engine::MARCHING_CUBES && mConfig.sparse) {
+		throw runtime_error("--sparse is supported only by mc engine");
+	}
+	if(engine != Engine::MARCHING_CUBES && engine != Engine::HISTOPYRAMID &&
+	   mConfig.adaptive) {
+		throw runtime_error("--adaptive is supported only by mc and hpmc engines");
+	}
+}
+
+unsigned int
+Pipeline::getBlockCount() const
+{
+	return mConfig.gridConf.x * mConfig.gridConf.y * mConfig.gridConf.z;
+}
+
+/**
+  \return number of voxels along z of every slab in streaming mode, the same
+  as thickness of regions of the coarse pass
+  */
+static cl_uint slab_depth(unsigned int logBlockDim)
+{
+	return std::min(SPARSE_TILE_DIM, static_cast<cl_uint>(1) << logBlockDim);
+}
+
+/**
+  \return number of slabs in streaming mode
+  */
+unsigned int
+Pipeline::getSlabCount() const
+{
+	cl_uint blockDim = static_cast<cl_uint>(1) << mConfig.logBlockDim;
+	return mConfig.gridConf.z * blockDim / slab_depth(mConfig.logBlockDim);
+}
+
+/**
+  \return size of voxels of blocks with the highest resolution
+  */
+float
+Pipeline::getFinestVoxelSize() const
+{
+	return mConfig.blockSize.x / (1 << mConfig.logBlockDim);
+}
+
+/**
+  \return index of block in order of computation (z changing fastest)
+  */
+unsigned int
+Pipeline::blockIndex(const uint3& pos) const
+{
+	return (pos.x * mConfig.gridConf.y + pos.y) * mConfig.gridConf.z + pos.z;
+}
+
+uint3
+Pipeline::blockPosition(unsigned int index) const
+{
+	const uint3& conf = mConfig.gridConf;
+	return uint3(index / (conf.y * conf.z), index / conf.z % conf.y, index % conf.z);
+}
+
+float3
+Pipeline::blockStart(const uint3& pos) const
+{
+	return float3(
+		mConfig.startPoint.x + mConfig.blockSize.x * pos.x,
+		mConfig.startPoint.y + mConfig.blockSize.y * pos.y,
+		mConfig.startPoint.z + mConfig.blockSize.z * pos.z,
+		1.0f
+	);
+}
+
+/**
+  \brief choose resolution of a block
+
+  Resolution is chosen so that the smallest blob intersecting the block is
+  ADAPTIVE_VOXELS_PER_DIAMETER voxels wide. Blobs which centers are within a
+  diameter from the block are treated as intersecting it.
+
+  \return log2 of size of the block in voxels along each axis, between
+  ADAPTIVE_MIN_LOG_DIM and logBlockDim
+  */
+unsigned int
+Pipeline::chooseLogDim(const uint3& pos) const
+{
+	const float3& blockSize = mConfig.blockSize;
+	float3 start = blockStart(pos);
+	float minDiam = -1.0f;
+	for(int i{0}; i<mNBlobs; i++) {
+		const float4& b = mBlobs[i];
+		if(b.x + b.w >= start.x && b.x - b.w <= start.x + blockSize.x &&
+		   b.y + b.w >= start.y && b.y - b.w <= start.y + blockSize.y &&
+		   b.z + b.w >= start.z && b.z - b.w <= start.z + blockSize.z) {
+			minDiam = minDiam < 0.0f ? b.w : std::min(minDiam, b.w);
+		}
+	}
+	unsigned int minLogDim = std::min(ADAPTIVE_MIN_LOG_DIM, mConfig.logBlockDim);
+	if(minDiam <= 0.0f) {
+		return minLogDim;
+	}
+	float extent = std::max(blockSize.x, std::max(blockSize.y, blockSize.z));
+	float voxels = extent * ADAPTIVE_VOXELS_PER_DIAMETER / minDiam;
+	unsigned int logDim = static_cast<unsigned int>(
+		std::max(0.0f, std::ceil(std::log2(voxels))));
+	return std::max(minLogDim, std::min(logDim, mConfig.logBlockDim));
+}
+
+/**
+  Coarse pass classifying regions of tile size (at the finest resolution)
+  of the whole domain.
+  */
+void
+Pipeline::classifyDomain()
+{
+	const uint3& conf = mConfig.gridConf;
+	const float3& blockSize = mConfig.blockSize;
+	mRegionsPerBlock = std::max(
+		static_cast<cl_uint>(1),
+		(static_cast<cl_uint>(1) << mConfig.logBlockDim) / SPARSE_TILE_DIM);
+	mRegionGridSize = uint3(
+		conf.x * mRegionsPerBlock,
+		conf.y * mRegionsPerBlock,
+		conf.z * mRegionsPerBlock
+	);
+	mRegions.clear();
+	if(!mConfig.prepass) {
+		return;
+	}
+	const vector<float>& iso = mConfig.isoValues;
+	mRegions = mCtx.getBlobProgram()->classifyRegions(
+		mBlobs,
+		mNBlobs,
+		mConfig.startPoint,
+		mRegionGridSize,
+		float3(
+			blockSize.x / mRegionsPerBlock,
+			blockSize.y / mRegionsPerBlock,
+			blockSize.z / mRegionsPerBlock,
+			0.0f
+		),
+		*min_element(iso.begin(), iso.end()),
+		*max_element(iso.begin(), iso.end())
+	);
+}
+
+/**
+  \return true if any of count^3 regions starting at first may contain
+  surface
+  */
+bool
+Pipeline::regionsActive(const uint3& first, cl_uint count) const
+{
+	if(mRegions.empty()) {
+		return true;
+	}
+	for(cl_uint z=first.z; z<first.z+count; z++) {
+		for(cl_uint y=first.y; y<first.y+count; y++) {
+			for(cl_uint x=first.x; x<first.x+count; x++) {
+				size_t r = (z * mRegionGridSize.y + y) * mRegionGridSize.x + x;
+				if(mRegions[r] == Blob::REGION_SURFACE) {
+					return true;
+				}
+			}
+		}
+	}
+	return false;
+}
+
+bool
+Pipeline::blockActive(const uint3& pos) const
+{
+	return regionsActive(
+		uint3(pos.x * mRegionsPerBlock, pos.y * mRegionsPerBlock, pos.z * mRegionsPerBlock),
+		mRegionsPerBlock
+	);
+}
+
+/**
+  \brief mesh the whole domain
+
+  \param blobs array of blobs (x, y, z, diameter), must stay valid until
+  run() returns
+  \param nBlobs length of blobs array
+  \param callback function called with meshes of every block
+  \return false if computation was cancelled, also before it started
+  */
+bool
+Pipeline::run(const float4* blobs, int nBlobs, const BlockCallback& callback)
+{
+	if(mCancelled) {
+		return false;
+	}
+	mBlobs = blobs;
+	mNBlobs = nBlobs;
+	mCallback = &callback;
+	mDeviation = MeshDeviation();
+	unsigned int nBlocks = getBlockCount();
+
+	mBlockLogDims.assign(nBlocks, mConfig.logBlockDim);
+	if(mConfig.adaptive) {
+		for(unsigned int b=0; b<nBlocks; b++) {
+			mBlockLogDims[b] = chooseLogDim(blockPosition(b));
+		}
+	}
+	mHeldMeshes.assign(mConfig.adaptive ? nBlocks : 0, vector<MCMesh>());
+	mPrevGrid.reset();
+	//Blobs go to the device once and are reused by every block
+	mCtx.getBlobProgram()->setFalloff(mConfig.falloff);
+	mCtx.getBlobProgram()->setSeparable(mConfig.separable);
+	mCtx.getBlobProgram()->setSplatting(mConfig.splatting);
+	mCtx.getBlobProgram()->uploadBlobs(blobs, nBlobs);
+
+	classifyDomain();
+
+	if(mConfig.streaming) {
+		computeSlabs();
+	} else if(mConfig.batchSize > 1) {
+		computeBatches();
+	} else {
+		for(unsigned int b=0; b<nBlocks && !mCancelled; b++) {
+			computeBlock(blockPosition(b));
+		}
+	}
+
+	if(mConfig.adaptive) {
+		stitchBlocks();
+		for(unsigned int b=0; b<nBlocks; b++) {
+			if(!mHeldMeshes[b].empty()) {
+				BlockResult result{b, blockPosition(b), std::move(mHeldMeshes[b])};
+				callback(result);
+			}
+		}
+		mHeldMeshes.clear();
+	}
+	mPrevGrid.reset();
+	mCallback = NULL;
+	return !mCancelled;
+}
+
+/**
+  Passes meshes of computed block to the callback, or keeps them for
+  stitching in adaptive mode.
+  */
+void
+Pipeline::deliver(unsigned int index, vector<MCMesh>& meshes)
+{
+	if(mConfig.adaptive) {
+		mHeldMeshes[index] = std::move(meshes);
+		return;
+	}
+	BlockResult result{index, blockPosition(index), std::move(meshes)};
+	(*mCallback)(result);
+}
+
+/**
+  Computes blocks in batches. Each block of a batch is a tile of sparse
+  grid spanning whole domain, so every stage runs once per batch.
+  */
+void
+Pipeline::computeBatches()
+{
+	const uint3& conf = mConfig.gridConf;
+	const vector<float>& iso = mConfig.isoValues;
+	unsigned int nBlocks = getBlockCount();
+	cl_uint blockDim = static_cast<cl_uint>(1) << mConfig.logBlockDim;
+	SparseGrid grid{
+		uint3(conf.x * blockDim, conf.y * blockDim, conf.z * blockDim),
+		float3(
+			mConfig.blockSize.x / blockDim,
+			mConfig.blockSize.y / blockDim,
+			mConfig.blockSize.z / blockDim
+		),
+		mConfig.startPoint,
+		mCtx.getClContext(),
+		mCtx.getQueues()[0],
+		mCtx.getMemsetKernel(),
+		mConfig.gridFormat,
+		blockDim
+	};
+
+	//Only blocks that may contain the surface are batched, remaining ones
+	//get empty meshes, delivered in between in order of block index
+	vector<unsigned int> activeBlocks;
+	for(unsigned int b=0; b<nBlocks; b++) {
+		if(blockActive(blockPosition(b))) {
+			activeBlocks.push_back(b);
+		}
+	}
+	unsigned int nextBlock = 0;
+	auto deliverInactive = [&](unsigned int end) {
+		for(; nextBlock<end; nextBlock++) {
+			vector<MCMesh> empty(iso.size());
+			deliver(nextBlock, empty);
+		}
+	};
+	for(size_t first=0; first<activeBlocks.size() && !mCancelled;
+	    first+=mConfig.batchSize) {
+		size_t last = std::min(activeBlocks.size(), first + mConfig.batchSize);
+		vector<uint3> tiles;
+		for(size_t a=first; a<last; a++) {
+			tiles.push_back(blockPosition(activeBlocks[a]));
+		}
+		grid.setTiles(tiles);
+		grid.clear();
+		mCtx.getBlobProgram()->runBlob(mBlobs, mNBlobs, grid);
+
+		vector<vector<MCMesh>> meshes(last - first);
+		for(size_t n=0; n<iso.size(); n++) {
+			vector<MCMesh> batch = mCtx.getMcProgram()->computeTiles(grid, iso[n]);
+			for(size_t a=first; a<last; a++) {
+				meshes[a - first].push_back(std::move(batch[a - first]));
+			}
+		}
+		for(size_t a=first; a<last; a++) {
+			deliverInactive(activeBlocks[a]);
+			deliver(activeBlocks[a], meshes[a - first]);
+			nextBlock = activeBlocks[a] + 1;
+		}
+	}
+	if(!mCancelled) {
+		deliverInactive(nBlocks);
+	}
+}
+
+/**
+  Computes the whole domain as one lattice, slab by slab along z. Each slab
+  is a grid of slab_depth() voxels, its first lattice slice is copied from
+  the last one of the previous slab. Slabs without surface (according to
+  the coarse pass) are skipped. Grid format is always
+  Grid::Format::GRADIENT, so normals on slab borders don't depend on
+  neighbouring slabs.
+  */
+void
+Pipeline::computeSlabs()
+{
+	const uint3& conf = mConfig.gridConf;
+	const vector<float>& iso = mConfig.isoValues;
+	cl_uint blockDim = static_cast<cl_uint>(1) << mConfig.logBlockDim;
+	cl_uint depth = slab_depth(mConfig.logBlockDim);
+	float3 voxelSize(
+		mConfig.blockSize.x / blockDim,
+		mConfig.blockSize.y / blockDim,
+		mConfig.blockSize.z / blockDim
+	);
+	uint3 slabDim(conf.x * blockDim, conf.y * blockDim, depth);
+
+	//Two slabs swapped after every step, so the last slice of the previous
+	//one is still on the device
+	unique_ptr<Grid> slabs[2];
+	for(unique_ptr<Grid>& slab : slabs) {
+		slab.reset(new Grid{
+			slabDim,
+			voxelSize,
+			mConfig.startPoint,
+			mCtx.getClContext(),
+			mCtx.getQueues()[0],
+			mCtx.getMemsetKernel(),
+			mConfig.gridFormat,
+			mConfig.gridLayout
+		});
+	}
+	bool prevValid = false;
+	unsigned int nSlabs = getSlabCount();
+	for(unsigned int s=0; s<nSlabs && !mCancelled; s++) {
+		vector<MCMesh> meshes;
+		//Regions are as thick as slabs
+		bool active = false;
+		for(cl_uint y=0; y<mRegionGridSize.y && !active; y++) {
+			for(cl_uint x=0; x<mRegionGridSize.x && !active; x++) {
+				active = regionsActive(uint3(x, y, s), 1);
+			}
+		}
+		if(!active) {
+			prevValid = false;
+			meshes.resize(iso.size());
+		} else {
+			Grid& slab = *slabs[s % 2];
+			slab.setStartPos(float3(
+				mConfig.startPoint.x,
+				mConfig.startPoint.y,
+				mConfig.startPoint.z + s * depth * voxelSize.z,
+				1.0f
+			));
+			slab.clear();
+			cl_uint firstSlice = 0;
+			if(prevValid && mConfig.gridLayout == Grid::Layout::LINEAR) {
+				slab.copySlices(*slabs[(s + 1) % 2], depth, 1);
+				firstSlice = 1;
+			}
+			mCtx.getBlobProgram()->runBlob(mBlobs, mNBlobs, slab, firstSlice);
+			for(float isoValue : iso) {
+				meshes.push_back(mCtx.getMcProgram()->compute(slab, isoValue));
+			}
+			prevValid = true;
+		}
+		BlockResult result{s, uint3(0, 0, s), std::move(meshes)};
+		(*mCallback)(result);
+	}
+}
+
+/**
+  Computes meshes of single block for all iso values.
+  */
+void
+Pipeline::computeBlock(const uint3& pos)
+{
+	const vector<float>& iso = mConfig.isoValues;
+	unsigned int index = blockIndex(pos);
+	vector<MCMesh> meshes;
+	if(!blockActive(pos)) {
+		mPrevGrid.reset();
+		meshes.resize(iso.size());
+		deliver(index, meshes);
+		return;
+	}
+
+	float3 start = blockStart(pos);
+	unsigned int blockLogDim = mBlockLogDims[index];
+	uint3 gridDim = uint3(static_cast<uint>(1) << blockLogDim);
+	float3 voxelSize{
+		mConfig.blockSize.x / gridDim.x,
+		mConfig.blockSize.y / gridDim.y,
+		mConfig.blockSize.z / gridDim.z
+	};
+	MarchingCubes* mc = mCtx.getMcProgram();
+	Engine engine = mConfig.engine;
+
+	//Surface nets need grids overlapping by one voxel to join blocks, the
+	//extra layer is put before the block
+	bool apron = engine == Engine::SURFACE_NETS ||
+	             engine == Engine::DUAL_CONTOURING;
+	uint3 denseGridDim = gridDim;
+	float3 denseGridStart = start;
+	if(apron) {
+		denseGridDim = uint3(gridDim.x + 1, gridDim.y + 1, gridDim.z + 1);
+		denseGridStart = float3(
+			start.x - voxelSize.x,
+			start.y - voxelSize.y,
+			start.z - voxelSize.z,
+			1.0f
+		);
+	}
+	auto extract = [&](Grid& grid, float isoValue) {
+		switch(engine) {
+		case Engine::SURFACE_NETS:
+			return mCtx.getSurfaceNetsProgram()->compute(grid, isoValue, false, 1);
+		case Engine::DUAL_CONTOURING:
+			return mCtx.getSurfaceNetsProgram()->compute(grid, isoValue, true, 1);
+		case Engine::HISTOPYRAMID:
+			return mCtx.getHpProgram()->compute(grid, isoValue);
+		case Engine::MARCHING_CUBES:
+		default:
+			return mc->compute(grid, isoValue);
+		}
+	};
+
+	if(mConfig.sparse) {
+		SparseGrid grid{
+			gridDim,
+			voxelSize,
+			start,
+			mCtx.getClContext(),
+			mCtx.getQueues()[0],
+			mCtx.getMemsetKernel(),
+			mConfig.gridFormat,
+			std::min(SPARSE_TILE_DIM, gridDim.x)
+		};
+		if(mRegions.empty()) {
+			mCtx.getBlobProgram()->findActiveTiles(
+				mBlobs, mNBlobs, grid,
+				*min_element(iso.begin(), iso.end()),
+				*max_element(iso.begin(), iso.end()));
+		} else {
+			//Tiles are at least as big as regions
+			uint3 tileGridSize = grid.getTileGridSize();
+			cl_uint step = mRegionsPerBlock / tileGridSize.x;
+			vector<uint3> tiles;
+			for(cl_uint z=0; z<tileGridSize.z; z++) {
+				for(cl_uint y=0; y<tileGridSize.y; y++) {
+					for(cl_uint x=0; x<tileGridSize.x; x++) {
+						uint3 first(
+							pos.x * mRegionsPerBlock + x * step,
+							pos.y * mRegionsPerBlock + y * step,
+							pos.z * mRegionsPerBlock + z * step
+						);
+						if(regionsActive(first, step)) {
+							tiles.push_back(uint3(x, y, z));
+						}
+					}
+				}
+			}
+			grid.setTiles(tiles);
+		}
+		grid.clear();
+		mCtx.getBlobProgram()->runBlob(mBlobs, mNBlobs, grid);
+		for(float isoValue : iso) {
+			meshes.push_back(mc->compute(grid, isoValue));
+		}
+	} else {
+		unique_ptr<Grid> gridPtr{new Grid{
+			denseGridDim,
+			voxelSize,
+			denseGridStart,
+			mCtx.getClContext(),
+			mCtx.getQueues()[0],
+			mCtx.getMemsetKernel(),
+			mConfig.gridFormat,
+			mConfig.gridLayout
+		}};
+		Grid& grid = *gridPtr;
+		grid.clear();
+
+		//Blocks are computed with z changing fastest, so slices on the face
+		//shared with the previous block (two with the apron) can be
+		//copied from its grid
+		cl_uint firstSlice = 0;
+		if(mPrevGrid &&
+		   mPrevPos.x == pos.x && mPrevPos.y == pos.y && mPrevPos.z + 1 == pos.z &&
+		   mPrevGrid->getGridSize().x == denseGridDim.x &&
+		   mPrevGrid->getGridSize().y == denseGridDim.y &&
+		   mPrevGrid->getGridSize().z == denseGridDim.z) {
+			firstSlice = apron ? 2 : 1;
+			grid.copySlices(*mPrevGrid, denseGridDim.z + 1 - firstSlice, firstSlice);
+		}
+		mPrevGrid.reset();
+		mCtx.getBlobProgram()->runBlob(mBlobs, mNBlobs, grid, firstSlice);
+		bool resampled = false;
+
+		//Match faces shared with coarser neighbours
+		int conf[] = {
+			(int) mConfig.gridConf.x,
+			(int) mConfig.gridConf.y,
+			(int) mConfig.gridConf.z
+		};
+		for(unsigned int axis=0; axis<3; axis++) {
+			for(int side=0; side<2; side++) {
+				int n[] = {(int) pos.x, (int) pos.y, (int) pos.z};
+				n[axis] += side ? 1 : -1;
+				if(n[axis] < 0 || n[axis] >= conf[axis]) {
+					continue;
+				}
+				unsigned int neighbourLogDim =
+					mBlockLogDims[blockIndex(uint3(n[0], n[1], n[2]))];
+				if(neighbourLogDim < blockLogDim) {
+					resampled = true;
+					mCtx.getBlobProgram()->resampleFace(
+						grid,
+						axis,
+						side,
+						1 << (blockLogDim - neighbourLogDim)
+					);
+				}
+			}
+		}
+		for(float isoValue : iso) {
+			meshes.push_back(extract(grid, isoValue));
+		}
+		//Resampled faces differ from values the next block would compute,
+		//slices of bricked grids aren't contiguous and can't be copied
+		if(!resampled && mConfig.gridLayout == Grid::Layout::LINEAR) {
+			mPrevGrid = std::move(gridPtr);
+			mPrevPos = pos;
+		}
+	}
+	if(mConfig.precisionReport) {
+		Grid refGrid{
+			denseGridDim,
+			voxelSize,
+			denseGridStart,
+			mCtx.getClContext(),
+			mCtx.getQueues()[0],
+			mCtx.getMemsetKernel(),
+			Grid::Format::SCALAR
+		};
+		refGrid.clear();
+		mCtx.getBlobProgram()->runBlob(mBlobs, mNBlobs, refGrid);
+		for(size_t n=0; n<iso.size(); n++) {
+			measureDeviation(
+				extract(refGrid, iso[n]),
+				meshes[n],
+				std::max(voxelSize.x, std::max(voxelSize.y, voxelSize.z)),
+				mDeviation
+			);
+		}
+	}
+	deliver(index, meshes);
+}
+
+/**
+  Stitches meshes of neighbouring blocks of different resolution. Blocks
+  that weren't computed (because of cancellation) are skipped.
+  */
+void
+Pipeline::stitchBlocks()
+{
+	const uint3& gridConf = mConfig.gridConf;
+	int conf[] = {(int) gridConf.x, (int) gridConf.y, (int) gridConf.z};
+	for(unsigned int b=0; b<getBlockCount(); b++) {
+		if(mHeldMeshes[b].empty()) {
+			continue;
+		}
+		uint3 pos = blockPosition(b);
+		for(unsigned int axis=0; axis<3; axis++) {
+			int n[] = {(int) pos.x, (int) pos.y, (int) pos.z};
+			n[axis]++;
+			if(n[axis] >= conf[axis]) {
+				continue;
+			}
+			unsigned int nb = blockIndex(uint3(n[0], n[1], n[2]));
+			if(mHeldMeshes[nb].empty() || mBlockLogDims[b] == mBlockLogDims[nb]) {
+				continue;
+			}
+			bool thisFiner = mBlockLogDims[b] > mBlockLogDims[nb];
+			unsigned int fine = thisFiner ? b : nb;
+			unsigned int coarse = thisFiner ? nb : b;
+			for(size_t i=0; i<mHeldMeshes[b].size(); i++) {
+				stitchFace(
+					mHeldMeshes[fine][i],
+					mHeldMeshes[coarse][i],
+					axis,
+					mConfig.startPoint.cell[axis] + mConfig.blockSize.cell[axis] * n[axis],
+					mConfig.blockSize.cell[axis] / (1 << mBlockLogDims[coarse])
+				);
+			}
+		}
+	}
+}
+
+/**
+  \brief fit the domain tightly around blobs
+
+  Finds bounding box of regions influenced by blobs (see
+  FIT_DENSITY_CUTOFF, with compact support falloff the exact radius of
+  influence is used instead), which encloses the whole isosurface however
+  blobs overlap, and replaces startPoint and gridConf of config with
+  the smallest part of the lattice of blocks (anchored at startPoint) that
+  encloses it. Resolution stays the same, but when the box fits into half of
+  a block along every axis, blocks are halved (with logBlockDim decreased),
+  down to ADAPTIVE_MIN_LOG_DIM.
+
+  \param config configuration with resolution and iso values set
+  \param blobs array of blobs (x, y, z, diameter)
+  \param nBlobs length of blobs array
+  \param threads number of threads searching for the bounding box, 0 means
+  one per hardware thread (large inputs only)
+  \throws runtime_error if there are no blobs or iso values aren't positive
+  */
+void fitDomain(
+	PipelineConfig& config,
+	const float4* blobs,
+	int nBlobs,
+	unsigned int threads)
+{
+	if(nBlobs <= 0) {
+		throw runtime_error("Can't fit domain without blobs");
+	}
+	const vector<float>& iso = config.isoValues;
+	if(iso.empty() ||
+	   *min_element(iso.begin(), iso.end()) <= 0.0f) {
+		throw runtime_error("Iso values must be positive");
+	}
+	//Outside of boxes of all blobs each of them adds less than cutoff, so
+	//even if all of them overlap, density stays below the smallest iso value
+	float cutoff = FIT_DENSITY_CUTOFF * *min_element(iso.begin(), iso.end()) /
+		nBlobs;
+	//Blob density is exp(1 - d^2/r^2) where r is half of the diameter
+	float reach = 0.5f * std::sqrt(std::max(0.0f, 1.0f - std::log(cutoff)));
+	float supportRatio = Blob::getSupportRatio(config.falloff);
+	if(supportRatio > 0.0f) {
+		reach = 0.5f * supportRatio;
+	}
+
+	if(threads == 0) {
+		threads = std::max(1u, std::thread::hardware_concurrency());
+	}
+	threads = std::max(1, std::min<int>(threads, nBlobs / FIT_BLOBS_PER_THREAD));
+
+	vector<float3> lows(threads), highs(threads);
+	auto worker = [&](unsigned int t) {
+		int first = static_cast<long long>(nBlobs) * t / threads;
+		int last = static_cast<long long>(nBlobs) * (t + 1) / threads;
+		float3 lo = blobs[first];
+		float3 hi = blobs[first];
+		for(int i=first; i<last; i++) {
+			const float4& b = blobs[i];
+			float r = b.w * reach;
+			lo.x = std::min(lo.x, b.x - r);
+			lo.y = std::min(lo.y, b.y - r);
+			lo.z = std::min(lo.z, b.z - r);
+			hi.x = std::max(hi.x, b.x + r);
+			hi.y = std::max(hi.y, b.y + r);
+			hi.z = std::max(hi.z, b.z + r);
+		}
+		lows[t] = lo;
+		highs[t] = hi;
+	};
+	vector<std::thread> pool;
+	for(unsigned int t=1; t<threads; t++) {
+		pool.push_back(std::thread(worker, t));
+	}
+	worker(0);
+	for(std::thread& t : pool) {
+		t.join();
+	}
+	float3 lo = lows[0];
+	float3 hi = highs[0];
+	for(unsigned int t=1; t<threads; t++) {
+		for(int axis=0; axis<3; axis++) {
+			lo.cell[axis] = std::min(lo.cell[axis], lows[t].cell[axis]);
+			hi.cell[axis] = std::max(hi.cell[axis], highs[t].cell[axis]);
+		}
+	}
+
+	auto fitsHalfBlock = [&]() {
+		for(int axis=0; axis<3; axis++) {
+			if(hi.cell[axis] - lo.cell[axis] > config.blockSize.cell[axis] / 2.0f) {
+				return false;
+			}
+		}
+		return true;
+	};
+	while(config.logBlockDim > ADAPTIVE_MIN_LOG_DIM && fitsHalfBlock()) {
+		config.blockSize = float3(
+			config.blockSize.x / 2.0f,
+			config.blockSize.y / 2.0f,
+			config.blockSize.z / 2.0f
+		);
+		config.logBlockDim--;
+	}
+
+	cl_uint conf[3];
+	for(int axis=0; axis<3; axis++) {
+		float start = config.startPoint.cell[axis];
+		float size = config.blockSize.cell[axis];
+		float first = std::floor((lo.cell[axis] - start) / size);
+		float last = std::ceil((hi.cell[axis] - start) / size);
+		conf[axis] = static_cast<cl_uint>(std::max(1.0f, last - first));
+		config.startPoint.cell[axis] = start + first * size;
+	}
+	config.gridConf = uint3(conf[0], conf[1], conf[2]);
+}
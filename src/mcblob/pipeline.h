@@ -0,0 +1,156 @@
+#ifndef __MCBLOB_PIPELINE_H__
+#define __MCBLOB_PIPELINE_H__
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "common/mathtypes.h"
+#include "blob.h"
+#include "grid.h"
+#include "marchingcubes.h"
+#include "meshutil.h"
+
+class Context;
+
+/** Isosurface extraction engine used by Pipeline */
+enum class Engine {
+	MARCHING_CUBES,
+	HISTOPYRAMID,
+	SURFACE_NETS,
+	DUAL_CONTOURING
+};
+
+/**
+  \brief Description of the domain and the way it's meshed.
+
+  The domain is a box starting at startPoint made of gridConf blocks, each
+  of size blockSize and divided into 2^logBlockDim voxels along each axis.
+  */
+struct PipelineConfig {
+	float3 startPoint{0.0f, 0.0f, 0.0f};
+	uint3 gridConf{1, 1, 1};
+	float3 blockSize{1.0f, 1.0f, 1.0f};
+	unsigned int logBlockDim = 5;
+
+	Engine engine = Engine::MARCHING_CUBES;
+	Grid::Format gridFormat = Grid::Format::GRADIENT;
+	Grid::Layout gridLayout = Grid::Layout::LINEAR; /**< layout of dense
+	                                                     grids */
+	bool sparse = false; /**< keep grids only in tiles near the surface */
+	bool adaptive = false; /**< choose resolution of each block from blob
+	                            sizes */
+	bool prepass = true; /**< skip blocks without surface found by the
+	                          coarse pass over the whole domain */
+	bool precisionReport = false; /**< measure deviation from single
+	                                   precision scalar grid */
+	unsigned int batchSize = 1; /**< number of blocks computed at once */
+	bool streaming = false; /**< treat the whole domain as one block and
+	                             compute it slab by slab along z */
+	Blob::Falloff falloff = Blob::Falloff::GAUSSIAN; /**< field function of
+	                                                      blobs */
+	bool separable = false; /**< evaluate Gaussian blobs in dense grids from
+	                             1D factors, see Blob::setSeparable() */
+	bool splatting = false; /**< add compact support blobs to dense grids
+	                             over their footprints only, see
+	                             Blob::setSplatting() */
+	std::vector<float> isoValues{1.0f};
+};
+
+/**
+  \brief Meshes of a single block passed to Pipeline callback.
+  */
+struct BlockResult {
+	unsigned int index; /**< index of the block in order of computation
+	                         (of the slab in streaming mode) */
+	uint3 position; /**< position of the block in the grid of blocks
+	                     ((0, 0, index) in streaming mode) */
+	std::vector<MCMesh> meshes; /**< mesh for each iso value, in order of
+	                                 PipelineConfig::isoValues */
+};
+
+/**
+  \brief Meshing of the whole domain, block by block.
+
+  Meshes of each block are passed to a callback as soon as the block is
+  computed, so the caller doesn't have to keep the whole domain in memory.
+  Blocks without surface get empty meshes. In adaptive mode meshes must be
+  stitched with their neighbours first, so they are passed after all blocks
+  are computed.
+
+  In streaming mode the whole domain is a single lattice evaluated and
+  polygonized in slabs of a few voxels along z, each passed to the callback
+  as soon as it's done. Only two slabs are kept on the device at once, so
+  device memory grows with the area of the domain's xy cross-section rather
+  than with its volume, and there are no seams between blocks.
+
+  Computation may be stopped from another thread (or a signal handler) with
+  cancel(). Meshes of blocks computed so far are still passed to the
+  callback. Cancellation isn't cleared by run(), so it isn't lost when it
+  comes just before run() starts; call resetCancellation() before making
+  the pipeline reachable for cancel() again.
+  */
+class Pipeline
+{
+public:
+	typedef std::function<void(BlockResult&)> BlockCallback;
+
+	Pipeline(Context& ctx, const PipelineConfig& config);
+	virtual ~Pipeline() {}
+
+	bool run(const float4* blobs, int nBlobs, const BlockCallback& callback);
+
+	void cancel() { mCancelled = true; }
+	void resetCancellation() { mCancelled = false; }
+	bool isCancelled() const { return mCancelled; }
+
+	const PipelineConfig& getConfig() const { return mConfig; }
+	unsigned int getBlockCount() const;
+	unsigned int getSlabCount() const;
+	float getFinestVoxelSize() const;
+	const MeshDeviation& getDeviation() const { return mDeviation; }
+
+protected:
+	Context& mCtx;
+	PipelineConfig mConfig;
+	std::atomic<bool> mCancelled;
+	MeshDeviation mDeviation;
+
+	//State of the current run()
+	const float4* mBlobs;
+	int mNBlobs;
+	const BlockCallback* mCallback;
+	std::vector<unsigned int> mBlockLogDims;
+	std::vector<cl_uchar> mRegions;
+	cl_uint mRegionsPerBlock;
+	uint3 mRegionGridSize;
+	std::vector<std::vector<MCMesh>> mHeldMeshes;
+	std::unique_ptr<Grid> mPrevGrid; /**< grid of the previous block, its
+	                                      last slices are reused */
+	uint3 mPrevPos;
+
+	unsigned int blockIndex(const uint3& pos) const;
+	uint3 blockPosition(unsigned int index) const;
+	float3 blockStart(const uint3& pos) const;
+	unsigned int chooseLogDim(const uint3& pos) const;
+
+	void classifyDomain();
+	bool regionsActive(const uint3& first, cl_uint count) const;
+	bool blockActive(const uint3& pos) const;
+
+	void computeBatches();
+	void computeSlabs();
+	void computeBlock(const uint3& pos);
+	void stitchBlocks();
+	void deliver(unsigned int index, std::vector<MCMesh>& meshes);
+};
+
+void fitDomain(
+	PipelineConfig& config,
+	const float4* blobs,
+	int nBlobs,
+	unsigned int threads = 0
+);
+
+#endif //__MCBLOB_PIPELINE_H__
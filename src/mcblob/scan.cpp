@@ -26,6 +26,8 @@ static const std::string sPath = "kernels/scan.cl";
 static const char sScanExclusiveLocal1Name[] = "scanExclusiveLocal1";
 static const char sScanExclusiveLocal2Name[] = "scanExclusiveLocal2";
 static const char sUniformUpdateName[] = "uniformUpdate";
+static const char sScanExclusiveChunksName[] = "scanExclusiveChunks";
+static const char sUniformUpdateBoundedName[] = "uniformUpdateBounded";
 
 Scan::Scan(
 	const cl::Context &context,
@@ -35,6 +37,8 @@ Scan::Scan(
 	mScanExclusiveLocal1 = cl::Kernel(mProgram, sScanExclusiveLocal1Name);
 	mScanExclusiveLocal2 = cl::Kernel(mProgram, sScanExclusiveLocal2Name);
 	mUniformUpdate = cl::Kernel(mProgram, sUniformUpdateName);
+	mScanExclusiveChunks = cl::Kernel(mProgram, sScanExclusiveChunksName);
+	mUniformUpdateBounded = cl::Kernel(mProgram, sUniformUpdateBoundedName);
 	
 	bool hasCapableDevice = false;
 	for(cl::CommandQueue& q : mCommandQueues) {
@@ -47,10 +51,16 @@ Scan::Scan(
 			mScanExclusiveLocal2.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(dev);
 		size_t uniformUpdateWGSize = 
 			mUniformUpdate.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(dev);
+		size_t scanExclusiveChunksWGSize =
+			mScanExclusiveChunks.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(dev);
+		size_t uniformUpdateBoundedWGSize =
+			mUniformUpdateBounded.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(dev);
 		
 		if( (scanExclusiveLocal1WGSize) >= WORKGROUP_SIZE &&
 		    (scanExclusiveLocal2WGSize) >= WORKGROUP_SIZE &&
-		    (uniformUpdateWGSize) >= WORKGROUP_SIZE
+		    (uniformUpdateWGSize) >= WORKGROUP_SIZE &&
+		    (scanExclusiveChunksWGSize) >= WORKGROUP_SIZE &&
+		    (uniformUpdateBoundedWGSize) >= WORKGROUP_SIZE
 		) {
 			hasCapableDevice = true;
 			mSelectedQueue = q;
@@ -69,9 +79,23 @@ Scan::Scan(
 	}
 }
 
+/**
+  Computes exclusive prefix sum of size elements of src and writes it to dst.
+  Arrays of power-of-two length between MIN_LARGE_ARRAY_SIZE and
+  MAX_LARGE_ARRAY_SIZE use the original SDK implementation, all other lengths
+  are scanned recursively with scanExclusiveAny().
+  */
 void Scan::compute(cl::Buffer src, cl::Buffer dst, int size)
 {
-	scanExclusiveLarge(dst, src, 1, size);
+	unsigned int log2L;
+	if(size > 0 &&
+	   factorRadix2(log2L, size) == 1 &&
+	   size >= MIN_LARGE_ARRAY_SIZE &&
+	   size <= MAX_LARGE_ARRAY_SIZE) {
+		scanExclusiveLarge(dst, src, 1, size);
+	} else if(size > 0) {
+		scanExclusiveAny(dst, src, size);
+	}
 }
 
 unsigned int Scan::iSnapUp(unsigned int dividend, unsigned int divisor)
@@ -217,3 +241,48 @@ void Scan::scanExclusiveLarge(
 		(batchSize * arrayLength) / (4 * WORKGROUP_SIZE)
 	);
 }
+
+/**
+  Scans array of any length. Chunks of 4 * WORKGROUP_SIZE elements are
+  scanned separately, then totals of chunks are scanned with compute() and
+  added back to every chunk.
+  */
+void Scan::scanExclusiveAny(
+	cl::Buffer dst,
+	cl::Buffer src,
+	unsigned int size)
+{
+	unsigned int chunks = iSnapUp(size, 4 * WORKGROUP_SIZE) / (4 * WORKGROUP_SIZE);
+	cl::Buffer sums = cl::Buffer(
+		mContext, CL_MEM_READ_WRITE, chunks * sizeof(unsigned int));
+	
+	mScanExclusiveChunks.setArg(0, dst);
+	mScanExclusiveChunks.setArg(1, src);
+	mScanExclusiveChunks.setArg(2, sums);
+	mScanExclusiveChunks.setArg(3, 2 * WORKGROUP_SIZE * sizeof(unsigned int), NULL);
+	mScanExclusiveChunks.setArg(4, size);
+	mSelectedQueue.enqueueNDRangeKernel(
+		mScanExclusiveChunks,
+		cl::NDRange(0),
+		cl::NDRange(chunks * WORKGROUP_SIZE),
+		cl::NDRange(WORKGROUP_SIZE)
+	);
+	
+	if(chunks == 1) {
+		return;
+	}
+	
+	cl::Buffer sumsScan = cl::Buffer(
+		mContext, CL_MEM_READ_WRITE, chunks * sizeof(unsigned int));
+	compute(sums, sumsScan, chunks);
+	
+	mUniformUpdateBounded.setArg(0, dst);
+	mUniformUpdateBounded.setArg(1, sumsScan);
+	mUniformUpdateBounded.setArg(2, size);
+	mSelectedQueue.enqueueNDRangeKernel(
+		mUniformUpdateBounded,
+		cl::NDRange(0),
+		cl::NDRange(chunks * WORKGROUP_SIZE),
+		cl::NDRange(WORKGROUP_SIZE)
+	);
+}
@@ -18,6 +18,8 @@ protected:
 	cl::Kernel mScanExclusiveLocal1;
 	cl::Kernel mScanExclusiveLocal2;
 	cl::Kernel mUniformUpdate;
+	cl::Kernel mScanExclusiveChunks;
+	cl::Kernel mUniformUpdateBounded;
 	cl::Buffer mInternal;
 	
 	cl::CommandQueue mSelectedQueue; /**< Scan operation can be performed
@@ -55,6 +57,11 @@ protected:
 	                cl::Buffer src,
 	                unsigned int batchSize,
 	                unsigned int arrayLength);
+	
+	void scanExclusiveAny(
+	                cl::Buffer dst,
+	                cl::Buffer src,
+	                unsigned int size);
 public:
 	Scan(
 		const cl::Context &context,
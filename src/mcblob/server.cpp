@@ -0,0 +1,214 @@
+#include "config.h"
+#include "server.h"
+
+#include <stdexcept>
+#include <sstream>
+#include <cstring>
+#include <cerrno>
+
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace std;
+
+static const char sOkResponse[] = "OK";
+static const char sErrorResponse[] = "ERROR";
+
+/** Maximal number of clients waiting for the server */
+static const int SERVER_BACKLOG = 64;
+
+/** Seconds the server waits for more data of a job (or for the client to
+    take the response) before giving up on the client, so a stalled client
+    doesn't block the following ones */
+static const int CLIENT_TIMEOUT = 30;
+
+static sockaddr_un
+socket_address(const string& socketPath)
+{
+	sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if(socketPath.size() >= sizeof(addr.sun_path)) {
+		throw runtime_error("Socket path too long: " + socketPath);
+	}
+	strcpy(addr.sun_path, socketPath.c_str());
+	return addr;
+}
+
+static void
+send_all(int fd, const string& data)
+{
+	size_t sent = 0;
+	while(sent < data.size()) {
+		ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+		if(n < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			throw runtime_error(string("Socket write failed: ") + strerror(errno));
+		}
+		sent += n;
+	}
+}
+
+/**
+  Reads from fd until the other side shuts down the connection.
+  \throws runtime_error also if receive timeout of the socket passes
+  without any data
+  */
+static string
+receive_all(int fd)
+{
+	string ret;
+	char buf[4096];
+	for(;;) {
+		ssize_t n = recv(fd, buf, sizeof(buf), 0);
+		if(n < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			if(errno == EAGAIN || errno == EWOULDBLOCK) {
+				throw runtime_error("Timed out waiting for data on socket");
+			}
+			throw runtime_error(string("Socket read failed: ") + strerror(errno));
+		}
+		if(n == 0) {
+			return ret;
+		}
+		ret.append(buf, n);
+	}
+}
+
+static JobRequest
+parse_request(const string& message)
+{
+	JobRequest ret;
+	size_t pos = 0;
+	bool first = true;
+	for(;;) {
+		size_t end = message.find('\n', pos);
+		if(end == string::npos) {
+			throw runtime_error("Malformed job request");
+		}
+		string line = message.substr(pos, end - pos);
+		pos = end + 1;
+		if(first) {
+			ret.workingDirectory = line;
+			first = false;
+		} else if(line.empty()) {
+			break;
+		} else {
+			ret.args.push_back(line);
+		}
+	}
+	ret.data = message.substr(pos);
+	return ret;
+}
+
+/**
+  \brief Accept jobs on a Unix domain socket and compute them one by one.
+  
+  This function never returns unless the socket can't be created. Errors of
+  single jobs are sent back to their clients and don't stop the server.
+  Clients that stop sending job data for CLIENT_TIMEOUT seconds are
+  dropped.
+  
+  \param socketPath path of the socket, existing file is replaced
+  \param handler function called for every job
+  */
+void
+serveJobs(const string& socketPath, const JobHandler& handler)
+{
+	sockaddr_un addr = socket_address(socketPath);
+	int server = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(server < 0) {
+		throw runtime_error(string("Can't create socket: ") + strerror(errno));
+	}
+	unlink(socketPath.c_str());
+	if(bind(server, (sockaddr*) &addr, sizeof(addr)) < 0 ||
+	   listen(server, SERVER_BACKLOG) < 0) {
+		string error = strerror(errno);
+		close(server);
+		throw runtime_error("Can't listen on " + socketPath + ": " + error);
+	}
+	
+	for(;;) {
+		int client = accept(server, NULL, NULL);
+		if(client < 0) {
+			continue;
+		}
+		timeval timeout;
+		timeout.tv_sec = CLIENT_TIMEOUT;
+		timeout.tv_usec = 0;
+		setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+		setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+		string response = sOkResponse;
+		try {
+			handler(parse_request(receive_all(client)));
+		} catch(exception& e) {
+			response = string(sErrorResponse) + " " + e.what();
+		} catch(...) {
+			response = string(sErrorResponse) + " Unknown error";
+		}
+		try {
+			send_all(client, response + "\n");
+		} catch(runtime_error&) {
+			//client is gone, nothing to report to
+		}
+		close(client);
+	}
+}
+
+/**
+  \brief Send job to the server and wait until it's computed.
+  
+  \param socketPath path of the socket on which the server listens
+  \param request job to be computed, arguments must not contain newlines
+  \throws runtime_error with message of the server if the job failed
+  */
+void
+submitJob(const string& socketPath, const JobRequest& request)
+{
+	ostringstream message;
+	message << request.workingDirectory << '\n';
+	for(const string& arg : request.args) {
+		if(arg.find('\n') != string::npos || arg.empty()) {
+			throw runtime_error("Job arguments can't be empty or contain newlines");
+		}
+		message << arg << '\n';
+	}
+	message << '\n' << request.data;
+	
+	sockaddr_un addr = socket_address(socketPath);
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(fd < 0) {
+		throw runtime_error(string("Can't create socket: ") + strerror(errno));
+	}
+	string response;
+	try {
+		if(connect(fd, (sockaddr*) &addr, sizeof(addr)) < 0) {
+			throw runtime_error("Can't connect to " + socketPath + ": " + strerror(errno));
+		}
+		send_all(fd, message.str());
+		shutdown(fd, SHUT_WR);
+		response = receive_all(fd);
+	} catch(...) {
+		close(fd);
+		throw;
+	}
+	close(fd);
+	
+	while(!response.empty() && response.back() == '\n') {
+		response.pop_back();
+	}
+	if(response == sOkResponse) {
+		return;
+	}
+	string prefix = string(sErrorResponse) + " ";
+	if(response.compare(0, prefix.size(), prefix) == 0) {
+		throw runtime_error(response.substr(prefix.size()));
+	}
+	throw runtime_error("Unexpected response from server: " + response);
+}
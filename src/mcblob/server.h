@@ -0,0 +1,34 @@
+#ifndef __MCBLOB_SERVER_H__
+#define __MCBLOB_SERVER_H__
+
+#include <functional>
+#include <string>
+#include <vector>
+
+/**
+  \brief Job sent to mcblob running in server mode.
+  
+  On the socket a job is sent as working directory of the client and
+  arguments, each in separate line, followed by an empty line and inline
+  data (if any), which ends when the client shuts down its side of the
+  connection. Server answers with a single line, "OK" or "ERROR" followed
+  by the error message.
+  */
+struct JobRequest {
+	std::string workingDirectory; /**< relative paths are resolved here */
+	std::vector<std::string> args; /**< command line arguments, without
+	                                    program name */
+	std::string data; /**< inline input data */
+};
+
+/**
+  Function computing single job. Errors are reported by throwing an
+  exception, its message is sent back to the client.
+  */
+typedef std::function<void(const JobRequest&)> JobHandler;
+
+void serveJobs(const std::string& socketPath, const JobHandler& handler);
+
+void submitJob(const std::string& socketPath, const JobRequest& request);
+
+#endif //__MCBLOB_SERVER_H__
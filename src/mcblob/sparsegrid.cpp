@@ -0,0 +1,170 @@
+#include "config.h"
+#include "sparsegrid.h"
+#include "util.h"
+
+#include <stdexcept>
+
+using namespace std;
+
+/**
+  \param gridDim dimension of the whole grid, i.e. number of voxels in each
+  dimension. Each component must be a multiple of tileDim.
+  \param voxelSize size of single voxel
+  \param startPos position of the grid's corner with smallest x, y and z
+  \param context OpenCL context within which this grid will operate
+  \param cq OpenCL command queue used to transfer and clear the data
+  \param memSetKernel kernel used to clear the grid on the device
+  \param format format of data stored for each lattice point
+  \param tileDim number of voxels along each edge of a tile
+  */
+SparseGrid::SparseGrid(
+	uint3 gridDim,
+	float3 voxelSize,
+	float3 startPos,
+	cl::Context& context,
+	cl::CommandQueue& cq,
+	cl::Kernel& memSetKernel,
+	Grid::Format format,
+	cl_uint tileDim
+) :
+	mContext{context},
+	mCommandQueue{cq},
+	mMemSetKernel{memSetKernel},
+	mGridDim{gridDim},
+	mVoxelSize{voxelSize},
+	mStartPos{startPos},
+	mTileDim{tileDim},
+	mFormat{format}
+{
+	if(tileDim == 0 ||
+	   gridDim.x % tileDim != 0 ||
+	   gridDim.y % tileDim != 0 ||
+	   gridDim.z % tileDim != 0) {
+		throw runtime_error("SparseGrid: grid size is not a multiple of tile size");
+	}
+}
+
+/**
+  \return number of tiles in each dimension of the whole grid
+  */
+uint3
+SparseGrid::getTileGridSize() const
+{
+	return uint3(
+		mGridDim.x / mTileDim,
+		mGridDim.y / mTileDim,
+		mGridDim.z / mTileDim
+	);
+}
+
+cl_uint
+SparseGrid::getVoxelsPerTile() const
+{
+	return mTileDim * mTileDim * mTileDim;
+}
+
+cl_uint
+SparseGrid::getPointsPerTile() const
+{
+	return (mTileDim + 1) * (mTileDim + 1) * (mTileDim + 1);
+}
+
+/**
+  \return number of voxels in all allocated tiles
+  */
+cl_uint
+SparseGrid::getVoxelCount() const
+{
+	return mTiles.size() * getVoxelsPerTile();
+}
+
+/**
+  \return number of lattice points kept in all allocated tiles
+  */
+cl_uint
+SparseGrid::getPointCount() const
+{
+	return mTiles.size() * getPointsPerTile();
+}
+
+/**
+  \return size in bytes of data of all tiles, rounded up to whole 32-bit
+  words so it can be cleared with memSet kernel.
+  */
+size_t
+SparseGrid::getDataSize() const
+{
+	size_t size = getPointCount() * Grid::getElementSize(mFormat);
+	return (size + sizeof(cl_uint) - 1) / sizeof(cl_uint) * sizeof(cl_uint);
+}
+
+/**
+  \brief Set tiles kept by this grid.
+
+  Values of previously kept tiles are lost, values of new tiles are
+  undefined until clear() is called. Device buffers are reused if the number
+  of tiles doesn't change, so the grid can be cheaply moved between batches
+  of tiles of equal size.
+
+  \param tiles positions of tiles (in tile units, i.e. voxel position divided
+  by getTileDim()) that will be allocated
+  */
+void
+SparseGrid::setTiles(const vector<uint3>& tiles)
+{
+	uint3 tileGridSize = getTileGridSize();
+	for(const uint3& t : tiles) {
+		if(t.x >= tileGridSize.x ||
+		   t.y >= tileGridSize.y ||
+		   t.z >= tileGridSize.z) {
+			throw runtime_error("SparseGrid::setTiles: tile out of grid bounds");
+		}
+	}
+	bool sameCount = !mTiles.empty() && mTiles.size() == tiles.size();
+	mTiles = tiles;
+	if(mTiles.empty()) {
+		mTilesBuffer = cl::Buffer();
+		mValuesBuffer = cl::Buffer();
+		return;
+	}
+	if(sameCount) {
+		mCommandQueue.enqueueWriteBuffer(
+			mTilesBuffer,
+			CL_TRUE,
+			0,
+			mTiles.size() * sizeof(uint3),
+			mTiles.data()
+		);
+		return;
+	}
+
+	mTilesBuffer = cl::Buffer(
+		mContext,
+		CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+		mTiles.size() * sizeof(uint3),
+		mTiles.data()
+	);
+	mValuesBuffer = cl::Buffer(mContext, CL_MEM_READ_WRITE, getDataSize());
+}
+
+/**
+  \brief clear data of all tiles to specified value
+
+  \param val value to which all data in grid will be set
+  */
+void
+SparseGrid::clear(float val)
+{
+	if(mTiles.empty()) {
+		return;
+	}
+	unsigned int i = 0;
+	mMemSetKernel.setArg(i++, Grid::getClearPattern(mFormat, val));
+	mMemSetKernel.setArg(i++, mValuesBuffer);
+
+	run1DKernelSingleQueue(
+		mMemSetKernel,
+		mCommandQueue,
+		getDataSize() / sizeof(cl_uint)
+	);
+}
@@ -0,0 +1,83 @@
+#ifndef __MCBLOB_SPARSEGRID_H__
+#define __MCBLOB_SPARSEGRID_H__
+
+#include <vector>
+
+#include "common/mathtypes.h"
+#include "grid.h"
+
+/**
+  \brief Sparse, narrow-band storage for 3D grid of values.
+
+  Grid of gridDim voxels is divided into cubic tiles of tileDim voxels along
+  each edge. Only tiles set with setTiles() are allocated, so memory and work
+  needed to fill and polygonize the grid scale with the area of the surface
+  rather than with the volume of the domain. Tiles that may contain the
+  surface are found with Blob::findActiveTiles().
+
+  Every tile keeps its own (tileDim+1)^3 lattice points in the same format as
+  Grid does (see Grid::Format). Tiles are stored one after another in the
+  order of getTiles(). Lattice points on faces shared by two tiles are kept
+  in both of them.
+
+  Unlike Grid, data is kept only on the device.
+  */
+class SparseGrid
+{
+protected:
+	cl::Context mContext;
+	cl::CommandQueue mCommandQueue;
+	cl::Kernel mMemSetKernel;
+
+	std::vector<uint3> mTiles; /**< Positions of allocated tiles, in tiles */
+	cl::Buffer mTilesBuffer;
+	cl::Buffer mValuesBuffer;
+
+	uint3 mGridDim; /**< Size of the whole grid in voxels */
+	float3 mVoxelSize;
+	float3 mStartPos;
+	cl_uint mTileDim;
+	Grid::Format mFormat;
+
+	size_t getDataSize() const;
+public:
+	SparseGrid(
+		uint3 gridDim,
+		float3 voxelSize,
+		float3 startPos,
+		cl::Context& context,
+		cl::CommandQueue& cq,
+		cl::Kernel& memSetKernel,
+		Grid::Format format = Grid::Format::SCALAR,
+		cl_uint tileDim = 8
+	);
+	//Make grid noncopyable
+	SparseGrid(const SparseGrid& other) = delete;
+	SparseGrid& operator=(const SparseGrid& other) = delete;
+	virtual ~SparseGrid() {}
+
+	uint3 getGridSize() const { return mGridDim; }
+	float3 getStartPos() const { return mStartPos; }
+	float3 getVoxelSize() const { return mVoxelSize; }
+	void setStartPos(const float3& pos) { mStartPos = pos; }
+	Grid::Format getFormat() const { return mFormat; }
+
+	cl_uint getTileDim() const { return mTileDim; }
+	uint3 getTileGridSize() const;
+
+	void setTiles(const std::vector<uint3>& tiles);
+	const std::vector<uint3>& getTiles() const { return mTiles; }
+	size_t getTileCount() const { return mTiles.size(); }
+
+	cl_uint getVoxelsPerTile() const;
+	cl_uint getPointsPerTile() const;
+	cl_uint getVoxelCount() const;
+	cl_uint getPointCount() const;
+
+	cl::Buffer getTilesBuffer() const { return mTilesBuffer; }
+	cl::Buffer getValuesBuffer() const { return mValuesBuffer; }
+
+	void clear(float val=0.0f);
+};
+
+#endif // __MCBLOB_SPARSEGRID_H__
@@ -0,0 +1,180 @@
+#include "config.h"
+
+#include "util.h"
+#include "grid.h"
+#include "scan.h"
+#include "surfacenets.h"
+
+#include <memory>
+
+using namespace std;
+
+//path of the cl source
+static const string sPath = "kernels/surfacenets.cl";
+
+//Kernel functions names
+static const char sClassifyCellsFunc[] = "classifyCells";
+static const char sGenerateVerticesFunc[] = "generateVertices";
+static const char sCountQuadsFunc[] = "countQuads";
+static const char sGenerateQuadsFunc[] = "generateQuads";
+
+//Constants
+static const int SURFACE_NETS_THREADS_PER_WG = 128;
+
+/**
+  \param scan pointer to object storing initialized scan program object
+*/
+SurfaceNets::SurfaceNets(
+	const cl::Context& ctx,
+	const vector<cl::CommandQueue>& queues,
+	Scan *scan) : AbstractProgram(sPath, ctx, queues), mScanOp(scan)
+{
+	mClassifyCellsKernel = cl::Kernel(mProgram, sClassifyCellsFunc);
+	mGenerateVerticesKernel = cl::Kernel(mProgram, sGenerateVerticesFunc);
+	mCountQuadsKernel = cl::Kernel(mProgram, sCountQuadsFunc);
+	mGenerateQuadsKernel = cl::Kernel(mProgram, sGenerateQuadsFunc);
+}
+
+/**
+  This function computes indexed triangle mesh from scalar field described
+  by grid.
+  
+  \param grid scalar field which describes isosurface
+  \param isoValue value that will be treated as a frontier of the
+  surface
+  \param dualContouring if true, vertices are placed with dual contouring
+  instead of naive surface nets
+  \param apron number of lattice layers at the start of each axis for which
+  quads of edges along that axis are not generated. If blocks are computed
+  with grids starting one voxel before the block (and apron set to 1), every
+  quad between blocks is generated exactly once.
+  \return mesh with vertices, normals and indices
+*/
+MCMesh SurfaceNets::compute(
+	Grid &grid,
+	float isoValue,
+	bool dualContouring,
+	unsigned int apron)
+{
+	MCMesh ret;
+	grid.copyToDevice();
+	uint3 gridSize = grid.getGridSize();
+	unsigned int numCells = grid.getVoxelCount();
+	unsigned int numPoints =
+		(gridSize.x + 1) * (gridSize.y + 1) * (gridSize.z + 1);
+	
+	//Finding voxels crossed by the surface
+	cl::Buffer cellActive = cl::Buffer(
+		mContext, CL_MEM_READ_WRITE, sizeof(cl_uint) * numCells);
+	unsigned int i = 0;
+	mClassifyCellsKernel.setArg(i++, grid.getValuesBuffer());
+	mClassifyCellsKernel.setArg(i++, grid.getFormat());
+	mClassifyCellsKernel.setArg(i++, grid.getLayout());
+	mClassifyCellsKernel.setArg(i++, cellActive);
+	mClassifyCellsKernel.setArg(i++, gridSize);
+	mClassifyCellsKernel.setArg(i++, isoValue);
+	mClassifyCellsKernel.setArg(i++, numCells);
+	run1DKernelSingleQueue(
+		mClassifyCellsKernel,
+		mFirstQueue,
+		numCells,
+		SURFACE_NETS_THREADS_PER_WG
+	);
+	
+	cl::Buffer cellScan = cl::Buffer(
+		mContext, CL_MEM_READ_WRITE, sizeof(cl_uint) * numCells);
+	mScanOp->compute(cellActive, cellScan, numCells);
+	unsigned int totalVerts = readScanTotal(mFirstQueue, cellActive, cellScan, numCells);
+	if(totalVerts == 0) {
+		return ret;
+	}
+	
+	//One vertex per active voxel
+	cl::Buffer verts = cl::Buffer(
+		mContext, CL_MEM_WRITE_ONLY, sizeof(cl_float4) * totalVerts);
+	cl::Buffer normals = cl::Buffer(
+		mContext, CL_MEM_WRITE_ONLY, sizeof(cl_float4) * totalVerts);
+	i = 0;
+	mGenerateVerticesKernel.setArg(i++, verts);
+	mGenerateVerticesKernel.setArg(i++, normals);
+	mGenerateVerticesKernel.setArg(i++, grid.getValuesBuffer());
+	mGenerateVerticesKernel.setArg(i++, grid.getFormat());
+	mGenerateVerticesKernel.setArg(i++, grid.getLayout());
+	mGenerateVerticesKernel.setArg(i++, cellActive);
+	mGenerateVerticesKernel.setArg(i++, cellScan);
+	mGenerateVerticesKernel.setArg(i++, gridSize);
+	mGenerateVerticesKernel.setArg(i++, grid.getVoxelSize());
+	mGenerateVerticesKernel.setArg(i++, grid.getStartPos());
+	mGenerateVerticesKernel.setArg(i++, isoValue);
+	mGenerateVerticesKernel.setArg(i++, (cl_uint) dualContouring);
+	mGenerateVerticesKernel.setArg(i++, numCells);
+	run1DKernelSingleQueue(
+		mGenerateVerticesKernel,
+		mFirstQueue,
+		numCells,
+		SURFACE_NETS_THREADS_PER_WG
+	);
+	
+	//Quads for crossed lattice edges
+	cl::Buffer quadCount = cl::Buffer(
+		mContext, CL_MEM_READ_WRITE, sizeof(cl_uint) * numPoints);
+	i = 0;
+	mCountQuadsKernel.setArg(i++, grid.getValuesBuffer());
+	mCountQuadsKernel.setArg(i++, grid.getFormat());
+	mCountQuadsKernel.setArg(i++, grid.getLayout());
+	mCountQuadsKernel.setArg(i++, quadCount);
+	mCountQuadsKernel.setArg(i++, gridSize);
+	mCountQuadsKernel.setArg(i++, isoValue);
+	mCountQuadsKernel.setArg(i++, (cl_uint) apron);
+	mCountQuadsKernel.setArg(i++, numPoints);
+	run1DKernelSingleQueue(
+		mCountQuadsKernel,
+		mFirstQueue,
+		numPoints,
+		SURFACE_NETS_THREADS_PER_WG
+	);
+	
+	cl::Buffer quadScan = cl::Buffer(
+		mContext, CL_MEM_READ_WRITE, sizeof(cl_uint) * numPoints);
+	mScanOp->compute(quadCount, quadScan, numPoints);
+	unsigned int totalQuads = readScanTotal(mFirstQueue, quadCount, quadScan, numPoints);
+	
+	unsigned int totalIndices = totalQuads * 6;
+	cl::Buffer indices;
+	if(totalIndices > 0) {
+		indices = cl::Buffer(
+			mContext, CL_MEM_WRITE_ONLY, sizeof(cl_uint) * totalIndices);
+		i = 0;
+		mGenerateQuadsKernel.setArg(i++, indices);
+		mGenerateQuadsKernel.setArg(i++, grid.getValuesBuffer());
+		mGenerateQuadsKernel.setArg(i++, grid.getFormat());
+		mGenerateQuadsKernel.setArg(i++, grid.getLayout());
+		mGenerateQuadsKernel.setArg(i++, cellScan);
+		mGenerateQuadsKernel.setArg(i++, quadScan);
+		mGenerateQuadsKernel.setArg(i++, gridSize);
+		mGenerateQuadsKernel.setArg(i++, isoValue);
+		mGenerateQuadsKernel.setArg(i++, (cl_uint) apron);
+		mGenerateQuadsKernel.setArg(i++, numPoints);
+		run1DKernelSingleQueue(
+			mGenerateQuadsKernel,
+			mFirstQueue,
+			numPoints,
+			SURFACE_NETS_THREADS_PER_WG
+		);
+	}
+	
+	unique_ptr<float3[]> hVertices{new float3[totalVerts]};
+	unique_ptr<float3[]> hNormals{new float3[totalVerts]};
+	mFirstQueue.enqueueReadBuffer(verts, CL_TRUE, 0, sizeof(float3) * totalVerts, hVertices.get());
+	mFirstQueue.enqueueReadBuffer(normals, CL_TRUE, 0, sizeof(float3) * totalVerts, hNormals.get());
+	ret.verts.assign(hVertices.get(), hVertices.get() + totalVerts);
+	ret.normals.assign(hNormals.get(), hNormals.get() + totalVerts);
+	
+	if(totalIndices > 0) {
+		ret.indices.resize(totalIndices);
+		mFirstQueue.enqueueReadBuffer(
+			indices, CL_TRUE, 0, sizeof(cl_uint) * totalIndices, ret.indices.data());
+	}
+	
+	return ret;
+}
@@ -0,0 +1,53 @@
+#ifndef __MCBLOB_SURFACENETS_H__
+#define __MCBLOB_SURFACENETS_H__
+
+#include "abstractprogram.h"
+#include "marchingcubes.h"
+#include "common/mathtypes.h"
+
+class Grid;
+class Scan;
+
+/**
+  \brief Surface nets / dual contouring extraction of isosurface.
+  
+  Alternative to MarchingCubes. One vertex is placed in every voxel crossed
+  by the surface and vertices of voxels sharing a crossed lattice edge are
+  joined with a quad (two triangles). Resulting meshes are indexed, have
+  about half of triangles of Marching cubes meshes and no slivers.
+  
+  Vertex is placed in the mass point of surface intersections with voxel
+  edges (naive surface nets) or, with dual contouring enabled, in the point
+  minimizing distance to planes tangent to the surface at these
+  intersections.
+  
+  Quads of the edges on the boundary of the grid can't be generated, so to
+  join neighbouring blocks their grids should overlap by one voxel, see
+  apron parameter of compute().
+  */
+class SurfaceNets : public AbstractProgram
+{
+protected:
+	cl::Kernel mClassifyCellsKernel;
+	cl::Kernel mGenerateVerticesKernel;
+	cl::Kernel mCountQuadsKernel;
+	cl::Kernel mGenerateQuadsKernel;
+	
+	Scan* mScanOp;
+public:
+	SurfaceNets(
+		const cl::Context& ctx,
+		const std::vector<cl::CommandQueue> &queues,
+		Scan* scan
+	);
+	virtual ~SurfaceNets() {}
+	
+	MCMesh compute(
+		Grid& grid,
+		float isoValue,
+		bool dualContouring = false,
+		unsigned int apron = 0
+	);
+};
+
+#endif // __MCBLOB_SURFACENETS_H__
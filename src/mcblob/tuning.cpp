@@ -0,0 +1,346 @@
+#include "config.h"
+#include "tuning.h"
+#include "context.h"
+#include "grid.h"
+#include "blob.h"
+#include "marchingcubes.h"
+#include "util.h"
+
+#include <algorithm>
+#include <cctype>
+#include <climits>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+using namespace std;
+
+static const string TUNING_FILE_PREFIX = "mcblob-";
+static const string TUNING_FILE_SUFFIX = ".tuning";
+
+//Benchmark used by autotune()
+static const unsigned int TUNING_GRID_DIM = 64;
+static const int TUNING_BLOBS = 1000;
+static const unsigned int TUNING_SEED = 1;
+static const unsigned int TUNING_REPETITIONS = 5;
+static const float TUNING_ISO_VALUE = 1.0f;
+
+static const unsigned int TUNING_GROUP_SIZES[] = {32, 64, 128, 256};
+static const unsigned int TUNING_GENERATE_GROUP_SIZES[] = {16, 32, 64, 128};
+static const uint3 TUNING_GROUP_SHAPES[] = {
+	uint3(4, 4, 4), uint3(8, 4, 4), uint3(8, 8, 2), uint3(8, 8, 4),
+	uint3(16, 4, 4), uint3(16, 8, 2), uint3(32, 4, 2), uint3(16, 16, 1)
+};
+
+/**
+  \return name of the file keeping tuning of given device. Name and driver
+  version of the device are part of it, so a driver update needs new
+  tuning. The file is kept in the working directory, like kernel sources.
+  */
+string tuningFileName(const cl::Device& device)
+{
+	string name, driver;
+	device.getInfo(CL_DEVICE_NAME, &name);
+	device.getInfo(CL_DRIVER_VERSION, &driver);
+	string id = name + "-" + driver;
+	//Names may contain spaces, slashes and trailing NULs
+	id.erase(remove(id.begin(), id.end(), '\0'), id.end());
+	for(char& c : id) {
+		if(!isalnum(static_cast<unsigned char>(c)) && c != '.' && c != '-') {
+			c = '_';
+		}
+	}
+	return TUNING_FILE_PREFIX + id + TUNING_FILE_SUFFIX;
+}
+
+/**
+  Reads a work group size from the rest of a tuning file line.
+  \param allowZero accept 0, which selects 1D kernels in x of shapes
+  \throws runtime_error if the value is missing, negative or 0
+  */
+static unsigned int readGroupSize(istream& is, const string& key, bool allowZero = false)
+{
+	long long value;
+	if(!(is >> value) || value < (allowZero ? 0 : 1) || value > UINT_MAX) {
+		throw runtime_error("Invalid value of " + key);
+	}
+	return static_cast<unsigned int>(value);
+}
+
+/**
+  Reads a work group shape from the rest of a tuning file line. Only shapes
+  with x of 0, which select 1D kernels, may have other components 0.
+  */
+static uint3 readGroupShape(istream& is, const string& key)
+{
+	uint3 shape;
+	shape.x = readGroupSize(is, key, true);
+	shape.y = readGroupSize(is, key, shape.x == 0);
+	shape.z = readGroupSize(is, key, shape.x == 0);
+	return shape;
+}
+
+/**
+  Reads tuning saved with saveTuning(). Every line keeps name of a parameter
+  followed by its value. Parameters missing in the file are left unchanged
+  and unknown ones are ignored, so files written by other versions can
+  still be used.
+  \param path path of the tuning file
+  \param tuning parameters to be updated, left unchanged if the file is
+  invalid
+  \return false if the file can't be opened
+  \throws runtime_error if the file has invalid work group size or shape
+  */
+bool loadTuning(const string& path, KernelTuning& tuning)
+{
+	ifstream file(path);
+	if(!file) {
+		return false;
+	}
+	KernelTuning loaded = tuning;
+	string line;
+	while(getline(file, line)) {
+		istringstream is(line);
+		string key;
+		is >> key;
+		try {
+			if(key == "blobGroupSize") {
+				loaded.blobGroupSize = readGroupSize(is, key);
+			} else if(key == "blobGroupShape") {
+				loaded.blobGroupShape = readGroupShape(is, key);
+			} else if(key == "classifyGroupSize") {
+				loaded.classifyGroupSize = readGroupSize(is, key);
+			} else if(key == "classifyGroupShape") {
+				loaded.classifyGroupShape = readGroupShape(is, key);
+			} else if(key == "compactGroupSize") {
+				loaded.compactGroupSize = readGroupSize(is, key);
+			} else if(key == "generateGroupSize") {
+				loaded.generateGroupSize = readGroupSize(is, key);
+			} else if(key == "gridLayout") {
+				string layout;
+				is >> layout;
+				loaded.gridLayout = layout == "bricked" ?
+					Grid::Layout::BRICKED : Grid::Layout::LINEAR;
+			}
+		} catch(runtime_error& e) {
+			throw runtime_error(path + ": " + e.what());
+		}
+	}
+	tuning = loaded;
+	return true;
+}
+
+void saveTuning(const string& path, const KernelTuning& tuning)
+{
+	ofstream file(path);
+	if(!file) {
+		throw runtime_error("Can't write tuning file " + path);
+	}
+	const uint3& b = tuning.blobGroupShape;
+	const uint3& c = tuning.classifyGroupShape;
+	file << "blobGroupSize " << tuning.blobGroupSize << "\n"
+	     << "blobGroupShape " << b.x << " " << b.y << " " << b.z << "\n"
+	     << "classifyGroupSize " << tuning.classifyGroupSize << "\n"
+	     << "classifyGroupShape " << c.x << " " << c.y << " " << c.z << "\n"
+	     << "compactGroupSize " << tuning.compactGroupSize << "\n"
+	     << "generateGroupSize " << tuning.generateGroupSize << "\n"
+	     << "gridLayout "
+	     << (tuning.gridLayout == Grid::Layout::BRICKED ? "bricked" : "linear")
+	     << "\n";
+}
+
+/**
+  Runs op TUNING_REPETITIONS times (after one warm-up run) and measures it
+  with markers enqueued before and after.
+  \return the shortest time in milliseconds
+  */
+static double timeOnDevice(const cl::CommandQueue& queue, const function<void()>& op)
+{
+	op();
+	double best = numeric_limits<double>::max();
+	for(unsigned int i=0; i<TUNING_REPETITIONS; i++) {
+		cl::Event start, end;
+		queue.enqueueMarker(&start);
+		op();
+		queue.enqueueMarker(&end);
+		end.wait();
+		cl_ulong t0 = start.getProfilingInfo<CL_PROFILING_COMMAND_END>();
+		cl_ulong t1 = end.getProfilingInfo<CL_PROFILING_COMMAND_END>();
+		best = min(best, (t1 - t0) * 1e-6);
+	}
+	return best;
+}
+
+static string shapeString(const uint3& shape)
+{
+	ostringstream os;
+	if(shape.x == 0) {
+		os << "1D";
+	} else {
+		os << shape.x << "x" << shape.y << "x" << shape.z;
+	}
+	return os.str();
+}
+
+/**
+  \brief find the fastest launch parameters for the device of ctx
+
+  Every kernel with configurable work groups is timed on a benchmark block
+  with each candidate size (1D kernels) and shape (3D kernels), the other
+  parameters staying at their best values found so far. Layouts of the grid
+  are compared last, on the whole evaluation and extraction of the block.
+  Times are measured with profiling events, so the context must be created
+  with profiling enabled. Progress is printed to log.
+
+  The best parameters found are set in ctx and returned.
+  */
+KernelTuning autotune(Context& ctx, ostream& log)
+{
+	cl::CommandQueue queue = ctx.getQueues()[0];
+	cl_command_queue_properties props;
+	queue.getInfo(CL_QUEUE_PROPERTIES, &props);
+	if(!(props & CL_QUEUE_PROFILING_ENABLE)) {
+		throw runtime_error("Autotuning needs queues with profiling enabled");
+	}
+	Blob* blobProgram = ctx.getBlobProgram();
+	MarchingCubes* mcProgram = ctx.getMcProgram();
+	KernelTuning best = ctx.getTuning();
+
+	//Random blobs inside the unit cube, small enough to give many surface
+	//voxels
+	minstd_rand rng(TUNING_SEED);
+	uniform_real_distribution<float> position(0.1f, 0.9f);
+	uniform_real_distribution<float> diameter(0.05f, 0.15f);
+	vector<float4> blobs(TUNING_BLOBS);
+	for(float4& b : blobs) {
+		b.x = position(rng);
+		b.y = position(rng);
+		b.z = position(rng);
+		b.w = diameter(rng);
+	}
+	uint3 gridDim(TUNING_GRID_DIM, TUNING_GRID_DIM, TUNING_GRID_DIM);
+	float3 voxelSize(1.0f / TUNING_GRID_DIM);
+	float3 startPos(0.0f, 0.0f, 0.0f, 1.0f);
+	Grid grid{gridDim, voxelSize, startPos, ctx.getClContext(), queue,
+	          ctx.getMemsetKernel()};
+	grid.clear();
+
+	//Candidates of the kernels that have both 1D and 3D variants
+	vector<pair<unsigned int, uint3>> candidates;
+	for(unsigned int size : TUNING_GROUP_SIZES) {
+		candidates.push_back(make_pair(size, uint3(0, 0, 0)));
+	}
+	for(const uint3& shape : TUNING_GROUP_SHAPES) {
+		candidates.push_back(make_pair(0u, shape));
+	}
+
+	double bestTime = numeric_limits<double>::max();
+	for(auto& c : candidates) {
+		if(c.first > 0) {
+			blobProgram->setWorkGroupSize(c.first);
+		}
+		blobProgram->setWorkGroupShape(c.second);
+		double t = timeOnDevice(queue, [&]() {
+			blobProgram->runBlob(blobs.data(), blobs.size(), grid);
+		});
+		log << "blobValue " << shapeString(blobProgram->getWorkGroupShape());
+		if(c.first > 0) {
+			log << " " << blobProgram->getWorkGroupSize();
+		}
+		log << ": " << t << " ms" << endl;
+		if(t < bestTime) {
+			bestTime = t;
+			if(c.first > 0) {
+				best.blobGroupSize = blobProgram->getWorkGroupSize();
+			}
+			best.blobGroupShape = blobProgram->getWorkGroupShape();
+		}
+	}
+	ctx.setTuning(best);
+
+	grid.clear();
+	blobProgram->runBlob(blobs.data(), blobs.size(), grid);
+	size_t bufferSize = sizeof(cl_uint) * gridDim.x * gridDim.y * gridDim.z;
+	cl::Buffer voxelVerts(ctx.getClContext(), CL_MEM_READ_WRITE, bufferSize);
+	cl::Buffer voxelOccupied(ctx.getClContext(), CL_MEM_READ_WRITE, bufferSize);
+	bestTime = numeric_limits<double>::max();
+	for(auto& c : candidates) {
+		mcProgram->setWorkGroupShape(c.second);
+		if(c.first > 0) {
+			mcProgram->setWorkGroupSizes(c.first, best.compactGroupSize,
+			                             best.generateGroupSize);
+		}
+		double t = timeOnDevice(queue, [&]() {
+			mcProgram->launchClassifyVoxel(grid, voxelVerts, voxelOccupied,
+			                               TUNING_ISO_VALUE);
+		});
+		log << "classifyVoxel " << shapeString(mcProgram->getWorkGroupShape());
+		if(c.first > 0) {
+			log << " " << mcProgram->getClassifyWorkGroupSize();
+		}
+		log << ": " << t << " ms" << endl;
+		if(t < bestTime) {
+			bestTime = t;
+			if(c.first > 0) {
+				best.classifyGroupSize = mcProgram->getClassifyWorkGroupSize();
+			}
+			best.classifyGroupShape = mcProgram->getWorkGroupShape();
+		}
+	}
+	ctx.setTuning(best);
+
+	//Compaction and triangle generation depend on number of active voxels
+	//found by the previous stages, so whole extraction is timed
+	auto extract = [&]() { mcProgram->compute(grid, TUNING_ISO_VALUE); };
+	bestTime = numeric_limits<double>::max();
+	for(unsigned int size : TUNING_GROUP_SIZES) {
+		mcProgram->setWorkGroupSizes(best.classifyGroupSize, size,
+		                             best.generateGroupSize);
+		double t = timeOnDevice(queue, extract);
+		log << "compactVoxels " << mcProgram->getCompactWorkGroupSize()
+		    << ": " << t << " ms" << endl;
+		if(t < bestTime) {
+			bestTime = t;
+			best.compactGroupSize = mcProgram->getCompactWorkGroupSize();
+		}
+	}
+	bestTime = numeric_limits<double>::max();
+	for(unsigned int size : TUNING_GENERATE_GROUP_SIZES) {
+		mcProgram->setWorkGroupSizes(best.classifyGroupSize,
+		                             best.compactGroupSize, size);
+		double t = timeOnDevice(queue, extract);
+		log << "generateTriangles " << mcProgram->getGenerateWorkGroupSize()
+		    << ": " << t << " ms" << endl;
+		if(t < bestTime) {
+			bestTime = t;
+			best.generateGroupSize = mcProgram->getGenerateWorkGroupSize();
+		}
+	}
+	ctx.setTuning(best);
+
+	bestTime = numeric_limits<double>::max();
+	for(Grid::Layout layout : {Grid::Layout::LINEAR, Grid::Layout::BRICKED}) {
+		Grid layoutGrid{gridDim, voxelSize, startPos, ctx.getClContext(),
+		                queue, ctx.getMemsetKernel(),
+		                Grid::Format::GRADIENT, layout};
+		layoutGrid.copyToDevice();
+		double t = timeOnDevice(queue, [&]() {
+			layoutGrid.clear();
+			blobProgram->runBlob(blobs.data(), blobs.size(), layoutGrid);
+			mcProgram->compute(layoutGrid, TUNING_ISO_VALUE);
+		});
+		log << "layout "
+		    << (layout == Grid::Layout::BRICKED ? "bricked" : "linear")
+		    << ": " << t << " ms" << endl;
+		if(t < bestTime) {
+			bestTime = t;
+			best.gridLayout = layout;
+		}
+	}
+	ctx.setTuning(best);
+	return best;
+}
@@ -0,0 +1,38 @@
+#ifndef __MCBLOB_TUNING_H__
+#define __MCBLOB_TUNING_H__
+
+#include <iosfwd>
+#include <string>
+
+#include "common/mathtypes.h"
+#include "grid.h"
+
+class Context;
+
+/**
+  \brief Launch parameters of kernels chosen for one device.
+
+  Work group sizes of 1D kernels and shapes of 3D ones (x of 0 selects 1D
+  variant, see Blob::setWorkGroupShape()), and the grid layout that is used
+  when none is requested. Found by autotune() and kept in a file per device,
+  which Context loads on start.
+  */
+struct KernelTuning {
+	unsigned int blobGroupSize;      /**< 1D blob kernels */
+	uint3 blobGroupShape;            /**< blobValue3D */
+	unsigned int classifyGroupSize;  /**< classifyVoxel */
+	uint3 classifyGroupShape;        /**< classifyVoxel3D */
+	unsigned int compactGroupSize;   /**< compactVoxels */
+	unsigned int generateGroupSize;  /**< generateTriangles */
+	Grid::Layout gridLayout;
+};
+
+std::string tuningFileName(const cl::Device& device);
+
+bool loadTuning(const std::string& path, KernelTuning& tuning);
+
+void saveTuning(const std::string& path, const KernelTuning& tuning);
+
+KernelTuning autotune(Context& ctx, std::ostream& log);
+
+#endif //__MCBLOB_TUNING_H__
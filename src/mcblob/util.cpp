@@ -1,7 +1,11 @@
 #include "config.h"
 #include "util.h"
+#include <algorithm>
 #include <fstream>
+#include <map>
+#include <mutex>
 #include <sstream>
+#include <cstring>
 
 using namespace std;
 
@@ -111,7 +115,9 @@ readSource(const string& filename)
 }
 
 /**
-  This function builds program with source from provided file
+  This function builds program with source from provided file. Directory
+  containing the file is added to the include path of the compiler, so
+  programs can include shared helpers (e.g. kernels/grid.cl).
   \param path path to file containing the source code of the program
   \return built OpenCL program object
   \throws BuildError object is thrown if
@@ -120,8 +126,14 @@ cl::Program buildProgram(const std::string& path, const cl::Context& context)
 {
 	string source = readSource(path);
 	cl::Program program (context, source);
+	
+	string options;
+	size_t dirEnd = path.find_last_of('/');
+	if(dirEnd != string::npos) {
+		options = "-I " + path.substr(0, dirEnd);
+	}
 	try {
-		program.build();
+		program.build(options.c_str());
 	} catch (cl::Error& e) {
 		if(e.err() == CL_BUILD_PROGRAM_FAILURE ) {
 			throw BuildError(path, buildLog(program));
@@ -177,6 +189,91 @@ string buildLog(const cl::Program& program)
 	return os.str();
 }
 
+/**
+  Converts single precision float to IEEE 754 half precision float with
+  rounding to nearest even, the same way vstore_half does on the device.
+  \param value value to be converted
+  \return bit pattern of half precision value
+  */
+cl_half floatToHalf(float value)
+{
+	cl_uint bits;
+	memcpy(&bits, &value, sizeof(bits));
+	
+	cl_uint sign = (bits >> 16) & 0x8000;
+	int exponent = static_cast<int>((bits >> 23) & 0xff) - 127 + 15;
+	cl_uint mantissa = bits & 0x7fffff;
+	
+	if(((bits >> 23) & 0xff) == 0xff) {
+		//Inf or NaN
+		return sign | 0x7c00 | (mantissa ? 0x200 : 0);
+	}
+	if(exponent >= 0x1f) {
+		//Overflow to infinity
+		return sign | 0x7c00;
+	}
+	if(exponent <= 0) {
+		if(exponent < -10) {
+			//Too small even for denormal half
+			return sign;
+		}
+		//Denormal half
+		mantissa |= 0x800000;
+		cl_uint shift = 14 - exponent;
+		cl_uint half = mantissa >> shift;
+		cl_uint rest = mantissa & ((1u << shift) - 1);
+		cl_uint halfway = 1u << (shift - 1);
+		if(rest > halfway || (rest == halfway && (half & 1))) {
+			half++;
+		}
+		return sign | half;
+	}
+	
+	cl_uint half = sign | (exponent << 10) | (mantissa >> 13);
+	cl_uint rest = mantissa & 0x1fff;
+	if(rest > 0x1000 || (rest == 0x1000 && (half & 1))) {
+		//Carry may overflow into exponent which is still correct rounding
+		half++;
+	}
+	return half;
+}
+
+/**
+  Converts IEEE 754 half precision float to single precision float.
+  \param value bit pattern of half precision value
+  \return converted value
+  */
+float halfToFloat(cl_half value)
+{
+	cl_uint sign = (value & 0x8000) << 16;
+	cl_uint exponent = (value >> 10) & 0x1f;
+	cl_uint mantissa = value & 0x3ff;
+	cl_uint bits;
+	
+	if(exponent == 0x1f) {
+		bits = sign | 0x7f800000 | (mantissa << 13);
+	} else if(exponent == 0) {
+		if(mantissa == 0) {
+			bits = sign;
+		} else {
+			//Normalizing denormal half
+			exponent = 127 - 15 + 1;
+			while((mantissa & 0x400) == 0) {
+				mantissa <<= 1;
+				exponent--;
+			}
+			mantissa &= 0x3ff;
+			bits = sign | (exponent << 23) | (mantissa << 13);
+		}
+	} else {
+		bits = sign | ((exponent - 15 + 127) << 23) | (mantissa << 13);
+	}
+	
+	float ret;
+	memcpy(&ret, &bits, sizeof(ret));
+	return ret;
+}
+
 /**
   This function return smallest integer larger or equal to globalSize
   that is divisible by localSize. If globalSize % localSize equals 0 then
@@ -200,9 +297,155 @@ static size_t roundUp(int localSize, int globalSize)
 	}
 }
 
+/** Weight of the newest measurement in throughput estimates */
+static const double THROUGHPUT_SMOOTHING = 0.5;
+
+/**
+  Throughput of a device running a kernel. Until the device has a measured
+  dispatch, only estimate from its compute units and clock is known, which
+  is in different units, so it can be compared only with other estimates.
+  */
+struct Throughput {
+	double estimate;
+	double measured; /**< work items per nanosecond */
+	bool hasMeasurement;
+};
+
+/** Kernel and device whose throughput is known */
+typedef pair<cl_kernel, cl_device_id> ThroughputKey;
+
+/**
+  Throughput of each device running each kernel, grouped by context of the
+  kernel. Used to split work among queues in run1DKernelMultipleQueues().
+  Entries of a context are dropped by forgetThroughput() before its kernels
+  are released, so handles reused by the runtime don't inherit them.
+  */
+static map<cl_context, map<ThroughputKey, Throughput>> sThroughput;
+
+/** Dispatches on profiled queues whose time isn't yet known */
+struct PendingDispatch {
+	cl::Event event;
+	cl_context context;
+	ThroughputKey key;
+	unsigned int items;
+};
+static vector<PendingDispatch> sPendingDispatches;
+static mutex sThroughputMutex;
+
+/**
+  Throughput estimate of a device, used before any of its dispatches is
+  measured: number of compute units times their clock.
+  */
+static double estimateThroughput(const cl::Device& device)
+{
+	cl_uint units, clock;
+	device.getInfo(CL_DEVICE_MAX_COMPUTE_UNITS, &units);
+	device.getInfo(CL_DEVICE_MAX_CLOCK_FREQUENCY, &clock);
+	return max(1.0, static_cast<double>(units) * clock);
+}
+
+/**
+  Updates measured throughput with times of completed dispatches. Must be
+  called with sThroughputMutex locked.
+  */
+static void refineThroughput()
+{
+	auto done = remove_if(
+		sPendingDispatches.begin(),
+		sPendingDispatches.end(),
+		[](PendingDispatch& d) {
+			cl_int status;
+			d.event.getInfo(CL_EVENT_COMMAND_EXECUTION_STATUS, &status);
+			if(status < 0) {
+				//failed dispatch, nothing to learn from it
+				return true;
+			}
+			if(status != CL_COMPLETE) {
+				return false;
+			}
+			cl_ulong start = d.event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+			cl_ulong end = d.event.getProfilingInfo<CL_PROFILING_COMMAND_END>();
+			if(end > start) {
+				double measured = static_cast<double>(d.items) / (end - start);
+				Throughput& t = sThroughput[d.context][d.key];
+				t.measured = t.hasMeasurement ?
+					(1.0 - THROUGHPUT_SMOOTHING) * t.measured +
+					THROUGHPUT_SMOOTHING * measured :
+					measured;
+				t.hasMeasurement = true;
+			}
+			return true;
+		}
+	);
+	sPendingDispatches.erase(done, sPendingDispatches.end());
+}
+
+/**
+  Drops throughput measured for kernels of a context, together with its
+  dispatches not yet accounted for. Must be called before the kernels
+  of the context are released.
+  
+  \param context context whose kernels are going to be released
+  */
+void forgetThroughput(const cl::Context& context)
+{
+	lock_guard<mutex> lock(sThroughputMutex);
+	sThroughput.erase(context());
+	auto forgotten = remove_if(
+		sPendingDispatches.begin(),
+		sPendingDispatches.end(),
+		[&context](const PendingDispatch& d) {
+			return d.context == context();
+		}
+	);
+	sPendingDispatches.erase(forgotten, sPendingDispatches.end());
+}
+
+/**
+  Splits globalSize work items into parts proportional to weights. Every
+  part except the last one is a multiple of localSize, so parts enqueued
+  one after another don't overlap when rounded up to whole work groups.
+  
+  \param globalSize number of work items to split
+  \param localSize size of work group, 0 if not set
+  \param weights relative speed of each part, must be positive
+  \return number of work items of each part, some may be 0
+  */
+vector<unsigned int> splitWork(
+	unsigned int globalSize,
+	unsigned int localSize,
+	const vector<double>& weights)
+{
+	vector<unsigned int> sizes(weights.size(), 0);
+	if(weights.empty()) {
+		return sizes;
+	}
+	double total = 0.0;
+	for(double w : weights) {
+		total += w;
+	}
+	unsigned int unit = max(localSize, 1u);
+	unsigned int assigned = 0;
+	for(size_t i=0; i+1 < weights.size(); i++) {
+		unsigned int size = static_cast<unsigned int>(
+			globalSize * (weights[i] / total)) / unit * unit;
+		size = min(size, globalSize - assigned);
+		sizes[i] = size;
+		assigned += size;
+	}
+	sizes.back() = globalSize - assigned;
+	return sizes;
+}
+
 /**
-  This function runs 1D kernel by splitting the workload evenly on all provided
+  This function runs 1D kernel by splitting the workload among all provided
   command queues. All command queues must be in the same context.
+  
+  Each queue gets part of the work proportional to throughput of its device
+  running this kernel, so all of them finish at about the same time. The
+  throughput is estimated from device's compute units and clock at first
+  and, for queues created with CL_QUEUE_PROFILING_ENABLE, refined with
+  times of the previous dispatches of the kernel.
   \warning Pass only kernels that are fully initialized ant their parameters are
   properly set, and valid (e.g. respective data is copied to the context etc.)
   
@@ -224,20 +467,56 @@ void run1DKernelMultipleQueues(
 	bool synchronous,
 	const std::vector<cl::Event>* events)
 {
-	unsigned int devSize = globalSize / queues.size();
+	vector<unsigned int> sizes(1, globalSize);
+	vector<cl_device_id> devices(queues.size());
+	vector<bool> profiled(queues.size(), false);
+	cl_context context = NULL;
+	if(queues.size() > 1) {
+		cl::Context queueContext;
+		queues[0].getInfo(CL_QUEUE_CONTEXT, &queueContext);
+		context = queueContext();
+		lock_guard<mutex> lock(sThroughputMutex);
+		refineThroughput();
+		map<ThroughputKey, Throughput>& known = sThroughput[context];
+		vector<double> estimated, measured;
+		for(size_t i=0; i < queues.size(); i++) {
+			cl::Device dev;
+			queues[i].getInfo(CL_QUEUE_DEVICE, &dev);
+			cl_command_queue_properties props;
+			queues[i].getInfo(CL_QUEUE_PROPERTIES, &props);
+			devices[i] = dev();
+			profiled[i] = (props & CL_QUEUE_PROFILING_ENABLE) != 0;
+			auto key = make_pair(kernel(), dev());
+			auto entry = known.find(key);
+			if(entry == known.end()) {
+				entry = known.insert(make_pair(
+					key, Throughput{estimateThroughput(dev), 0.0, false})).first;
+			}
+			estimated.push_back(entry->second.estimate);
+			if(entry->second.hasMeasurement) {
+				measured.push_back(entry->second.measured);
+			}
+		}
+		//Measurements are used only when every device has one
+		sizes = splitWork(
+			globalSize,
+			localSize,
+			measured.size() == queues.size() ? measured : estimated
+		);
+	}
+	
 	vector<cl::Event> waitEvents;
-	for(int i=0; i < queues.size(); i++) {
+	unsigned int offset = 0;
+	for(size_t i=0; i < sizes.size(); i++) {
+		unsigned int devSize = sizes[i];
+		if(devSize == 0) {
+			continue;
+		}
 		const cl::CommandQueue& queue = queues[i];
 		cl::Event event;
-		
-		//Check if it's last queue. It may have more work if globalSize
-		//was not evenly divisable by number of queues
-		if(i == (queues.size() - 1) ){
-			devSize = globalSize - (devSize * i);
-		}
 		queue.enqueueNDRangeKernel(
 			kernel,
-			cl::NDRange(devSize * i),
+			cl::NDRange(offset),
 			cl::NDRange(
 				localSize > 0 ? //is localSize user-defined ?
 					roundUp(localSize,devSize) :
@@ -248,6 +527,12 @@ void run1DKernelMultipleQueues(
 			&event
 		);
 		waitEvents.push_back(event);
+		if(profiled[i]) {
+			lock_guard<mutex> lock(sThroughputMutex);
+			sPendingDispatches.push_back(PendingDispatch{
+				event, context, make_pair(kernel(), devices[i]), devSize});
+		}
+		offset += devSize;
 	}
 	if(synchronous) {
 		cl::Event::waitForEvents(waitEvents);
@@ -286,3 +571,118 @@ void run1DKernelSingleQueue(
 		events
 	);
 }
+
+/**
+  \return true if device of queue shares memory with the host (e.g. it's
+  a CPU or an integrated GPU), so buffers created with CL_MEM_USE_HOST_PTR
+  can be mapped instead of copied
+  */
+bool hasUnifiedMemory(const cl::CommandQueue& queue)
+{
+	cl::Device dev;
+	queue.getInfo(CL_QUEUE_DEVICE, &dev);
+	cl_bool unified = CL_FALSE;
+	dev.getInfo(CL_DEVICE_HOST_UNIFIED_MEMORY, &unified);
+	return unified == CL_TRUE;
+}
+
+/**
+  Run 3D kernel on single command queue. Global size is rounded up to whole
+  work groups in every dimension, so the kernel must check bounds itself.
+  \warning Pass only kernels that are fully initialized ant their parameters are
+  properly set, and valid (e.g. respective data is copied to the context etc.)
+  
+  \param kernel A 3D kernel to be executed
+  \param queue command queue, on which the kernel will be queued
+  \param globalSize size of the work to be done in x, y and z
+  \param localShape shape of the single work group. If any of its
+         dimensions is 0 then cl::NullRange will be used
+  \param synchronous if true, function will not return until all work has been
+         done
+  \param event list of events that will be completed before anything will be
+         enqueued
+  */
+void run3DKernel(
+	const cl::Kernel &kernel,
+	const cl::CommandQueue &queue,
+	const uint3& globalSize,
+	const uint3& localShape,
+	bool synchronous,
+	const vector<cl::Event> *events)
+{
+	bool localSet = localShape.x > 0 && localShape.y > 0 && localShape.z > 0;
+	cl::Event event;
+	queue.enqueueNDRangeKernel(
+		kernel,
+		cl::NullRange,
+		localSet ?
+			cl::NDRange(
+				roundUp(localShape.x, globalSize.x),
+				roundUp(localShape.y, globalSize.y),
+				roundUp(localShape.z, globalSize.z)
+			) :
+			cl::NDRange(globalSize.x, globalSize.y, globalSize.z),
+		localSet ?
+			cl::NDRange(localShape.x, localShape.y, localShape.z) :
+			cl::NullRange,
+		events,
+		&event
+	);
+	if(synchronous) {
+		event.wait();
+	}
+}
+
+/**
+  Shrinks work group shape until it has at most maxSize work items, halving
+  the longest dimension first.
+  \param shape requested shape of the work group
+  \param maxSize maximal number of work items in a group, e.g.
+         CL_KERNEL_WORK_GROUP_SIZE of the kernel
+  \return shape that fits
+  */
+uint3 fitWorkGroupShape(uint3 shape, size_t maxSize)
+{
+	while(shape.x * shape.y * shape.z > maxSize) {
+		unsigned int& longest =
+			shape.x >= shape.y && shape.x >= shape.z ? shape.x :
+			(shape.y >= shape.z ? shape.y : shape.z);
+		if(longest <= 1) {
+			break;
+		}
+		longest /= 2;
+	}
+	return shape;
+}
+
+/**
+  Reads total sum of n-element array from its exclusive scan, i.e. sum of the
+  last element of the array and the last element of the scan.
+  \param queue queue used to read the data
+  \param values array that was scanned
+  \param scanned result of exclusive scan of values
+  \param n number of elements in values
+  */
+cl_uint readScanTotal(
+	const cl::CommandQueue& queue,
+	cl::Buffer values,
+	cl::Buffer scanned,
+	unsigned int n)
+{
+	cl_uint lastElement, lastScanElement;
+	queue.enqueueReadBuffer(
+		values,
+		CL_TRUE,
+		(n - 1) * sizeof(cl_uint),
+		sizeof(cl_uint),
+		&lastElement
+	);
+	queue.enqueueReadBuffer(
+		scanned,
+		CL_TRUE,
+		(n - 1) * sizeof(cl_uint),
+		sizeof(cl_uint),
+		&lastScanElement
+	);
+	return lastElement + lastScanElement;
+}
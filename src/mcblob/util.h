@@ -3,10 +3,14 @@
 
 #include "common/mathtypes.h"
 
+#include <cstdint>
 #include <cstdio>
+#include <cstdlib>
 #include <string>
 #include <iostream>
 #include <memory>
+#include <new>
+#include <vector>
 
 #include <CL/cl.hpp>
 
@@ -25,6 +29,58 @@
 */
 #define checkError(sample, reference) __checkError(sample, reference, __FILE__, __LINE__)
 
+/** Alignment of host data, page aligned memory can be used by devices
+    sharing memory with the host without copying */
+static const size_t HOST_DATA_ALIGNMENT = 4096;
+
+/**
+  \brief Allocator of page aligned memory of whole pages.
+  
+  Storage of vectors using it can be wrapped in buffers created with
+  CL_MEM_USE_HOST_PTR, which devices sharing memory with the host then use
+  in place.
+  */
+template<class T>
+struct PageAlignedAllocator {
+	typedef T value_type;
+	
+	PageAlignedAllocator() {}
+	template<class U>
+	PageAlignedAllocator(const PageAlignedAllocator<U>&) {}
+	
+	T* allocate(size_t n) {
+		if(n > (SIZE_MAX - HOST_DATA_ALIGNMENT) / sizeof(T)) {
+			throw std::bad_alloc();
+		}
+		size_t bytes = (n * sizeof(T) + HOST_DATA_ALIGNMENT - 1) /
+			HOST_DATA_ALIGNMENT * HOST_DATA_ALIGNMENT;
+		void* p;
+		if(posix_memalign(&p, HOST_DATA_ALIGNMENT, bytes) != 0) {
+			throw std::bad_alloc();
+		}
+		return static_cast<T*>(p);
+	}
+	void deallocate(T* p, size_t) {
+		free(p);
+	}
+};
+
+template<class T, class U>
+bool operator==(const PageAlignedAllocator<T>&, const PageAlignedAllocator<U>&)
+{
+	return true;
+}
+
+template<class T, class U>
+bool operator!=(const PageAlignedAllocator<T>&, const PageAlignedAllocator<U>&)
+{
+	return false;
+}
+
+/** Vector with page aligned storage, see PageAlignedAllocator */
+template<class T>
+using PageAlignedVector = std::vector<T, PageAlignedAllocator<T>>;
+
 const std::string errorString(cl_int error);
 
 std::string readSource(const std::string &filename);
@@ -35,6 +91,20 @@ cl_int buildStatus(const cl::Program& program);
 
 std::string buildLog(const cl::Program& program);
 
+bool hasUnifiedMemory(const cl::CommandQueue& queue);
+
+cl_half floatToHalf(float value);
+
+float halfToFloat(cl_half value);
+
+void forgetThroughput(const cl::Context& context);
+
+std::vector<unsigned int> splitWork(
+	unsigned int globalSize,
+	unsigned int localSize,
+	const std::vector<double>& weights
+);
+
 void run1DKernelMultipleQueues(
 	const cl::Kernel& kernel,
 	const std::vector<cl::CommandQueue>& queues,
@@ -53,6 +123,24 @@ void run1DKernelSingleQueue(
 	const std::vector<cl::Event>* events = NULL
 );
 
+void run3DKernel(
+	const cl::Kernel& kernel,
+	const cl::CommandQueue& queue,
+	const uint3& globalSize,
+	const uint3& localShape = uint3(0, 0, 0),
+	bool synchronous = false,
+	const std::vector<cl::Event>* events = NULL
+);
+
+uint3 fitWorkGroupShape(uint3 shape, size_t maxSize);
+
+cl_uint readScanTotal(
+	const cl::CommandQueue& queue,
+	cl::Buffer values,
+	cl::Buffer scanned,
+	unsigned int n
+);
+
 /**
   Dump 1D buffer to output stream.
   
@@ -0,0 +1,68 @@
+#include "config.h"
+#include "decimation.h"
+
+#include <cmath>
+
+#include "gtest/gtest.h"
+
+/**
+  Builds triangle soup of flat n x n square made of 2*n*n triangles
+  */
+static MCMesh flatSquare(int n)
+{
+	MCMesh mesh;
+	auto add = [&](float x, float y) {
+		mesh.verts.push_back(float3(x, y, 0.0f, 1.0f));
+		mesh.normals.push_back(float3(0.0f, 0.0f, 1.0f));
+	};
+	for(int i=0; i<n; i++) {
+		for(int j=0; j<n; j++) {
+			add(i, j); add(i+1, j); add(i+1, j+1);
+			add(i, j); add(i+1, j+1); add(i, j+1);
+		}
+	}
+	return mesh;
+}
+
+TEST(DecimationTest, WeldTest)
+{
+	MCMesh mesh = flatSquare(4);
+	weldVertices(mesh, 1e-4f);
+	EXPECT_EQ(mesh.verts.size(), 25u);
+	EXPECT_EQ(mesh.indices.size(), 4u*4u*6u);
+}
+
+TEST(DecimationTest, FlatSquareTest)
+{
+	const int n = 16;
+	std::vector<MCMesh> meshes{flatSquare(n), flatSquare(n)};
+	DecimationParams params;
+	params.maxError = 1e-3f;
+	decimateMeshes(meshes, params, 2);
+	
+	for(MCMesh& mesh : meshes) {
+		ASSERT_FALSE(mesh.indices.empty());
+		//Only border vertices must be left, they are locked
+		EXPECT_LT(mesh.indices.size() / 3, 2u*n*n / 4);
+		unsigned int border = 0;
+		for(const float3& v : mesh.verts) {
+			EXPECT_NEAR(v.z, 0.0f, 1e-5f);
+			if(v.x == 0.0f || v.y == 0.0f || v.x == n || v.y == n) {
+				border++;
+			}
+		}
+		EXPECT_EQ(border, 4u*n);
+	}
+}
+
+TEST(DecimationTest, TargetRatioTest)
+{
+	const int n = 16;
+	MCMesh mesh = flatSquare(n);
+	DecimationParams params;
+	params.targetRatio = 0.5f;
+	decimateMesh(mesh, params);
+	
+	EXPECT_LE(mesh.indices.size() / 3, 2u*n*n / 2);
+	EXPECT_GT(mesh.indices.size() / 3, 2u*n*n / 2 - 4);
+}
@@ -1,10 +1,21 @@
 #include "config.h"
 #include "context.h"
 #include "grid.h"
+#include "sparsegrid.h"
+#include "blob.h"
+#include "meshutil.h"
 #include "marchingcubes.h"
+#include "histopyramid.h"
+#include "pipeline.h"
+#include "tuning.h"
+#include "util.h"
 
 #include <memory>
 #include <iostream>
+#include <cmath>
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
 
 #include "gtest/gtest.h"
 #include "common-test.h"
@@ -45,3 +56,846 @@ TEST_F(MarchingCubesTest, FlatSurfaceTest)
 	
 	EXPECT_TRUE( result.verts.size() == 64*64*6);
 }
+
+TEST_F(MarchingCubesTest, ScalarFlatSurfaceTest)
+{
+	const int dimLen = 64;
+	
+	const int gridDataSliceSize = (dimLen + 1) * (dimLen + 1);
+	const int gridDataSize = (dimLen + 1) * (dimLen + 1) * (dimLen + 1);
+	
+	uint3 gridDim{dimLen};
+	float3 voxelSize{1.0f};
+	float3 startPos{0.0f};
+	
+	cl::CommandQueue queue = ctx->getQueues()[0];
+	Grid grid{gridDim, voxelSize, startPos, ctx->getClContext(), queue,
+	          ctx->getMemsetKernel(), Grid::Format::SCALAR};
+	
+	float *values = grid.getScalarValues();
+	
+	//Set first slice to all -1's
+	for(int i=0; i<gridDataSliceSize; i++) {
+		values[i] = -1.0f;
+	}
+	for(int i=gridDataSliceSize; i<gridDataSize; i++) {
+		values[i] = 1.0f;
+	}
+	
+	grid.copyToDevice();
+	
+	MCMesh result = ctx->getMcProgram()->compute(grid, 0.0f);
+	
+	ASSERT_TRUE( result.verts.size() == 64*64*6);
+	
+	//Density grows along z axis, so normals computed from central
+	//differences should point in negative z direction
+	for(float3& n : result.normals) {
+		EXPECT_NEAR(n.x, 0.0f, 1e-5f);
+		EXPECT_NEAR(n.y, 0.0f, 1e-5f);
+		EXPECT_NEAR(n.z, -1.0f, 1e-5f);
+	}
+}
+
+TEST_F(MarchingCubesTest, ReducedPrecisionFlatSurfaceTest)
+{
+	const int dimLen = 64;
+	
+	const int gridDataSliceSize = (dimLen + 1) * (dimLen + 1);
+	
+	uint3 gridDim{dimLen};
+	float3 voxelSize{1.0f};
+	float3 startPos{0.0f};
+	
+	cl::CommandQueue queue = ctx->getQueues()[0];
+	for(Grid::Format format : {Grid::Format::HALF, Grid::Format::FIXED16}) {
+		Grid grid{gridDim, voxelSize, startPos, ctx->getClContext(), queue,
+		          ctx->getMemsetKernel(), format};
+		grid.clear(1.0f);
+		
+		//Set first slice to all -1's
+		cl_short *values = static_cast<cl_short*>(grid.getRawValues());
+		cl_short minusOne = (format == Grid::Format::HALF) ?
+			floatToHalf(-1.0f) :
+			-32767 / static_cast<int>(Grid::FIXED16_RANGE);
+		for(int i=0; i<gridDataSliceSize; i++) {
+			values[i] = minusOne;
+		}
+		
+		grid.copyToDevice();
+		
+		MCMesh result = ctx->getMcProgram()->compute(grid, 0.0f);
+		
+		EXPECT_TRUE( result.verts.size() == 64*64*6);
+		for(float3& v : result.verts) {
+			EXPECT_NEAR(v.z, 0.5f, 1e-3f);
+		}
+	}
+}
+
+TEST_F(MarchingCubesTest, SparseGridTest)
+{
+	const int dimLen = 64;
+	
+	uint3 gridDim{dimLen};
+	float3 voxelSize{4.0f / dimLen};
+	float3 startPos{-2.0f, -2.0f, -2.0f, 1.0f};
+	float4 blobs[] = { {0.0f, 0.0f, 0.0f, 2.0f}, {0.5f, 0.3f, 0.0f, 1.0f} };
+	int nBlobs = sizeof(blobs) / sizeof(blobs[0]);
+	
+	cl::CommandQueue queue = ctx->getQueues()[0];
+	Grid grid{gridDim, voxelSize, startPos, ctx->getClContext(), queue,
+	          ctx->getMemsetKernel(), Grid::Format::SCALAR};
+	grid.clear();
+	ctx->getBlobProgram()->runBlob(blobs, nBlobs, grid);
+	MCMesh dense = ctx->getMcProgram()->compute(grid, 1.0f);
+	
+	SparseGrid sparseGrid{gridDim, voxelSize, startPos, ctx->getClContext(),
+	                      queue, ctx->getMemsetKernel(), Grid::Format::SCALAR};
+	ctx->getBlobProgram()->findActiveTiles(blobs, nBlobs, sparseGrid, 1.0f);
+	sparseGrid.clear();
+	ctx->getBlobProgram()->runBlob(blobs, nBlobs, sparseGrid);
+	MCMesh sparse = ctx->getMcProgram()->compute(sparseGrid, 1.0f);
+	
+	EXPECT_GT(sparseGrid.getTileCount(), 0u);
+	EXPECT_LT(sparseGrid.getTileCount(), 8u * 8u * 8u);
+	EXPECT_GT(dense.verts.size(), 0u);
+	EXPECT_EQ(dense.verts.size(), sparse.verts.size());
+}
+
+TEST_F(MarchingCubesTest, ClassifyRegionsTest)
+{
+	//Surface of single blob is a sphere with radius 1 around the origin
+	float4 blobs[] = { {0.0f, 0.0f, 0.0f, 2.0f} };
+	uint3 regionGridSize{8};
+	std::vector<cl_uchar> regions = ctx->getBlobProgram()->classifyRegions(
+		blobs, 1, float3{-2.0f, -2.0f, -2.0f, 1.0f}, regionGridSize,
+		float3{0.5f, 0.5f, 0.5f, 0.0f}, 1.0f);
+	ASSERT_EQ(regions.size(), 8u * 8u * 8u);
+	
+	auto region = [&](unsigned int x, unsigned int y, unsigned int z) {
+		return regions[(z * 8 + y) * 8 + x];
+	};
+	EXPECT_EQ(region(4, 4, 4), Blob::REGION_INSIDE);
+	EXPECT_EQ(region(0, 0, 0), Blob::REGION_OUTSIDE);
+	EXPECT_EQ(region(5, 4, 4), Blob::REGION_SURFACE);
+	
+	//Every region containing part of the sphere must be found
+	for(unsigned int z=0; z<8; z++) {
+		for(unsigned int y=0; y<8; y++) {
+			for(unsigned int x=0; x<8; x++) {
+				float lo[3], hi[3];
+				unsigned int p[] = {x, y, z};
+				float nearest = 0.0f, farthest = 0.0f;
+				for(int c=0; c<3; c++) {
+					lo[c] = -2.0f + 0.5f * p[c];
+					hi[c] = lo[c] + 0.5f;
+					float n = std::max(0.0f, std::max(lo[c], -hi[c]));
+					float f = std::max(std::fabs(lo[c]), std::fabs(hi[c]));
+					nearest += n * n;
+					farthest += f * f;
+				}
+				if(nearest < 1.0f && farthest > 1.0f) {
+					EXPECT_EQ(region(x, y, z), Blob::REGION_SURFACE);
+				}
+			}
+		}
+	}
+}
+
+TEST_F(MarchingCubesTest, BatchedTilesTest)
+{
+	//Domain of 2x2x1 blocks of 16^3 voxels, computed in one batch
+	const int blockDim = 16;
+	
+	float3 voxelSize{2.0f / blockDim};
+	float3 startPos{-2.0f, -2.0f, -1.0f, 1.0f};
+	float4 blobs[] = { {0.0f, 0.0f, 0.0f, 2.0f}, {0.5f, 0.3f, 0.0f, 1.0f} };
+	int nBlobs = sizeof(blobs) / sizeof(blobs[0]);
+	std::vector<uint3> blocks = {
+		{0, 0, 0, 0}, {0, 1, 0, 0}, {1, 0, 0, 0}, {1, 1, 0, 0}
+	};
+	
+	cl::CommandQueue queue = ctx->getQueues()[0];
+	SparseGrid batch{uint3{2 * blockDim, 2 * blockDim, blockDim, 0}, voxelSize,
+	                 startPos, ctx->getClContext(), queue,
+	                 ctx->getMemsetKernel(), Grid::Format::SCALAR, blockDim};
+	batch.setTiles(blocks);
+	batch.clear();
+	ctx->getBlobProgram()->runBlob(blobs, nBlobs, batch);
+	std::vector<MCMesh> meshes = ctx->getMcProgram()->computeTiles(batch, 1.0f);
+	ASSERT_EQ(meshes.size(), blocks.size());
+	
+	for(unsigned int b=0; b<blocks.size(); b++) {
+		float3 blockStart{
+			startPos.x + blocks[b].x * 2.0f,
+			startPos.y + blocks[b].y * 2.0f,
+			startPos.z,
+			1.0f
+		};
+		Grid grid{uint3{blockDim}, voxelSize, blockStart, ctx->getClContext(),
+		          queue, ctx->getMemsetKernel(), Grid::Format::SCALAR};
+		grid.clear();
+		ctx->getBlobProgram()->runBlob(blobs, nBlobs, grid);
+		MCMesh single = ctx->getMcProgram()->compute(grid, 1.0f);
+		
+		ASSERT_GT(single.verts.size(), 0u);
+		ASSERT_EQ(single.verts.size(), meshes[b].verts.size());
+		for(unsigned int i=0; i<single.verts.size(); i++) {
+			EXPECT_NEAR(single.verts[i].x, meshes[b].verts[i].x, 1e-4f);
+			EXPECT_NEAR(single.verts[i].y, meshes[b].verts[i].y, 1e-4f);
+			EXPECT_NEAR(single.verts[i].z, meshes[b].verts[i].z, 1e-4f);
+		}
+	}
+}
+
+TEST_F(MarchingCubesTest, ResampledFaceTest)
+{
+	float4 blobs[] = { {1.0f, 0.5f, 0.5f, 0.6f} };
+	cl::CommandQueue queue = ctx->getQueues()[0];
+	
+	//fine block [0,1]^3 next to coarse block [1,2]x[0,1]x[0,1]
+	Grid fine{uint3{32}, float3{1.0f / 32}, float3{0.0f, 0.0f, 0.0f, 1.0f},
+	          ctx->getClContext(), queue, ctx->getMemsetKernel(),
+	          Grid::Format::SCALAR};
+	Grid coarse{uint3{8}, float3{1.0f / 8}, float3{1.0f, 0.0f, 0.0f, 1.0f},
+	            ctx->getClContext(), queue, ctx->getMemsetKernel(),
+	            Grid::Format::SCALAR};
+	fine.clear();
+	coarse.clear();
+	ctx->getBlobProgram()->runBlob(blobs, 1, fine);
+	ctx->getBlobProgram()->runBlob(blobs, 1, coarse);
+	ctx->getBlobProgram()->resampleFace(fine, 0, true, 4);
+	
+	MCMesh fineMesh = ctx->getMcProgram()->compute(fine, 1.0f);
+	MCMesh coarseMesh = ctx->getMcProgram()->compute(coarse, 1.0f);
+	
+	//Every vertex of coarse mesh on the shared face must be matched
+	int checked = 0;
+	for(const float3& c : coarseMesh.verts) {
+		if(std::fabs(c.x - 1.0f) > 1e-5f) {
+			continue;
+		}
+		checked++;
+		float nearest = 1.0f;
+		for(const float3& f : fineMesh.verts) {
+			nearest = std::min(nearest,
+				std::fabs(f.x - c.x) + std::fabs(f.y - c.y) + std::fabs(f.z - c.z));
+		}
+		EXPECT_LT(nearest, 1e-4f);
+	}
+	EXPECT_GT(checked, 0);
+	EXPECT_GT(stitchFace(fineMesh, coarseMesh, 0, 1.0f, 1.0f / 8), 0u);
+}
+
+TEST_F(MarchingCubesTest, HistoPyramidTest)
+{
+	//Not cubic and not power of two, so the pyramid is padded, the second
+	//grid is flat, so its z axis is reduced to a single cell first
+	uint3 gridDims[] = { {40, 24, 33, 0}, {40, 24, 5, 0} };
+	float3 startPositions[] = { {-2.0f, -1.2f, -1.6f, 1.0f},
+	                            {-2.0f, -1.2f, -0.25f, 1.0f} };
+	float3 voxelSize{4.0f / 40};
+	float4 blobs[] = { {0.0f, 0.0f, 0.0f, 2.0f}, {0.5f, 0.3f, 0.0f, 1.0f} };
+	
+	cl::CommandQueue queue = ctx->getQueues()[0];
+	for(int g=0; g<2; g++) {
+		Grid grid{gridDims[g], voxelSize, startPositions[g],
+		          ctx->getClContext(), queue, ctx->getMemsetKernel(),
+		          Grid::Format::SCALAR};
+		grid.clear();
+		ctx->getBlobProgram()->runBlob(blobs, 2, grid);
+		
+		MCMesh mc = ctx->getMcProgram()->compute(grid, 1.0f);
+		MCMesh hp = ctx->getHpProgram()->compute(grid, 1.0f);
+		
+		//Voxels are visited in different order, so compare vertex counts
+		//and order independent sums of coordinates
+		ASSERT_GT(mc.verts.size(), 0u);
+		ASSERT_EQ(mc.verts.size(), hp.verts.size());
+		double mcSum[3] = {0.0, 0.0, 0.0};
+		double hpSum[3] = {0.0, 0.0, 0.0};
+		for(unsigned int i=0; i<mc.verts.size(); i++) {
+			for(int c=0; c<3; c++) {
+				mcSum[c] += mc.verts[i].cell[c];
+				hpSum[c] += hp.verts[i].cell[c];
+			}
+			const float3& n = hp.normals[i];
+			EXPECT_NEAR(n.x*n.x + n.y*n.y + n.z*n.z, 1.0f, 1e-4f);
+		}
+		for(int c=0; c<3; c++) {
+			EXPECT_NEAR(mcSum[c] / mc.verts.size(), hpSum[c] / hp.verts.size(), 1e-5);
+		}
+	}
+}
+
+TEST_F(MarchingCubesTest, PipelineTest)
+{
+	float4 blobs[] = { {1.0f, 0.5f, 0.5f, 0.6f} };
+	PipelineConfig config;
+	config.gridConf = uint3(3, 1, 1);
+	config.logBlockDim = 4;
+	
+	//Blob is far from the last block, which must still be passed with an
+	//empty mesh
+	Pipeline pipeline(*ctx, config);
+	std::vector<unsigned int> indices;
+	size_t verts = 0;
+	bool finished = pipeline.run(blobs, 1, [&](BlockResult& result) {
+		ASSERT_EQ(1u, result.meshes.size());
+		indices.push_back(result.index);
+		verts += result.meshes[0].verts.size();
+	});
+	EXPECT_TRUE(finished);
+	ASSERT_EQ(3u, indices.size());
+	for(unsigned int b=0; b<3; b++) {
+		EXPECT_EQ(b, indices[b]);
+	}
+	EXPECT_GT(verts, 0u);
+	
+	//Blocks computed before cancellation are still passed
+	indices.clear();
+	finished = pipeline.run(blobs, 1, [&](BlockResult& result) {
+		indices.push_back(result.index);
+		pipeline.cancel();
+	});
+	EXPECT_FALSE(finished);
+	EXPECT_EQ(1u, indices.size());
+	
+	//Cancellation before run() isn't lost, and lasts until reset
+	indices.clear();
+	finished = pipeline.run(blobs, 1, [&](BlockResult& result) {
+		indices.push_back(result.index);
+	});
+	EXPECT_FALSE(finished);
+	EXPECT_EQ(0u, indices.size());
+	pipeline.resetCancellation();
+	finished = pipeline.run(blobs, 1, [&](BlockResult& result) {
+		indices.push_back(result.index);
+	});
+	EXPECT_TRUE(finished);
+	EXPECT_EQ(3u, indices.size());
+	
+	config.sparse = true;
+	config.engine = Engine::SURFACE_NETS;
+	EXPECT_THROW(Pipeline(*ctx, config), std::runtime_error);
+	
+	config.sparse = false;
+	config.engine = Engine::MARCHING_CUBES;
+	config.isoValues = {1.0f, -0.5f};
+	EXPECT_THROW(Pipeline(*ctx, config), std::runtime_error);
+}
+
+TEST_F(MarchingCubesTest, BrickedLayoutTest)
+{
+	//Lattice not divisible into whole bricks, so the last ones are padded
+	uint3 gridDim{21, 14, 18, 0};
+	float3 voxelSize{3.0f / 21};
+	float3 startPos{-1.5f, -1.0f, -1.3f, 1.0f};
+	float4 blobs[] = { {0.0f, 0.0f, 0.0f, 2.0f}, {0.4f, 0.2f, -0.1f, 1.0f} };
+	
+	cl::CommandQueue queue = ctx->getQueues()[0];
+	Grid linear{gridDim, voxelSize, startPos, ctx->getClContext(), queue,
+	            ctx->getMemsetKernel(), Grid::Format::SCALAR};
+	Grid bricked{gridDim, voxelSize, startPos, ctx->getClContext(), queue,
+	             ctx->getMemsetKernel(), Grid::Format::SCALAR,
+	             Grid::Layout::BRICKED};
+	for(Grid* grid : {&linear, &bricked}) {
+		grid->clear();
+		ctx->getBlobProgram()->runBlob(blobs, 2, *grid);
+	}
+	
+	//Voxels are visited in the same order, so meshes must be identical
+	MCMesh linearMesh = ctx->getMcProgram()->compute(linear, 1.0f);
+	MCMesh brickedMesh = ctx->getMcProgram()->compute(bricked, 1.0f);
+	ASSERT_GT(linearMesh.verts.size(), 0u);
+	ASSERT_EQ(linearMesh.verts.size(), brickedMesh.verts.size());
+	for(unsigned int i=0; i<linearMesh.verts.size(); i++) {
+		for(int c=0; c<3; c++) {
+			EXPECT_FLOAT_EQ(linearMesh.verts[i].cell[c], brickedMesh.verts[i].cell[c]);
+			EXPECT_FLOAT_EQ(linearMesh.normals[i].cell[c], brickedMesh.normals[i].cell[c]);
+		}
+	}
+	
+	linear.copyToHost();
+	bricked.copyToHost();
+	for(cl_uint z=0; z<=gridDim.z; z++) {
+		for(cl_uint y=0; y<=gridDim.y; y++) {
+			for(cl_uint x=0; x<=gridDim.x; x++) {
+				uint3 p{x, y, z, 0};
+				ASSERT_EQ(
+					linear.getScalarValues()[linear.getPointIndex(p)],
+					bricked.getScalarValues()[bricked.getPointIndex(p)]
+				);
+			}
+		}
+	}
+}
+
+TEST_F(MarchingCubesTest, SharedSlicesTest)
+{
+	uint3 gridDim{12, 10, 8, 0};
+	float3 voxelSize{0.125f};
+	float4 blobs[] = { {0.7f, 0.6f, 1.0f, 1.2f} };
+	
+	cl::CommandQueue queue = ctx->getQueues()[0];
+	Grid first{gridDim, voxelSize, float3{0.0f, 0.0f, 0.0f, 1.0f},
+	           ctx->getClContext(), queue, ctx->getMemsetKernel(),
+	           Grid::Format::SCALAR};
+	Grid second{gridDim, voxelSize, float3{0.0f, 0.0f, 1.0f, 1.0f},
+	            ctx->getClContext(), queue, ctx->getMemsetKernel(),
+	            Grid::Format::SCALAR};
+	Grid reference{gridDim, voxelSize, float3{0.0f, 0.0f, 1.0f, 1.0f},
+	               ctx->getClContext(), queue, ctx->getMemsetKernel(),
+	               Grid::Format::SCALAR};
+	first.clear();
+	second.clear();
+	reference.clear();
+	ctx->getBlobProgram()->runBlob(blobs, 1, first);
+	ctx->getBlobProgram()->runBlob(blobs, 1, reference);
+	
+	//The last slice of the first grid is the first slice of the second one
+	second.copySlices(first, gridDim.z, 1);
+	ctx->getBlobProgram()->runBlob(blobs, 1, second, 1);
+	
+	second.copyToHost();
+	reference.copyToHost();
+	size_t points = (gridDim.x + 1) * (gridDim.y + 1) * (gridDim.z + 1);
+	for(size_t i=0; i<points; i++) {
+		ASSERT_NEAR(reference.getScalarValues()[i], second.getScalarValues()[i], 1e-5f);
+	}
+}
+
+TEST_F(MarchingCubesTest, BlobTilesTest)
+{
+	//More blobs than fit in one local memory tile and lattice not divisible
+	//into whole work groups
+	const int nBlobs = 150;
+	uint3 gridDim{7, 5, 3, 0};
+	float3 voxelSize{0.25f};
+	float3 startPos{0.0f, 0.0f, 0.0f, 1.0f};
+	std::vector<float4> blobs;
+	for(int i=0; i<nBlobs; i++) {
+		blobs.push_back(float4{
+			(i % 10) * 0.2f, (i / 10 % 5) * 0.25f, (i / 50) * 0.3f,
+			0.3f + (i % 7) * 0.05f
+		});
+	}
+	
+	cl::CommandQueue queue = ctx->getQueues()[0];
+	Grid grid{gridDim, voxelSize, startPos, ctx->getClContext(), queue,
+	          ctx->getMemsetKernel(), Grid::Format::SCALAR};
+	grid.clear();
+	ctx->getBlobProgram()->runBlob(blobs.data(), nBlobs, grid);
+	grid.copyToHost();
+	
+	for(cl_uint z=0; z<=gridDim.z; z++) {
+		for(cl_uint y=0; y<=gridDim.y; y++) {
+			for(cl_uint x=0; x<=gridDim.x; x++) {
+				float expected = 0.0f;
+				for(const float4& b : blobs) {
+					float dx = b.x - x * voxelSize.x;
+					float dy = b.y - y * voxelSize.y;
+					float dz = b.z - z * voxelSize.z;
+					float r = b.w / 2.0f;
+					expected += std::exp(1.0f - (dx*dx + dy*dy + dz*dz) / (r*r));
+				}
+				float val = grid.getScalarValues()[grid.getPointIndex(uint3{x, y, z, 0})];
+				ASSERT_NEAR(expected, val, 1e-3f * std::max(1.0f, expected));
+			}
+		}
+	}
+}
+
+TEST_F(MarchingCubesTest, WorkGroupShapesTest)
+{
+	//Grid sizes not divisible by work group shapes
+	uint3 gridDim{21, 14, 18, 0};
+	float3 voxelSize{3.0f / 21};
+	float3 startPos{-1.5f, -1.0f, -1.3f, 1.0f};
+	float4 blobs[] = { {0.0f, 0.0f, 0.0f, 2.0f}, {0.4f, 0.2f, -0.1f, 1.0f} };
+	Blob* blobProgram = ctx->getBlobProgram();
+	MarchingCubes* mcProgram = ctx->getMcProgram();
+	uint3 blobShape = blobProgram->getWorkGroupShape();
+	uint3 mcShape = mcProgram->getWorkGroupShape();
+	
+	cl::CommandQueue queue = ctx->getQueues()[0];
+	std::vector<MCMesh> meshes;
+	for(uint3 shape : {uint3(0, 0, 0), uint3(8, 8, 4), uint3(5, 3, 2)}) {
+		blobProgram->setWorkGroupShape(shape);
+		mcProgram->setWorkGroupShape(shape);
+		Grid grid{gridDim, voxelSize, startPos, ctx->getClContext(), queue,
+		          ctx->getMemsetKernel(), Grid::Format::SCALAR};
+		grid.clear();
+		blobProgram->runBlob(blobs, 2, grid);
+		meshes.push_back(mcProgram->compute(grid, 1.0f));
+	}
+	blobProgram->setWorkGroupShape(blobShape);
+	mcProgram->setWorkGroupShape(mcShape);
+	
+	ASSERT_GT(meshes[0].verts.size(), 0u);
+	for(unsigned int m=1; m<meshes.size(); m++) {
+		ASSERT_EQ(meshes[0].verts.size(), meshes[m].verts.size());
+		for(unsigned int i=0; i<meshes[0].verts.size(); i++) {
+			for(int c=0; c<3; c++) {
+				EXPECT_NEAR(meshes[0].verts[i].cell[c], meshes[m].verts[i].cell[c], 1e-5f);
+			}
+		}
+	}
+}
+
+TEST_F(MarchingCubesTest, HostRoundTripTest)
+{
+	//Values edited on host after copyToHost() must reach the device again,
+	//whether the grid copies its data or maps it
+	const int dimLen = 16;
+	const int sliceSize = (dimLen + 1) * (dimLen + 1);
+	const int dataSize = sliceSize * (dimLen + 1);
+	
+	cl::CommandQueue queue = ctx->getQueues()[0];
+	Grid grid{uint3{dimLen}, float3{1.0f}, float3{0.0f}, ctx->getClContext(),
+	          queue, ctx->getMemsetKernel(), Grid::Format::SCALAR};
+	float* values = grid.getScalarValues();
+	for(int i=0; i<dataSize; i++) {
+		values[i] = i < sliceSize ? -1.0f : 1.0f;
+	}
+	grid.copyToDevice();
+	MCMesh first = ctx->getMcProgram()->compute(grid, 0.0f);
+	
+	grid.copyToHost();
+	values = grid.getScalarValues();
+	EXPECT_EQ(-1.0f, values[0]);
+	EXPECT_EQ(1.0f, values[dataSize - 1]);
+	for(int i=sliceSize; i<2*sliceSize; i++) {
+		values[i] = -1.0f;
+	}
+	grid.copyToDevice();
+	MCMesh second = ctx->getMcProgram()->compute(grid, 0.0f);
+	
+	ASSERT_EQ(dimLen * dimLen * 6u, first.verts.size());
+	ASSERT_EQ(first.verts.size(), second.verts.size());
+	for(unsigned int i=0; i<first.verts.size(); i++) {
+		EXPECT_NEAR(0.5f, first.verts[i].z, 1e-5f);
+		EXPECT_NEAR(1.5f, second.verts[i].z, 1e-5f);
+	}
+}
+
+TEST_F(MarchingCubesTest, CompactFalloffTest)
+{
+	//Lone blob of diameter 1 has surface at distance 0.5 for iso value 1
+	//with every falloff
+	uint3 gridDim{32};
+	float3 voxelSize{1.5f / 32};
+	float3 startPos{-0.75f, -0.75f, -0.75f, 1.0f};
+	float4 blob{0.0f, 0.0f, 0.0f, 1.0f};
+	Blob* blobProgram = ctx->getBlobProgram();
+	cl::CommandQueue queue = ctx->getQueues()[0];
+	
+	for(Blob::Falloff falloff : {Blob::Falloff::WYVILL,
+	                             Blob::Falloff::MURAKAMI,
+	                             Blob::Falloff::TRUNCATED_GAUSSIAN}) {
+		blobProgram->setFalloff(falloff);
+		Grid grid{gridDim, voxelSize, startPos, ctx->getClContext(), queue,
+		          ctx->getMemsetKernel(), Grid::Format::SCALAR};
+		grid.clear();
+		blobProgram->runBlob(&blob, 1, grid);
+		MCMesh mesh = ctx->getMcProgram()->compute(grid, 1.0f);
+		ASSERT_GT(mesh.verts.size(), 0u);
+		for(const float3& v : mesh.verts) {
+			float dist = std::sqrt(v.x * v.x + v.y * v.y + v.z * v.z);
+			EXPECT_NEAR(0.5f, dist, 0.02f);
+		}
+		
+		//Region just beyond radius of influence is empty for any iso value
+		float reach = 0.5f * Blob::getSupportRatio(falloff);
+		std::vector<cl_uchar> regions = blobProgram->classifyRegions(
+			&blob, 1, float3(reach * 1.01f, 0.0f, 0.0f), uint3(1, 1, 1),
+			float3(1.0f, 1.0f, 1.0f, 0.0f), 1e-6f);
+		EXPECT_EQ(Blob::REGION_OUTSIDE, regions[0]);
+	}
+	
+	//Gaussian reaches everywhere
+	blobProgram->setFalloff(Blob::Falloff::GAUSSIAN);
+	std::vector<cl_uchar> regions = blobProgram->classifyRegions(
+		&blob, 1, float3(1.01f, 0.0f, 0.0f), uint3(1, 1, 1),
+		float3(1.0f, 1.0f, 1.0f, 0.0f), 1e-6f);
+	EXPECT_EQ(Blob::REGION_SURFACE, regions[0]);
+}
+
+TEST_F(MarchingCubesTest, SeparableBlobTest)
+{
+	//Work group boxes cut by grid borders
+	uint3 gridDim{21, 14, 18, 0};
+	float3 voxelSize{3.0f / 21};
+	float3 startPos{-1.5f, -1.0f, -1.3f, 1.0f};
+	float4 blobs[] = { {0.0f, 0.0f, 0.0f, 2.0f}, {0.4f, 0.2f, -0.1f, 1.0f},
+	                   {-0.6f, 0.3f, 0.2f, 0.8f} };
+	Blob* blobProgram = ctx->getBlobProgram();
+	cl::CommandQueue queue = ctx->getQueues()[0];
+	
+	std::vector<MCMesh> meshes;
+	for(bool separable : {false, true}) {
+		blobProgram->setSeparable(separable);
+		Grid grid{gridDim, voxelSize, startPos, ctx->getClContext(), queue,
+		          ctx->getMemsetKernel()};
+		grid.clear();
+		blobProgram->runBlob(blobs, 3, grid);
+		meshes.push_back(ctx->getMcProgram()->compute(grid, 1.0f));
+	}
+	blobProgram->setSeparable(false);
+	
+	ASSERT_GT(meshes[0].verts.size(), 0u);
+	ASSERT_EQ(meshes[0].verts.size(), meshes[1].verts.size());
+	for(unsigned int i=0; i<meshes[0].verts.size(); i++) {
+		float dot = 0.0f, len0 = 0.0f, len1 = 0.0f;
+		for(int c=0; c<3; c++) {
+			EXPECT_NEAR(meshes[0].verts[i].cell[c], meshes[1].verts[i].cell[c], 1e-3f);
+			dot += meshes[0].normals[i].cell[c] * meshes[1].normals[i].cell[c];
+			len0 += meshes[0].normals[i].cell[c] * meshes[0].normals[i].cell[c];
+			len1 += meshes[1].normals[i].cell[c] * meshes[1].normals[i].cell[c];
+		}
+		//Analytic gradient points the same way as the sampled one
+		EXPECT_GT(dot / std::sqrt(len0 * len1), 0.99f);
+	}
+}
+
+TEST_F(MarchingCubesTest, SplatBlobsTest)
+{
+	//Blobs partly outside the grid, overlapping each other
+	uint3 gridDim{21, 14, 18, 0};
+	float3 voxelSize{3.0f / 21};
+	float3 startPos{-1.5f, -1.0f, -1.3f, 1.0f};
+	float4 blobs[] = { {0.0f, 0.0f, 0.0f, 1.0f}, {0.4f, 0.2f, -0.1f, 0.8f},
+	                   {-1.4f, 0.9f, 0.2f, 0.6f} };
+	Blob* blobProgram = ctx->getBlobProgram();
+	cl::CommandQueue queue = ctx->getQueues()[0];
+	blobProgram->setFalloff(Blob::Falloff::WYVILL);
+	
+	for(Grid::Format format : {Grid::Format::SCALAR, Grid::Format::GRADIENT}) {
+		Grid gathered{gridDim, voxelSize, startPos, ctx->getClContext(), queue,
+		              ctx->getMemsetKernel(), format};
+		Grid splatted{gridDim, voxelSize, startPos, ctx->getClContext(), queue,
+		              ctx->getMemsetKernel(), format};
+		gathered.clear();
+		splatted.clear();
+		blobProgram->runBlob(blobs, 3, gathered);
+		blobProgram->setSplatting(true);
+		blobProgram->runBlob(blobs, 3, splatted);
+		blobProgram->setSplatting(false);
+		gathered.copyToHost();
+		splatted.copyToHost();
+		
+		const unsigned int dataSize = 22 * 15 * 19;
+		const unsigned int floats = format == Grid::Format::GRADIENT ? 4 : 1;
+		const float* expected = gathered.getScalarValues();
+		const float* actual = splatted.getScalarValues();
+		for(unsigned int i=0; i<dataSize * floats; i++) {
+			//Blobs are summed in different order
+			EXPECT_NEAR(expected[i], actual[i], 1e-4f);
+		}
+	}
+	blobProgram->setFalloff(Blob::Falloff::GAUSSIAN);
+}
+
+TEST_F(MarchingCubesTest, SplatSmallBlobsTest)
+{
+	//Footprints of a few lattice points, so work groups are shared by
+	//many blobs, and more blobs than fit in a single work group
+	uint3 gridDim{16, 16, 16, 0};
+	float3 voxelSize{0.125f};
+	float3 startPos{-1.0f, -1.0f, -1.0f, 1.0f};
+	std::vector<float4> blobs;
+	for(int i=0; i<300; i++) {
+		blobs.push_back(float4{
+			-1.0f + 0.0071f * i,
+			1.0f - 0.0066f * ((i * 13) % 300),
+			-1.0f + 0.0067f * ((i * 7) % 300),
+			0.15f + 0.001f * (i % 50)
+		});
+	}
+	Blob* blobProgram = ctx->getBlobProgram();
+	cl::CommandQueue queue = ctx->getQueues()[0];
+	blobProgram->setFalloff(Blob::Falloff::MURAKAMI);
+	
+	Grid gathered{gridDim, voxelSize, startPos, ctx->getClContext(), queue,
+	              ctx->getMemsetKernel(), Grid::Format::SCALAR};
+	Grid splatted{gridDim, voxelSize, startPos, ctx->getClContext(), queue,
+	              ctx->getMemsetKernel(), Grid::Format::SCALAR};
+	gathered.clear();
+	splatted.clear();
+	blobProgram->runBlob(blobs.data(), blobs.size(), gathered);
+	blobProgram->setSplatting(true);
+	blobProgram->runBlob(blobs.data(), blobs.size(), splatted);
+	blobProgram->setSplatting(false);
+	gathered.copyToHost();
+	splatted.copyToHost();
+	
+	const unsigned int dataSize = 17 * 17 * 17;
+	const float* expected = gathered.getScalarValues();
+	const float* actual = splatted.getScalarValues();
+	for(unsigned int i=0; i<dataSize; i++) {
+		EXPECT_NEAR(expected[i], actual[i], 1e-4f);
+	}
+	blobProgram->setFalloff(Blob::Falloff::GAUSSIAN);
+}
+
+TEST_F(MarchingCubesTest, BlobUploadTest)
+{
+	//Blobs modified in place at the same address must not be taken from
+	//the previous upload
+	uint3 gridDim{8};
+	float3 voxelSize{0.25f};
+	float3 startPos{-1.0f, -1.0f, -1.0f, 1.0f};
+	Blob* blobProgram = ctx->getBlobProgram();
+	cl::CommandQueue queue = ctx->getQueues()[0];
+	std::vector<float> results[2];
+	float4 blobs[] = { {0.0f, 0.0f, 0.0f, 1.0f} };
+	for(int run=0; run<2; run++) {
+		Grid grid{gridDim, voxelSize, startPos, ctx->getClContext(), queue,
+		          ctx->getMemsetKernel(), Grid::Format::SCALAR};
+		grid.clear();
+		blobProgram->runBlob(blobs, 1, grid);
+		grid.copyToHost();
+		results[run].assign(grid.getScalarValues(), grid.getScalarValues() + 9 * 9 * 9);
+		blobs[0].x = 0.5f;
+	}
+	
+	float4 moved[] = { {0.5f, 0.0f, 0.0f, 1.0f} };
+	Grid grid{gridDim, voxelSize, startPos, ctx->getClContext(), queue,
+	          ctx->getMemsetKernel(), Grid::Format::SCALAR};
+	grid.clear();
+	blobProgram->runBlob(moved, 1, grid);
+	grid.copyToHost();
+	for(int i=0; i<9 * 9 * 9; i++) {
+		EXPECT_NEAR(grid.getScalarValues()[i], results[1][i], 1e-5f);
+	}
+	EXPECT_NE(results[0][4 * 81 + 4 * 9 + 6], results[1][4 * 81 + 4 * 9 + 6]);
+}
+
+TEST_F(MarchingCubesTest, StreamingPipelineTest)
+{
+	float4 blobs[] = { {0.5f, 0.5f, 0.5f, 0.6f}, {0.7f, 0.4f, 0.5f, 0.4f} };
+	PipelineConfig config;
+	config.logBlockDim = 4;
+	config.prepass = false;
+	
+	size_t blockVerts = 0;
+	Pipeline blockPipeline(*ctx, config);
+	blockPipeline.run(blobs, 2, [&](BlockResult& result) {
+		blockVerts += result.meshes[0].verts.size();
+	});
+	
+	//The same lattice computed in two slabs of 8 voxels
+	config.streaming = true;
+	Pipeline slabPipeline(*ctx, config);
+	ASSERT_EQ(2u, slabPipeline.getSlabCount());
+	size_t slabVerts = 0;
+	unsigned int slabs = 0;
+	slabPipeline.run(blobs, 2, [&](BlockResult& result) {
+		EXPECT_EQ(slabs++, result.index);
+		slabVerts += result.meshes[0].verts.size();
+	});
+	EXPECT_EQ(2u, slabs);
+	EXPECT_GT(blockVerts, 0u);
+	EXPECT_EQ(blockVerts, slabVerts);
+	
+	//Normals of scalar formats would be one-sided on slab borders
+	config.gridFormat = Grid::Format::SCALAR;
+	EXPECT_THROW(Pipeline(*ctx, config), std::runtime_error);
+}
+
+TEST(FitDomainTest, SnapsToBlockLattice)
+{
+	float4 blobs[] = { {2.2f, 0.5f, -3.4f, 0.4f}, {3.1f, 0.6f, -3.0f, 0.2f} };
+	PipelineConfig config;
+	config.startPoint = float3(0.0f, 0.0f, 0.0f);
+	config.gridConf = uint3(100, 100, 100);
+	config.blockSize = float3(1.0f, 1.0f, 1.0f);
+	config.logBlockDim = 5;
+	fitDomain(config, blobs, 2, 2);
+	
+	//Blobs reach about 1.0 diameter beyond centers for iso 1.0, as each of
+	//them may add only half of the cutoff
+	EXPECT_EQ(5u, config.logBlockDim);
+	EXPECT_FLOAT_EQ(1.0f, config.startPoint.x);
+	EXPECT_FLOAT_EQ(0.0f, config.startPoint.y);
+	EXPECT_FLOAT_EQ(-4.0f, config.startPoint.z);
+	EXPECT_EQ(3u, config.gridConf.x);
+	EXPECT_EQ(1u, config.gridConf.y);
+	EXPECT_EQ(2u, config.gridConf.z);
+	
+	//Single small blob fits in half of a block, voxel size is kept
+	config.startPoint = float3(0.0f, 0.0f, 0.0f);
+	fitDomain(config, blobs + 1, 1);
+	EXPECT_EQ(4u, config.logBlockDim);
+	EXPECT_FLOAT_EQ(0.5f, config.blockSize.x);
+	EXPECT_FLOAT_EQ(2.5f, config.startPoint.x);
+	EXPECT_EQ(2u, config.gridConf.x);
+	
+	//Density is positive everywhere, so there is no box for iso <= 0
+	config.isoValues = {0.5f, 0.0f};
+	EXPECT_THROW(fitDomain(config, blobs, 2), std::runtime_error);
+}
+
+TEST(TuningTest, FileRoundTrip)
+{
+	const char path[] = "tuning-test.tuning";
+	KernelTuning saved;
+	saved.blobGroupSize = 128;
+	saved.blobGroupShape = uint3(16, 4, 2);
+	saved.classifyGroupSize = 64;
+	saved.classifyGroupShape = uint3(0, 0, 0);
+	saved.compactGroupSize = 256;
+	saved.generateGroupSize = 16;
+	saved.gridLayout = Grid::Layout::BRICKED;
+	saveTuning(path, saved);
+	
+	KernelTuning loaded{};
+	ASSERT_TRUE(loadTuning(path, loaded));
+	EXPECT_EQ(128u, loaded.blobGroupSize);
+	EXPECT_EQ(16u, loaded.blobGroupShape.x);
+	EXPECT_EQ(4u, loaded.blobGroupShape.y);
+	EXPECT_EQ(2u, loaded.blobGroupShape.z);
+	EXPECT_EQ(64u, loaded.classifyGroupSize);
+	EXPECT_EQ(0u, loaded.classifyGroupShape.x);
+	EXPECT_EQ(256u, loaded.compactGroupSize);
+	EXPECT_EQ(16u, loaded.generateGroupSize);
+	EXPECT_EQ(Grid::Layout::BRICKED, loaded.gridLayout);
+	
+	//Parameters missing in the file are kept
+	std::ofstream(path) << "compactGroupSize 32\nunknownParameter 1\n";
+	ASSERT_TRUE(loadTuning(path, loaded));
+	EXPECT_EQ(32u, loaded.compactGroupSize);
+	EXPECT_EQ(128u, loaded.blobGroupSize);
+	
+	//Empty work groups are rejected and nothing is loaded
+	std::ofstream(path) << "blobGroupSize 8\ngenerateGroupSize 0\n";
+	EXPECT_THROW(loadTuning(path, loaded), std::runtime_error);
+	std::ofstream(path) << "blobGroupShape 8 0 4\n";
+	EXPECT_THROW(loadTuning(path, loaded), std::runtime_error);
+	EXPECT_EQ(128u, loaded.blobGroupSize);
+	EXPECT_EQ(16u, loaded.generateGroupSize);
+	std::remove(path);
+	
+	EXPECT_FALSE(loadTuning(path, loaded));
+}
+
+TEST(SplitWorkTest, ProportionalToWeights)
+{
+	std::vector<unsigned int> sizes = splitWork(1000, 0, {1.0, 3.0});
+	ASSERT_EQ(2u, sizes.size());
+	EXPECT_EQ(250u, sizes[0]);
+	EXPECT_EQ(750u, sizes[1]);
+	
+	//Every part but the last made of whole work groups
+	sizes = splitWork(1000, 64, {1.0, 1.0, 2.0});
+	ASSERT_EQ(3u, sizes.size());
+	EXPECT_EQ(192u, sizes[0]);
+	EXPECT_EQ(192u, sizes[1]);
+	EXPECT_EQ(616u, sizes[2]);
+	
+	//Too little work for the slow device
+	sizes = splitWork(100, 64, {1.0, 10.0});
+	EXPECT_EQ(0u, sizes[0]);
+	EXPECT_EQ(100u, sizes[1]);
+}
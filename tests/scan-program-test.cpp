@@ -71,3 +71,15 @@ TEST_F(ScanTest, LongArrayTest)
 	EXPECT_TRUE(run_test(in_array.get(), ARRAY_SIZE));
 	
 }
+
+TEST_F(ScanTest, ArbitrarySizeTest)
+{
+	static const int sizes[] = { 3, 1000, 1025, 5000, 300000, 1234567 };
+	for(int size : sizes) {
+		std::unique_ptr<uint[]> in_array{new uint[size]};
+		for(int i=0; i<size; i++) {
+			in_array.get()[i] = i % 7;
+		}
+		EXPECT_TRUE(run_test(in_array.get(), size)) << "size " << size;
+	}
+}
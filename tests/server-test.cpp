@@ -0,0 +1,80 @@
+#include "config.h"
+#include "server.h"
+
+#include <thread>
+#include <chrono>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+
+#include "gtest/gtest.h"
+
+using namespace std;
+
+static const string sSocketPath = "mcblob-server-test.sock";
+
+/**
+  Starts server which fails jobs with "fail" argument and checks
+  everything else it got. Server never returns, so its thread is detached.
+  */
+static void start_server()
+{
+	static bool started = false;
+	if(started) {
+		return;
+	}
+	started = true;
+	thread server([]() {
+		serveJobs(sSocketPath, [](const JobRequest& request) {
+			if(request.args.size() == 1 && request.args[0] == "fail") {
+				throw runtime_error("job failed");
+			}
+			if(request.workingDirectory != "/work" ||
+			   request.args.size() != 2 || request.args[1] != "-o" ||
+			   request.data != "inline\ndata\n") {
+				throw runtime_error("malformed request");
+			}
+		});
+	});
+	server.detach();
+}
+
+static void submit_with_retry(const JobRequest& request)
+{
+	//Server may not be listening yet
+	for(int i=0; ; i++) {
+		try {
+			submitJob(sSocketPath, request);
+			return;
+		} catch(runtime_error& e) {
+			if(string(e.what()).find("Can't connect") != 0 || i == 100) {
+				throw;
+			}
+			this_thread::sleep_for(chrono::milliseconds(10));
+		}
+	}
+}
+
+TEST(ServerTest, RoundTripTest)
+{
+	start_server();
+	JobRequest request;
+	request.workingDirectory = "/work";
+	request.args = {"--engine=mc", "-o"};
+	request.data = "inline\ndata\n";
+	EXPECT_NO_THROW(submit_with_retry(request));
+}
+
+TEST(ServerTest, ErrorTest)
+{
+	start_server();
+	JobRequest request;
+	request.workingDirectory = "/work";
+	request.args = {"fail"};
+	try {
+		submit_with_retry(request);
+		FAIL() << "Error of the job not reported";
+	} catch(runtime_error& e) {
+		EXPECT_EQ(string(e.what()), "job failed");
+	}
+}
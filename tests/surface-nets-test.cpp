@@ -0,0 +1,84 @@
+#include "config.h"
+#include "context.h"
+#include "grid.h"
+#include "blob.h"
+#include "marchingcubes.h"
+#include "surfacenets.h"
+
+#include <memory>
+#include <iostream>
+
+#include "gtest/gtest.h"
+#include "common-test.h"
+
+class SurfaceNetsTest : public CommonTest
+{
+};
+
+TEST_F(SurfaceNetsTest, FlatSurfaceTest)
+{
+	const int dimLen = 64;
+	
+	const int gridDataSliceSize = (dimLen + 1) * (dimLen + 1);
+	const int gridDataSize = (dimLen + 1) * (dimLen + 1) * (dimLen + 1);
+	
+	uint3 gridDim{dimLen};
+	float3 voxelSize{1.0f};
+	float3 startPos{0.0f};
+	
+	cl::CommandQueue queue = ctx->getQueues()[0];
+	Grid grid{gridDim, voxelSize, startPos, ctx->getClContext(), queue,
+	          ctx->getMemsetKernel(), Grid::Format::SCALAR};
+	
+	float *values = grid.getScalarValues();
+	
+	//Set first slice to all -1's
+	for(int i=0; i<gridDataSliceSize; i++) {
+		values[i] = -1.0f;
+	}
+	for(int i=gridDataSliceSize; i<gridDataSize; i++) {
+		values[i] = 1.0f;
+	}
+	
+	grid.copyToDevice();
+	
+	for(bool dualContouring : {false, true}) {
+		MCMesh result = ctx->getSurfaceNetsProgram()->compute(
+			grid, 0.0f, dualContouring);
+		
+		//One vertex per voxel of the first slice, quads between them
+		ASSERT_EQ(result.verts.size(), 64u*64u);
+		ASSERT_EQ(result.indices.size(), 63u*63u*6u);
+		for(unsigned int i=0; i<result.verts.size(); i++) {
+			EXPECT_NEAR(result.verts[i].z, 0.5f, 1e-5f);
+			EXPECT_NEAR(result.normals[i].z, -1.0f, 1e-5f);
+		}
+	}
+}
+
+TEST_F(SurfaceNetsTest, TriangleCountTest)
+{
+	const int dimLen = 64;
+	
+	uint3 gridDim{dimLen};
+	float3 voxelSize{4.0f / dimLen};
+	float3 startPos{-2.0f, -2.0f, -2.0f, 1.0f};
+	float4 blobs[] = { {0.0f, 0.0f, 0.0f, 2.0f}, {0.5f, 0.3f, 0.0f, 1.0f} };
+	
+	cl::CommandQueue queue = ctx->getQueues()[0];
+	Grid grid{gridDim, voxelSize, startPos, ctx->getClContext(), queue,
+	          ctx->getMemsetKernel(), Grid::Format::GRADIENT};
+	grid.clear();
+	ctx->getBlobProgram()->runBlob(blobs, 2, grid);
+	
+	MCMesh mc = ctx->getMcProgram()->compute(grid, 1.0f);
+	MCMesh sn = ctx->getSurfaceNetsProgram()->compute(grid, 1.0f);
+	MCMesh dc = ctx->getSurfaceNetsProgram()->compute(grid, 1.0f, true);
+	
+	ASSERT_GT(mc.verts.size(), 0u);
+	EXPECT_LT(sn.indices.size(), mc.verts.size() * 3 / 4);
+	EXPECT_EQ(sn.indices.size(), dc.indices.size());
+	for(unsigned int i : dc.indices) {
+		ASSERT_LT(i, dc.verts.size());
+	}
+}